@@ -1,6 +1,7 @@
 #include "config.hpp"
 #include "adjacent-matrix.hpp"
 #include "dedge.hpp"
+#include "parallel.hpp"
 #include <fstream>
 
 namespace qflow {
@@ -9,14 +10,11 @@ void generate_adjacency_matrix_uniform(
 	const MatrixXi &F, const VectorXi &V2E, const VectorXi &E2E,
 	const VectorXi &nonManifold, AdjacentMatrix& adj) {
 	adj.resize(V2E.size());
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-	for (int i = 0; i < adj.size(); ++i) {
+	parallel_for(0, adj.size(), [&](int i) {
 		int start = V2E[i];
 		int edge = start;
 		if (start == -1)
-			continue;
+			return;
 		do {
 			int base = edge % 3, f = edge / 3;
 			int opp = E2E[edge], next = dedge_next_3(opp);
@@ -29,7 +27,7 @@ void generate_adjacency_matrix_uniform(
 			}
 			edge = next;
 		} while (edge != start);
-	}
+	});
 }
 
 } // namespace qflow
@@ -0,0 +1,100 @@
+#include "bvh.hpp"
+
+#include "parallel.hpp"
+
+namespace qflow {
+
+static const int LEAF_SIZE = 4;
+static const int PARALLEL_BUILD_SIZE = 4096;
+
+Vector3d closest_point_on_triangle(const Vector3d& p, const Vector3d& a, const Vector3d& b,
+                                   const Vector3d& c) {
+    // Voronoi regions of the vertices and edges, see Ericson, Real-Time Collision Detection 5.1.5
+    Vector3d ab = b - a, ac = c - a, ap = p - a;
+    double d1 = ab.dot(ap), d2 = ac.dot(ap);
+    if (d1 <= 0 && d2 <= 0) return a;
+    Vector3d bp = p - b;
+    double d3 = ab.dot(bp), d4 = ac.dot(bp);
+    if (d3 >= 0 && d4 <= d3) return b;
+    double vc = d1 * d4 - d3 * d2;
+    if (vc <= 0 && d1 >= 0 && d3 <= 0) return a + d1 / (d1 - d3) * ab;
+    Vector3d cp = p - c;
+    double d5 = ab.dot(cp), d6 = ac.dot(cp);
+    if (d6 >= 0 && d5 <= d6) return c;
+    double vb = d5 * d2 - d1 * d6;
+    if (vb <= 0 && d2 >= 0 && d6 <= 0) return a + d2 / (d2 - d6) * ac;
+    double va = d3 * d6 - d5 * d4;
+    if (va <= 0 && (d4 - d3) >= 0 && (d5 - d6) >= 0)
+        return b + (d4 - d3) / ((d4 - d3) + (d5 - d6)) * (c - b);
+    double denom = va + vb + vc;
+    if (denom <= 0) return a;  // degenerate triangle
+    return a + ab * (vb / denom) + ac * (vc / denom);
+}
+
+int TriangleBVH::subtree_nodes(int count) {
+    if (count <= LEAF_SIZE) return 1;
+    auto it = num_subtree_nodes.find(count);
+    if (it != num_subtree_nodes.end()) return it->second;
+    int num = 1 + subtree_nodes(count / 2) + subtree_nodes(count - count / 2);
+    num_subtree_nodes[count] = num;
+    return num;
+}
+
+void TriangleBVH::build(const MatrixXi& F, const MatrixXd& V) {
+    this->F = &F;
+    this->V = &V;
+    int num = F.cols();
+    triangles.resize(num);
+    centroids.resize(num);
+    normals.resize(num);
+    parallel_for(0, num, [&](int f) {
+        Vector3d a = V.col(F(0, f)), b = V.col(F(1, f)), c = V.col(F(2, f));
+        triangles[f] = f;
+        centroids[f] = (a + b + c) / 3.0;
+        normals[f] = (b - a).cross(c - a).normalized();
+    });
+    nodes.clear();
+    if (num == 0) return;
+    // the sizes at each depth differ by at most one, so this only visits a few counts
+    num_subtree_nodes.clear();
+    nodes.resize(subtree_nodes(num));
+    build_node(0, 0, num);
+}
+
+void TriangleBVH::build_node(int node, int start, int count) {
+    Node& n = nodes[node];
+    if (count <= LEAF_SIZE) {
+        n.box.setEmpty();
+        for (int i = start; i < start + count; ++i) {
+            for (int k = 0; k < 3; ++k) n.box.extend(V->col((*F)(k, triangles[i])));
+        }
+        n.start = start;
+        n.count = count;
+        return;
+    }
+    AlignedBox3d centroid_box;
+    for (int i = start; i < start + count; ++i) centroid_box.extend(centroids[triangles[i]]);
+    int axis;
+    centroid_box.sizes().maxCoeff(&axis);
+    int half = count / 2;
+    auto begin = triangles.begin() + start;
+    std::nth_element(begin, begin + half, begin + count, [&](int a, int b) {
+        double ca = centroids[a][axis], cb = centroids[b][axis];
+        return ca < cb || (ca == cb && a < b);
+    });
+    int left = node + 1;
+    n.count = 0;
+    n.right = left + (half <= LEAF_SIZE ? 1 : num_subtree_nodes.at(half));
+    if (count >= PARALLEL_BUILD_SIZE) {
+        TaskGroup group;
+        group.run([&]() { build_node(left, start, half); });
+        build_node(n.right, start + half, count - half);
+        group.wait();
+    } else {
+        build_node(left, start, half);
+        build_node(n.right, start + half, count - half);
+    }
+    n.box = nodes[left].box.merged(nodes[n.right].box);
+}
+
+} // namespace qflow
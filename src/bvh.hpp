@@ -0,0 +1,94 @@
+#ifndef BVH_H_
+#define BVH_H_
+
+#include <Eigen/Core>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <vector>
+
+namespace qflow {
+
+using namespace Eigen;
+
+// Closest point to |p| on the triangle (a, b, c)
+Vector3d closest_point_on_triangle(const Vector3d& p, const Vector3d& a, const Vector3d& b,
+                                   const Vector3d& c);
+
+// Bounding volume hierarchy over the triangles of a mesh, split at the median centroid along the
+// longest axis. The node layout only depends on the triangle count, so subtrees are built in
+// parallel into their final slots.
+class TriangleBVH {
+   public:
+    void build(const MatrixXi& F, const MatrixXd& V);
+
+    // Closest point to |p| over the triangles accepted by |filter(f)| and nearer than
+    // sqrt(|max_distance2|). Returns the face, or -1 if there is none.
+    template <class Filter>
+    int closest_point(const Vector3d& p, const Filter& filter, Vector3d& closest,
+                      double max_distance2 = std::numeric_limits<double>::infinity()) const;
+    int closest_point(const Vector3d& p, Vector3d& closest) const {
+        return closest_point(p, [](int) { return true; }, closest);
+    }
+
+    const Vector3d& face_normal(int f) const { return normals[f]; }
+
+   private:
+    struct Node {
+        AlignedBox3d box;
+        int start, count;  // triangles of a leaf
+        int right;         // right child of an inner node, the left one follows the node
+    };
+    void build_node(int node, int start, int count);
+    int subtree_nodes(int count);
+
+    const MatrixXi* F = 0;
+    const MatrixXd* V = 0;
+    std::vector<Node> nodes;
+    std::vector<int> triangles;
+    std::vector<Vector3d> centroids, normals;
+    std::map<int, int> num_subtree_nodes;  // node count of a subtree over n triangles
+};
+
+template <class Filter>
+int TriangleBVH::closest_point(const Vector3d& p, const Filter& filter, Vector3d& closest,
+                               double max_distance2) const {
+    int face = -1;
+    double best = max_distance2;
+    if (nodes.empty()) return face;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node& node = nodes[stack[--top]];
+        if (node.box.squaredExteriorDistance(p) >= best) continue;
+        if (node.count > 0) {
+            for (int i = node.start; i < node.start + node.count; ++i) {
+                int f = triangles[i];
+                if (!filter(f)) continue;
+                Vector3d q = closest_point_on_triangle(p, V->col((*F)(0, f)), V->col((*F)(1, f)),
+                                                       V->col((*F)(2, f)));
+                double dis = (q - p).squaredNorm();
+                if (dis < best) {
+                    best = dis;
+                    face = f;
+                    closest = q;
+                }
+            }
+            continue;
+        }
+        int left = &node - nodes.data() + 1, right = node.right;
+        // visit the nearer child first
+        double dis_left = nodes[left].box.squaredExteriorDistance(p);
+        double dis_right = nodes[right].box.squaredExteriorDistance(p);
+        if (dis_left < dis_right) std::swap(left, right);
+        stack[top++] = left;
+        stack[top++] = right;
+    }
+    return face;
+}
+
+} // namespace qflow
+
+#endif
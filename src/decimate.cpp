@@ -0,0 +1,291 @@
+#include "decimate.hpp"
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+#include <algorithm>
+#include <queue>
+#include <vector>
+
+#include "dedge.hpp"
+#include "parallel.hpp"
+
+namespace qflow {
+
+// Squared distance p^T A p + 2 b^T p + c to a set of area weighted planes
+struct Quadric {
+    Quadric() : A(Matrix3d::Zero()), b(Vector3d::Zero()), c(0) {}
+    void add_plane(const Vector3d& n, double d, double weight) {
+        A += weight * n * n.transpose();
+        b += weight * d * n;
+        c += weight * d * d;
+    }
+    Quadric& operator+=(const Quadric& q) {
+        A += q.A;
+        b += q.b;
+        c += q.c;
+        return *this;
+    }
+    double error(const Vector3d& p) const { return p.dot(A * p) + 2 * b.dot(p) + c; }
+
+    Matrix3d A;
+    Vector3d b;
+    double c;
+};
+
+// Position of the vertex that replaces the edge (p0, p1) and its error. The minimizer of the
+// quadric is used if it is unique and close to the edge, otherwise the best of the midpoint and
+// the two ends.
+static double collapse_position(const Quadric& q, const Vector3d& p0, const Vector3d& p1,
+                                Vector3d& p) {
+    FullPivLU<Matrix3d> lu(q.A);
+    lu.setThreshold(1e-6);
+    if (lu.rank() == 3) {
+        p = lu.solve(-q.b);
+        if ((p - 0.5 * (p0 + p1)).squaredNorm() <= (p1 - p0).squaredNorm()) return q.error(p);
+    }
+    Vector3d candidates[3] = {0.5 * (p0 + p1), p0, p1};
+    double best = 1e30;
+    for (auto& candidate : candidates) {
+        double error = q.error(candidate);
+        if (error < best) {
+            best = error;
+            p = candidate;
+        }
+    }
+    return best;
+}
+
+struct Collapse {
+    double cost;
+    int v0, v1;
+    int stamp0, stamp1;
+    Vector3d p;
+};
+
+// the cheapest collapse first, ties broken by the vertices
+struct CollapseOrder {
+    bool operator()(const Collapse& a, const Collapse& b) const {
+        if (a.cost != b.cost) return a.cost > b.cost;
+        if (a.v0 != b.v0) return a.v0 > b.v0;
+        return a.v1 > b.v1;
+    }
+};
+
+int decimate(MatrixXi& F, MatrixXd& V, double target_length) {
+    // collapse the edges below 4/5 of the target length, without creating edges above 4/3 of it
+    const double max_collapse_length = 0.8 * target_length;
+    const double max_edge_length = 4.0 / 3.0 * target_length;
+    const double cell_size = 8 * target_length;
+    const int max_passes = 8;
+
+    int num_collapses = 0;
+    for (int pass = 0; pass < max_passes; ++pass) {
+        VectorXi V2E, E2E, boundary, nonManifold;
+        while (!compute_direct_graph(V, F, V2E, E2E, boundary, nonManifold))
+            ;
+        int num_v = V.cols(), num_f = F.cols();
+        std::vector<std::vector<int>> vertex_faces(num_v);
+        for (int f = 0; f < num_f; ++f) {
+            for (int j = 0; j < 3; ++j) vertex_faces[F(j, f)].push_back(f);
+        }
+        std::vector<Quadric> quadrics(num_v);
+        parallel_for(0, num_v, [&](int v) {
+            for (int f : vertex_faces[v]) {
+                Vector3d p0 = V.col(F(0, f)), p1 = V.col(F(1, f)), p2 = V.col(F(2, f));
+                Vector3d n = (p1 - p0).cross(p2 - p0);
+                double area = n.norm();
+                if (area == 0) continue;
+                n /= area;
+                quadrics[v].add_plane(n, -n.dot(p0), 0.5 * area);
+            }
+        });
+
+        // the vertices grouped by cell, in vertex order within a cell
+        AlignedBox3d box;
+        for (int v = 0; v < num_v; ++v) box.extend(Vector3d(V.col(v)));
+        Vector3d origin = box.min() - Vector3d::Constant((pass % 2) * 0.5 * cell_size);
+        Vector3i dims = ((box.max() - origin) / cell_size).cast<int>() + Vector3i::Ones();
+        std::vector<std::pair<int64_t, int>> cells(num_v);
+        parallel_for(0, num_v, [&](int v) {
+            Vector3i c = ((V.col(v) - origin) / cell_size).cast<int>();
+            cells[v] = std::make_pair(((int64_t)c[0] * dims[1] + c[1]) * dims[2] + c[2], v);
+        });
+        parallel_stable_sort(cells, [](const std::pair<int64_t, int>& a,
+                                       const std::pair<int64_t, int>& b) {
+            return a.first < b.first;
+        });
+        std::vector<int> region(num_v), region_begin;
+        for (int i = 0; i < num_v; ++i) {
+            if (i == 0 || cells[i].first != cells[i - 1].first) region_begin.push_back(i);
+            region[cells[i].second] = region_begin.size() - 1;
+        }
+        int num_regions = region_begin.size();
+        region_begin.push_back(num_v);
+
+        // a vertex is collapsed only if its one-ring lies in its cell, so the cells touch
+        // disjoint faces and vertices
+        std::vector<char> inside(num_v);
+        parallel_for(0, num_v, [&](int v) {
+            if (boundary[v] || nonManifold[v] || vertex_faces[v].empty()) return;
+            for (int f : vertex_faces[v]) {
+                for (int j = 0; j < 3; ++j) {
+                    if (region[F(j, f)] != region[v]) return;
+                }
+            }
+            inside[v] = 1;
+        });
+
+        std::vector<char> face_alive(num_f, 1), vertex_alive(num_v, 1);
+        std::vector<int> stamp(num_v, 0);
+        std::vector<int> region_collapses(num_regions, 0);
+        parallel_for(0, num_regions, [&](int r) {
+            std::priority_queue<Collapse, std::vector<Collapse>, CollapseOrder> queue;
+            auto push = [&](int v0, int v1) {
+                if (v0 > v1) std::swap(v0, v1);
+                Vector3d p0 = V.col(v0), p1 = V.col(v1);
+                if ((p1 - p0).norm() >= max_collapse_length) return;
+                Quadric q = quadrics[v0];
+                q += quadrics[v1];
+                Collapse collapse;
+                collapse.cost = collapse_position(q, p0, p1, collapse.p);
+                collapse.v0 = v0;
+                collapse.v1 = v1;
+                collapse.stamp0 = stamp[v0];
+                collapse.stamp1 = stamp[v1];
+                queue.push(collapse);
+            };
+            auto neighbors = [&](int v, std::vector<int>& result) {
+                result.clear();
+                for (int f : vertex_faces[v]) {
+                    for (int j = 0; j < 3; ++j) {
+                        if (F(j, f) != v) result.push_back(F(j, f));
+                    }
+                }
+                std::sort(result.begin(), result.end());
+                result.erase(std::unique(result.begin(), result.end()), result.end());
+            };
+            for (int i = region_begin[r]; i < region_begin[r + 1]; ++i) {
+                int v = cells[i].second;
+                if (!inside[v]) continue;
+                for (int f : vertex_faces[v]) {
+                    for (int j = 0; j < 3; ++j) {
+                        int w = F((j + 1) % 3, f);
+                        if (F(j, f) == v && v < w && inside[w]) push(v, w);
+                    }
+                }
+            }
+
+            std::vector<int> ring0, ring1, common, ring;
+            while (!queue.empty()) {
+                Collapse collapse = queue.top();
+                queue.pop();
+                int a = collapse.v0, b = collapse.v1;
+                if (!vertex_alive[a] || !vertex_alive[b] || stamp[a] != collapse.stamp0 ||
+                    stamp[b] != collapse.stamp1)
+                    continue;
+                const Vector3d& p = collapse.p;
+
+                // the link condition: the edge is shared by two faces and the two opposite
+                // vertices keep at least three neighbors
+                neighbors(a, ring0);
+                neighbors(b, ring1);
+                common.clear();
+                std::set_intersection(ring0.begin(), ring0.end(), ring1.begin(), ring1.end(),
+                                      std::back_inserter(common));
+                if (common.size() != 2) continue;
+                bool valid = true;
+                for (int c : common) {
+                    neighbors(c, ring);
+                    if (ring.size() <= 3) valid = false;
+                }
+                // the new edges stay short
+                for (auto* ring_ab : {&ring0, &ring1}) {
+                    for (int v : *ring_ab) {
+                        if (v != a && v != b && (V.col(v) - p).norm() > max_edge_length)
+                            valid = false;
+                    }
+                }
+                // and no face turns over
+                for (int v : {a, b}) {
+                    for (int f : vertex_faces[v]) {
+                        Vector3d q[3];
+                        bool shared = false;
+                        for (int j = 0; j < 3; ++j) {
+                            int w = F(j, f);
+                            shared |= (w == a || w == b) && w != v;
+                            q[j] = (w == v) ? p : Vector3d(V.col(w));
+                        }
+                        if (shared) continue;
+                        Vector3d p0 = V.col(F(0, f)), p1 = V.col(F(1, f)), p2 = V.col(F(2, f));
+                        Vector3d n0 = (p1 - p0).cross(p2 - p0);
+                        Vector3d n1 = (q[1] - q[0]).cross(q[2] - q[0]);
+                        if (n0.dot(n1) <= 0.2 * n0.norm() * n1.norm() || n1.norm() == 0)
+                            valid = false;
+                    }
+                }
+                if (!valid) continue;
+
+                // b is merged into a
+                for (int f : vertex_faces[b]) {
+                    bool shared = false;
+                    for (int j = 0; j < 3; ++j) shared |= F(j, f) == a;
+                    if (shared) {
+                        face_alive[f] = 0;
+                        continue;
+                    }
+                    for (int j = 0; j < 3; ++j) {
+                        if (F(j, f) == b) F(j, f) = a;
+                    }
+                    vertex_faces[a].push_back(f);
+                }
+                for (int v : {a, common[0], common[1]}) {
+                    auto& faces = vertex_faces[v];
+                    faces.erase(std::remove_if(faces.begin(), faces.end(),
+                                               [&](int f) { return !face_alive[f]; }),
+                                faces.end());
+                }
+                vertex_faces[b].clear();
+                vertex_alive[b] = 0;
+                V.col(a) = p;
+                quadrics[a] += quadrics[b];
+                stamp[a] += 1;
+                region_collapses[r] += 1;
+                neighbors(a, ring);
+                for (int w : ring) {
+                    if (inside[w]) push(a, w);
+                }
+            }
+        }, 1);
+
+        int pass_collapses = 0;
+        for (int r = 0; r < num_regions; ++r) pass_collapses += region_collapses[r];
+        num_collapses += pass_collapses;
+
+        std::vector<int> vertex_id(num_v, -1);
+        int num_new_v = 0, num_new_f = 0;
+        for (int v = 0; v < num_v; ++v) {
+            if (vertex_alive[v]) vertex_id[v] = num_new_v++;
+        }
+        for (int f = 0; f < num_f; ++f) num_new_f += face_alive[f];
+        MatrixXd new_V(3, num_new_v);
+        MatrixXi new_F(3, num_new_f);
+        for (int v = 0; v < num_v; ++v) {
+            if (vertex_alive[v]) new_V.col(vertex_id[v]) = V.col(v);
+        }
+        for (int f = 0, id = 0; f < num_f; ++f) {
+            if (!face_alive[f]) continue;
+            for (int j = 0; j < 3; ++j) new_F(j, id) = vertex_id[F(j, f)];
+            id += 1;
+        }
+        V = std::move(new_V);
+        F = std::move(new_F);
+#ifdef LOG_OUTPUT
+        printf("decimation pass %d: %d collapses in %d cells\n", pass, pass_collapses,
+               num_regions);
+#endif
+        if (pass_collapses < num_f / 100) break;
+    }
+    return num_collapses;
+}
+
+} // namespace qflow
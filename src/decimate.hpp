@@ -0,0 +1,19 @@
+#ifndef DECIMATE_H_
+#define DECIMATE_H_
+
+#include <Eigen/Core>
+
+namespace qflow {
+
+using namespace Eigen;
+
+// Collapses edges by their quadric error until the edges are about |target_length| long. The
+// vertices are split into the cells of a grid, and every cell collapses the edges whose
+// one-rings lie inside it, all cells in parallel. Later passes shift the grid so that the cell
+// borders are decimated as well. Boundary and non-manifold vertices are kept. The result does not
+// depend on the number of threads. Returns the number of collapsed edges.
+int decimate(MatrixXi& F, MatrixXd& V, double target_length);
+
+} // namespace qflow
+
+#endif
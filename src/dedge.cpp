@@ -1,15 +1,14 @@
 #include "dedge.hpp"
 #include "config.hpp"
 
+#include <algorithm>
 #include <atomic>
 #include <fstream>
 #include <iostream>
 #include <set>
 #include <vector>
 #include "compare-key.hpp"
-#ifdef WITH_TBB
-#include "tbb/tbb.h"
-#endif
+#include "parallel.hpp"
 namespace qflow {
 
 inline int dedge_prev(int e, int deg) { return (e % deg == 0u) ? e + (deg - 1) : e - 1; }
@@ -35,49 +34,29 @@ bool compute_direct_graph(MatrixXd& V, MatrixXi& F, VectorXi& V2E, VectorXi& E2E
     uint32_t deg = F.rows();
     std::vector<std::pair<uint32_t, uint32_t>> tmp(F.size());
 
-#ifdef WITH_TBB
-    tbb::parallel_for(
-        tbb::blocked_range<uint32_t>(0u, (uint32_t)F.cols(), GRAIN_SIZE),
-        [&](const tbb::blocked_range<uint32_t>& range) {
-            for (uint32_t f = range.begin(); f != range.end(); ++f) {
-                for (uint32_t i = 0; i < deg; ++i) {
-                    uint32_t idx_cur = F(i, f), idx_next = F((i + 1) % deg, f),
-                             edge_id = deg * f + i;
-                    if (idx_cur >= V.cols() || idx_next >= V.cols())
-                        throw std::runtime_error(
-                            "Mesh data contains an out-of-bounds vertex reference!");
-                    if (idx_cur == idx_next) continue;
-
-                    tmp[edge_id] = std::make_pair(idx_next, INVALID);
-                    if (!atomicCompareAndExchange(&V2E[idx_cur], edge_id, INVALID)) {
-                        uint32_t idx = V2E[idx_cur];
-                        while (!atomicCompareAndExchange((int*)&tmp[idx].second, edge_id, INVALID))
-                            idx = tmp[idx].second;
-                    }
+    std::atomic<bool> out_of_bounds(false);
+    parallel_for_range(0, F.cols(), GRAIN_SIZE, [&](int begin, int end) {
+        for (uint32_t f = begin; f != (uint32_t)end; ++f) {
+            for (uint32_t i = 0; i < deg; ++i) {
+                uint32_t idx_cur = F(i, f), idx_next = F((i + 1) % deg, f),
+                         edge_id = deg * f + i;
+                if (idx_cur >= V.cols() || idx_next >= V.cols()) {
+                    out_of_bounds = true;
+                    return;
                 }
-            }
-        });
-#else
-    for (int f = 0; f < F.cols(); ++f) {
-        for (unsigned int i = 0; i < deg; ++i) {
-            unsigned int idx_cur = F(i, f), idx_next = F((i + 1) % deg, f), edge_id = deg * f + i;
-            if (idx_cur >= V.cols() || idx_next >= V.cols())
-                throw std::runtime_error("Mesh data contains an out-of-bounds vertex reference!");
-            if (idx_cur == idx_next) continue;
+                if (idx_cur == idx_next) continue;
 
-            tmp[edge_id] = std::make_pair(idx_next, -1);
-            if (V2E[idx_cur] == -1)
-                V2E[idx_cur] = edge_id;
-            else {
-                unsigned int idx = V2E[idx_cur];
-                while (tmp[idx].second != -1) {
-                    idx = tmp[idx].second;
+                tmp[edge_id] = std::make_pair(idx_next, INVALID);
+                if (!atomicCompareAndExchange(&V2E[idx_cur], edge_id, INVALID)) {
+                    uint32_t idx = V2E[idx_cur];
+                    while (!atomicCompareAndExchange((int*)&tmp[idx].second, edge_id, INVALID))
+                        idx = tmp[idx].second;
                 }
-                tmp[idx].second = edge_id;
             }
         }
-    }
-#endif
+    });
+    if (out_of_bounds)
+        throw std::runtime_error("Mesh data contains an out-of-bounds vertex reference!");
 
     nonManifold.resize(V.cols());
     nonManifold.setConstant(false);
@@ -85,10 +64,7 @@ bool compute_direct_graph(MatrixXd& V, MatrixXi& F, VectorXi& V2E, VectorXi& E2E
     E2E.resize(F.cols() * deg);
     E2E.setConstant(INVALID);
 
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int f = 0; f < F.cols(); ++f) {
+    parallel_for(0, F.cols(), [&](int f) {
         for (uint32_t i = 0; i < deg; ++i) {
             uint32_t idx_cur = F(i, f), idx_next = F((i + 1) % deg, f), edge_id_cur = deg * f + i;
 
@@ -114,26 +90,23 @@ bool compute_direct_graph(MatrixXd& V, MatrixXi& F, VectorXi& V2E, VectorXi& E2E
                 E2E[edge_id_opp] = edge_id_cur;
             }
         }
-    }
+    });
     std::atomic<uint32_t> nonManifoldCounter(0), boundaryCounter(0), isolatedCounter(0);
 
     boundary.resize(V.cols());
     boundary.setConstant(false);
 
     /* Detect boundary regions of the mesh and adjust vertex->edge pointers*/
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < V.cols(); ++i) {
+    parallel_for(0, V.cols(), [&](int i) {
         uint32_t edge = V2E[i];
         if (edge == INVALID) {
             isolatedCounter++;
-            continue;
+            return;
         }
         if (nonManifold[i]) {
             nonManifoldCounter++;
             V2E[i] = INVALID;
-            continue;
+            return;
         }
 
         /* Walk backwards to the first boundary edge (if any) */
@@ -151,7 +124,7 @@ bool compute_direct_graph(MatrixXd& V, MatrixXi& F, VectorXi& V2E, VectorXi& E2E
             edge = prevEdge;
         } while (edge != start);
         V2E[i] = v2e;
-    }
+    });
 #ifdef LOG_OUTPUT
     printf("counter triangle %d %d\n", (int)boundaryCounter, (int)nonManifoldCounter);
 #endif
@@ -208,58 +181,35 @@ void compute_direct_graph_quad(std::vector<Vector3d>& V, std::vector<Vector4i>&
     uint32_t deg = 4;
     std::vector<std::pair<uint32_t, uint32_t>> tmp(F.size() * deg);
 
-#ifdef WITH_TBB
-    tbb::parallel_for(
-        tbb::blocked_range<uint32_t>(0u, (uint32_t)F.size(), GRAIN_SIZE),
-        [&](const tbb::blocked_range<uint32_t>& range) {
-            for (uint32_t f = range.begin(); f != range.end(); ++f) {
-                for (uint32_t i = 0; i < deg; ++i) {
-                    uint32_t idx_cur = F[f][i], idx_next = F[f][(i + 1) % deg],
-                             edge_id = deg * f + i;
-                    if (idx_cur >= V.size() || idx_next >= V.size())
-                        throw std::runtime_error(
-                            "Mesh data contains an out-of-bounds vertex reference!");
-                    if (idx_cur == idx_next) continue;
-
-                    tmp[edge_id] = std::make_pair(idx_next, INVALID);
-                    if (!atomicCompareAndExchange(&V2E[idx_cur], edge_id, INVALID)) {
-                        uint32_t idx = V2E[idx_cur];
-                        while (!atomicCompareAndExchange((int*)&tmp[idx].second, edge_id, INVALID))
-                            idx = tmp[idx].second;
-                    }
+    std::atomic<bool> out_of_bounds(false);
+    parallel_for_range(0, F.size(), GRAIN_SIZE, [&](int begin, int end) {
+        for (uint32_t f = begin; f != (uint32_t)end; ++f) {
+            for (uint32_t i = 0; i < deg; ++i) {
+                uint32_t idx_cur = F[f][i], idx_next = F[f][(i + 1) % deg],
+                         edge_id = deg * f + i;
+                if (idx_cur >= V.size() || idx_next >= V.size()) {
+                    out_of_bounds = true;
+                    return;
                 }
-            }
-        });
-#else
-    for (int f = 0; f < F.size(); ++f) {
-        for (unsigned int i = 0; i < deg; ++i) {
-            unsigned int idx_cur = F[f][i], idx_next = F[f][(i + 1) % deg], edge_id = deg * f + i;
-            if (idx_cur >= V.size() || idx_next >= V.size())
-                throw std::runtime_error("Mesh data contains an out-of-bounds vertex reference!");
-            if (idx_cur == idx_next) continue;
-            tmp[edge_id] = std::make_pair(idx_next, -1);
-            if (V2E[idx_cur] == -1) {
-                V2E[idx_cur] = edge_id;
-            }
-            else {
-                unsigned int idx = V2E[idx_cur];
-                while (tmp[idx].second != -1) {
-                    idx = tmp[idx].second;
+                if (idx_cur == idx_next) continue;
+
+                tmp[edge_id] = std::make_pair(idx_next, INVALID);
+                if (!atomicCompareAndExchange(&V2E[idx_cur], edge_id, INVALID)) {
+                    uint32_t idx = V2E[idx_cur];
+                    while (!atomicCompareAndExchange((int*)&tmp[idx].second, edge_id, INVALID))
+                        idx = tmp[idx].second;
                 }
-                tmp[idx].second = edge_id;
             }
         }
-    }
-#endif
+    });
+    if (out_of_bounds)
+        throw std::runtime_error("Mesh data contains an out-of-bounds vertex reference!");
     nonManifold.resize(V.size());
     nonManifold.setConstant(false);
 
     E2E.resize(F.size() * deg, INVALID);
 
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int f = 0; f < F.size(); ++f) {
+    parallel_for(0, F.size(), [&](int f) {
         for (uint32_t i = 0; i < deg; ++i) {
             uint32_t idx_cur = F[f][i], idx_next = F[f][(i + 1) % deg], edge_id_cur = deg * f + i;
 
@@ -285,26 +235,23 @@ void compute_direct_graph_quad(std::vector<Vector3d>& V, std::vector<Vector4i>&
                 E2E[edge_id_opp] = edge_id_cur;
             }
         }
-    }
+    });
     std::atomic<uint32_t> nonManifoldCounter(0), boundaryCounter(0), isolatedCounter(0);
 
     boundary.resize(V.size());
     boundary.setConstant(false);
 
     /* Detect boundary regions of the mesh and adjust vertex->edge pointers*/
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < V.size(); ++i) {
+    parallel_for(0, V.size(), [&](int i) {
         uint32_t edge = V2E[i];
         if (edge == INVALID) {
             isolatedCounter++;
-            continue;
+            return;
         }
         if (nonManifold[i]) {
             nonManifoldCounter++;
             V2E[i] = INVALID;
-            continue;
+            return;
         }
 
         /* Walk backwards to the first boundary edge (if any) */
@@ -322,7 +269,7 @@ void compute_direct_graph_quad(std::vector<Vector3d>& V, std::vector<Vector4i>&
             edge = prevEdge;
         } while (edge != start);
         V2E[i] = v2e;
-    }
+    });
 #ifdef LOG_OUTPUT
     printf("counter %d %d\n", (int)boundaryCounter, (int)nonManifoldCounter);
 #endif
@@ -484,4 +431,135 @@ void remove_nonmanifold(std::vector<Vector4i>& F, std::vector<Vector3d>& V) {
     }
 }
 
+LocalQuadGraph::LocalQuadGraph(std::vector<Vector4i>& F, std::vector<int>& V2E,
+                               std::vector<int>& E2E, VectorXi& boundary, VectorXi& nonManifold)
+    : F(F), V2E(V2E), E2E(E2E), boundary(boundary), nonManifold(nonManifold) {
+    vertex_faces.resize(V2E.size());
+    erased_faces.resize(F.size(), 0);
+    for (int f = 0; f < F.size(); ++f) link_face(f);
+    touched.clear();
+}
+
+int LocalQuadGraph::add_vertex() {
+    int v = V2E.size();
+    V2E.push_back(INVALID);
+    boundary.conservativeResize(v + 1);
+    boundary[v] = false;
+    nonManifold.conservativeResize(v + 1);
+    nonManifold[v] = false;
+    vertex_faces.emplace_back();
+    return v;
+}
+
+void LocalQuadGraph::set_face(int f, const Vector4i& face) {
+    if (f == F.size()) {
+        F.push_back(face);
+        E2E.resize(F.size() * 4, INVALID);
+        erased_faces.push_back(0);
+    } else {
+        unlink_face(f);
+        F[f] = face;
+    }
+    link_face(f);
+}
+
+void LocalQuadGraph::erase_face(int f) {
+    if (erased_faces[f]) return;
+    unlink_face(f);
+    erased_faces[f] = 1;
+    for (int i = 0; i < 4; ++i) E2E[f * 4 + i] = INVALID;
+}
+
+void LocalQuadGraph::link_face(int f) {
+    for (int i = 0; i < 4; ++i) {
+        int v = F[f][i];
+        if (std::find(F[f].data(), F[f].data() + i, v) != F[f].data() + i) continue;
+        vertex_faces[v].push_back(f);
+        touched.push_back(v);
+    }
+}
+
+void LocalQuadGraph::unlink_face(int f) {
+    for (int i = 0; i < 4; ++i) {
+        int v = F[f][i];
+        auto it = std::find(vertex_faces[v].begin(), vertex_faces[v].end(), f);
+        if (it == vertex_faces[v].end()) continue;
+        vertex_faces[v].erase(it);
+        touched.push_back(v);
+    }
+}
+
+int LocalQuadGraph::count_edges(int v1, int v2, int& edge) const {
+    int count = 0;
+    for (int f : vertex_faces[v1]) {
+        for (int i = 0; i < 4; ++i) {
+            if (F[f][i] == v1 && F[f][(i + 1) % 4] == v2) {
+                count += 1;
+                edge = f * 4 + i;
+            }
+        }
+    }
+    return count;
+}
+
+std::vector<int> LocalQuadGraph::update() {
+    std::sort(touched.begin(), touched.end());
+    touched.erase(std::unique(touched.begin(), touched.end()), touched.end());
+    std::vector<int> ring;
+    for (int v : touched) {
+        for (int f : vertex_faces[v]) {
+            for (int i = 0; i < 4; ++i) {
+                int v1 = F[f][i], v2 = F[f][(i + 1) % 4], edge = f * 4 + i;
+                ring.push_back(v1);
+                if (v1 != v && v2 != v) continue;
+                // an edge is linked only if both directions are unique, as nonmanifold edges
+                // have no opposite
+                int opp = INVALID, unused;
+                if (v1 == v2 || count_edges(v1, v2, unused) != 1 ||
+                    count_edges(v2, v1, opp) != 1)
+                    opp = INVALID;
+                E2E[edge] = opp;
+            }
+        }
+        ring.push_back(v);
+    }
+    std::sort(ring.begin(), ring.end());
+    ring.erase(std::unique(ring.begin(), ring.end()), ring.end());
+    for (int v : ring) update_vertex(v);
+    touched.clear();
+    return ring;
+}
+
+void LocalQuadGraph::update_vertex(int v) {
+    int start = INVALID, unused;
+    bool manifold = true;
+    for (int f : vertex_faces[v]) {
+        for (int i = 0; i < 4; ++i) {
+            int v1 = F[f][i], v2 = F[f][(i + 1) % 4];
+            if (v1 == v2 || (v1 != v && v2 != v)) continue;
+            if (v1 == v && (start == INVALID || f * 4 + i < start)) start = f * 4 + i;
+            if (count_edges(v2, v1, unused) > 1) manifold = false;
+        }
+    }
+    nonManifold[v] = !manifold;
+    boundary[v] = false;
+    if (start == INVALID || !manifold) {
+        V2E[v] = INVALID;
+        return;
+    }
+    // walk backwards to the first boundary edge as compute_direct_graph_quad does
+    int edge = start, v2e = start;
+    do {
+        v2e = std::min(v2e, edge);
+        int prev_edge = E2E[dedge_prev(edge, 4)];
+        if (prev_edge == INVALID) {
+            v2e = edge;
+            boundary[v] = true;
+            break;
+        }
+        edge = prev_edge;
+    } while (edge != start);
+    V2E[v] = v2e;
+}
+
 } // namespace qflow
@@ -20,6 +20,40 @@ void compute_direct_graph_quad(std::vector<Vector3d>& V, std::vector<Vector4i>&
 
 void remove_nonmanifold(std::vector<Vector4i> &F, std::vector<Vector3d> &V);
 
+// Keeps the graph of compute_direct_graph_quad up to date while faces are replaced, added or
+// erased. update() recomputes the opposite edges around the touched vertices and the vertex
+// links of their one-rings only, so edits cost time proportional to their size. Erased faces
+// stay in |F| and have no edges until the caller compacts them.
+class LocalQuadGraph {
+   public:
+    LocalQuadGraph(std::vector<Vector4i>& F, std::vector<int>& V2E, std::vector<int>& E2E,
+                   VectorXi& boundary, VectorXi& nonManifold);
+
+    int add_vertex();
+    // Replaces face |f|, or appends a face if |f| is F.size()
+    void set_face(int f, const Vector4i& face);
+    void erase_face(int f);
+    bool erased(int f) const { return erased_faces[f]; }
+
+    // Returns the vertices whose links were recomputed
+    std::vector<int> update();
+
+   private:
+    void link_face(int f);
+    void unlink_face(int f);
+    int count_edges(int v1, int v2, int& edge) const;
+    void update_vertex(int v);
+
+    std::vector<Vector4i>& F;
+    std::vector<int>& V2E;
+    std::vector<int>& E2E;
+    VectorXi& boundary;
+    VectorXi& nonManifold;
+    std::vector<std::vector<int>> vertex_faces;
+    std::vector<char> erased_faces;
+    std::vector<int> touched;
+};
+
 } // namespace qflow
 
 #endif
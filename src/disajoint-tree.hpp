@@ -1,8 +1,12 @@
 #ifndef DISAJOINT_TREE_H_
 #define DISAJOINT_TREE_H_
 
+#include <atomic>
 #include <vector>
 
+#include "dset.hpp"
+#include "parallel.hpp"
+
 namespace qflow {
 
 class DisajointTree {
@@ -58,6 +62,50 @@ class DisajointTree {
         }
     }
 
+    // Parallel Merge() + BuildCompactParent(): unites x and y for every i in [0, num_pairs) with
+    // pair(i, x, y) == true using the lock-free DisjointSets. Each set is rooted at and numbered
+    // in the order of its smallest member, so the result does not depend on the merge order.
+    template <class Pair>
+    void BuildCompactParallel(int num_pairs, const Pair& pair) {
+        int n = parent.size();
+        DisjointSets sets(n);
+        parallel_for(0, num_pairs, [&](int i) {
+            int x, y;
+            if (pair(i, x, y)) sets.unite(x, y);
+        });
+        std::vector<std::atomic<int>> smallest(n);
+        parallel_for(0, n, [&](int i) { smallest[i] = n; });
+        parallel_for(0, n, [&](int i) {
+            std::atomic<int>& s = smallest[sets.find(i)];
+            int current = s;
+            while (i < current && !s.compare_exchange_weak(current, i)) {
+            }
+        });
+        parallel_for(0, n, [&](int i) { parent[i] = smallest[sets.find(i)]; });
+
+        // number the roots with a prefix sum over chunks
+        int num_chunks = (n + GRAIN_SIZE - 1) / GRAIN_SIZE;
+        std::vector<int> offsets(num_chunks + 1, 0);
+        parallel_for(0, num_chunks, [&](int c) {
+            for (int i = c * GRAIN_SIZE; i < std::min(n, (c + 1) * GRAIN_SIZE); ++i)
+                offsets[c + 1] += parent[i] == i;
+        }, 1);
+        for (int c = 0; c < num_chunks; ++c) offsets[c + 1] += offsets[c];
+        compact_num = offsets[num_chunks];
+        indices.resize(n);
+        indices_to_parent.resize(compact_num);
+        parallel_for(0, num_chunks, [&](int c) {
+            int id = offsets[c];
+            for (int i = c * GRAIN_SIZE; i < std::min(n, (c + 1) * GRAIN_SIZE); ++i) {
+                if (parent[i] == i) {
+                    indices[i] = id;
+                    indices_to_parent[id++] = i;
+                }
+            }
+        }, 1);
+        parallel_for(0, n, [&](int i) { indices[i] = indices[parent[i]]; });
+    }
+
     int CompactNum() { return compact_num; }
 
     int compact_num;
@@ -74,16 +122,28 @@ class DisajointOrientTree {
         rank.resize(n, 1);
         for (int i = 0; i < n; ++i) parent[i] = std::make_pair(i, 0);
     }
+    // both walk up iteratively, so long chains do not exhaust the stack
     int Parent(int j) {
-        if (j == parent[j].first) return j;
-        int k = Parent(parent[j].first);
-        parent[j].second = (parent[j].second + parent[parent[j].first].second) % 4;
-        parent[j].first = k;
-        return k;
+        int root = j, orient = 0;
+        while (root != parent[root].first) {
+            orient += parent[root].second;
+            root = parent[root].first;
+        }
+        while (j != root) {
+            int next = parent[j].first, next_orient = orient - parent[j].second;
+            parent[j] = std::make_pair(root, orient % 4);
+            j = next;
+            orient = next_orient;
+        }
+        return root;
     }
     int Orient(int j) {
-        if (j == parent[j].first) return parent[j].second;
-        return (parent[j].second + Orient(parent[j].first)) % 4;
+        int orient = parent[j].second;
+        while (j != parent[j].first) {
+            j = parent[j].first;
+            orient += parent[j].second;
+        }
+        return orient % 4;
     }
     int Index(int x) { return indices[x]; }
     void MergeFromTo(int v0, int v1, int orient0, int orient1) {
@@ -123,6 +183,101 @@ class DisajointOrientTree {
             parent[p0].second = (orient0 - orient1 + orientp1 - orientp0 + 8) % 4;
         }
     }
+
+    // Parallel Merge() of edge(i, v0, v1, orient0, orient1) for every i in [0, num_edges), in the
+    // order of i. The edges are merged by deterministic reservation: in each round the next edges
+    // reserve the roots of both ends with their position, and an edge that holds one of its
+    // reservations links that root below the other one. The others wait for the next round, so the
+    // spanning forest equals the serial one and does not depend on the number of threads. The
+    // roots may differ from Merge(), which rotates every tree by a constant. Afterwards every
+    // element points directly to its root.
+    template <class Edge>
+    void MergeParallel(int num_edges, const Edge& edge) {
+        int n = parent.size();
+        // (parent << 2) | orient of every element
+        std::vector<std::atomic<uint64_t>> entries(n);
+        parallel_for(0, n, [&](int i) {
+            entries[i] = ((uint64_t)parent[i].first << 2) | parent[i].second;
+        });
+        // compressing the path while other threads walk it is safe, since every entry written
+        // still points to an ancestor with the right orientation
+        auto find = [&](int j, int& orient) {
+            int root = j;
+            orient = 0;
+            for (uint64_t e = entries[root]; (int)(e >> 2) != root; e = entries[root]) {
+                orient += e & 3;
+                root = e >> 2;
+            }
+            orient %= 4;
+            for (int o = orient; j != root;) {
+                uint64_t e = entries[j];
+                entries[j] = ((uint64_t)root << 2) | o;
+                o = (o - (e & 3) + 4) % 4;
+                j = e >> 2;
+            }
+            return root;
+        };
+
+        const int round_size = 4096;
+        std::vector<std::atomic<int>> reservation(n);
+        parallel_for(0, n, [&](int i) { reservation[i] = round_size; });
+        std::vector<int> pending(num_edges);
+        for (int i = 0; i < num_edges; ++i) pending[i] = i;
+        int begin = 0;
+        while (begin < pending.size()) {
+            int num = std::min(round_size, (int)pending.size() - begin);
+            std::vector<int> roots(num * 2), orients(num * 2);
+            parallel_for(0, num, [&](int k) {
+                int v0, v1, orient0, orient1;
+                edge(pending[begin + k], v0, v1, orient0, orient1);
+                roots[k * 2] = find(v0, orients[k * 2]);
+                roots[k * 2 + 1] = find(v1, orients[k * 2 + 1]);
+                if (roots[k * 2] == roots[k * 2 + 1]) return;
+                for (int j = 0; j < 2; ++j) {
+                    std::atomic<int>& r = reservation[roots[k * 2 + j]];
+                    int current = r;
+                    while (k < current && !r.compare_exchange_weak(current, k)) {
+                    }
+                }
+            });
+            std::vector<char> done(num, 1);
+            parallel_for(0, num, [&](int k) {
+                int p0 = roots[k * 2], p1 = roots[k * 2 + 1];
+                if (p0 == p1) return;
+                int v0, v1, orient0, orient1;
+                edge(pending[begin + k], v0, v1, orient0, orient1);
+                int orientp0 = orients[k * 2], orientp1 = orients[k * 2 + 1];
+                if (reservation[p1] == k) {
+                    entries[p1] = ((uint64_t)p0 << 2) |
+                                  ((orient1 - orient0 + orientp0 - orientp1 + 8) % 4);
+                } else if (reservation[p0] == k) {
+                    entries[p0] = ((uint64_t)p1 << 2) |
+                                  ((orient0 - orient1 + orientp1 - orientp0 + 8) % 4);
+                } else {
+                    done[k] = 0;
+                }
+            });
+            parallel_for(0, num * 2, [&](int k) { reservation[roots[k]] = round_size; });
+            // the deferred edges keep their order in front of the remaining ones
+            std::vector<int> deferred;
+            for (int k = 0; k < num; ++k) {
+                if (!done[k]) deferred.push_back(pending[begin + k]);
+            }
+            begin += num - deferred.size();
+            std::copy(deferred.begin(), deferred.end(), pending.begin() + begin);
+        }
+
+        parallel_for(0, n, [&](int i) {
+            int orient;
+            int root = find(i, orient);
+            parent[i] = std::make_pair(root, orient);
+        });
+        parallel_for(0, n, [&](int i) { rank[i] = 1; });
+        for (int i = 0; i < n; ++i) {
+            if (parent[i].first != i) rank[parent[i].first] += 1;
+        }
+    }
+
     void BuildCompactParent() {
         std::vector<int> compact_parent;
         compact_parent.resize(parent.size());
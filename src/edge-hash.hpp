@@ -0,0 +1,127 @@
+#ifndef EDGE_HASH_H_
+#define EDGE_HASH_H_
+
+#include <atomic>
+#include <cstdint>
+#include <vector>
+
+namespace qflow {
+
+// Open addressing map from directed edges (v1, v2) of non-negative vertices to non-negative
+// values, with linear probing over a power-of-two table. insert() grows the table and overwrites;
+// insert_max() may run concurrently on a table reserved for all keys and keeps the largest value
+// of each key, so a parallel build matches a serial one where the last insertion wins.
+class EdgeHashMap {
+   public:
+    EdgeHashMap() { reserve(0); }
+    // Copies must not run concurrently with insertions into |other|
+    EdgeHashMap(const EdgeHashMap& other) { *this = other; }
+    EdgeHashMap& operator=(const EdgeHashMap& other) {
+        if (this == &other) return *this;
+        std::vector<std::atomic<uint64_t>>(other.keys.size()).swap(keys);
+        std::vector<std::atomic<int>>(other.values.size()).swap(values);
+        for (int i = 0; i < (int)keys.size(); ++i) {
+            keys[i].store(other.keys[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+            values[i].store(other.values[i].load(std::memory_order_relaxed),
+                            std::memory_order_relaxed);
+        }
+        num = other.num.load();
+        return *this;
+    }
+
+    void reserve(int num_keys) {
+        int capacity = 16;
+        while (capacity < 2 * num_keys) capacity *= 2;
+        if (capacity <= (int)keys.size()) return;
+        std::vector<uint64_t> old_keys(keys.size());
+        std::vector<int> old_values(keys.size());
+        for (int i = 0; i < (int)keys.size(); ++i) {
+            old_keys[i] = keys[i].load(std::memory_order_relaxed);
+            old_values[i] = values[i].load(std::memory_order_relaxed);
+        }
+        std::vector<std::atomic<uint64_t>>(capacity).swap(keys);
+        std::vector<std::atomic<int>>(capacity).swap(values);
+        for (int i = 0; i < capacity; ++i) {
+            keys[i].store(EMPTY, std::memory_order_relaxed);
+            values[i].store(-1, std::memory_order_relaxed);
+        }
+        num = 0;
+        for (int i = 0; i < (int)old_keys.size(); ++i) {
+            if (old_keys[i] != EMPTY) insert_key(old_keys[i], old_values[i]);
+        }
+    }
+    void clear() {
+        std::vector<std::atomic<uint64_t>>().swap(keys);
+        std::vector<std::atomic<int>>().swap(values);
+        reserve(0);
+    }
+
+    // Value of the edge, or -1 if it is not in the map
+    int find(int v1, int v2) const {
+        uint64_t key = pack(v1, v2);
+        int mask = keys.size() - 1;
+        for (int slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+            uint64_t k = keys[slot].load(std::memory_order_relaxed);
+            if (k == key) return values[slot].load(std::memory_order_relaxed);
+            if (k == EMPTY) return -1;
+        }
+    }
+    bool count(int v1, int v2) const { return find(v1, v2) != -1; }
+
+    void insert(int v1, int v2, int value) {
+        if (2 * (num + 1) > (int)keys.size()) reserve(num + 1);
+        insert_key(pack(v1, v2), value);
+    }
+    void insert_max(int v1, int v2, int value) {
+        uint64_t key = pack(v1, v2);
+        int mask = keys.size() - 1;
+        for (int slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+            uint64_t k = keys[slot].load(std::memory_order_relaxed);
+            if (k == EMPTY) {
+                if (keys[slot].compare_exchange_strong(k, key)) {
+                    num.fetch_add(1, std::memory_order_relaxed);
+                    k = key;
+                }
+            }
+            if (k != key) continue;
+            int current = values[slot].load(std::memory_order_relaxed);
+            while (current < value && !values[slot].compare_exchange_weak(current, value)) {
+            }
+            return;
+        }
+    }
+
+    int size() const { return num; }
+
+   private:
+    static const uint64_t EMPTY = ~uint64_t(0);
+
+    static uint64_t pack(int v1, int v2) { return (uint64_t)(uint32_t)v1 << 32 | (uint32_t)v2; }
+    static uint64_t hash(uint64_t key) {
+        key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ull;
+        key = (key ^ (key >> 27)) * 0x94d049bb133111ebull;
+        return key ^ (key >> 31);
+    }
+    void insert_key(uint64_t key, int value) {
+        int mask = keys.size() - 1;
+        for (int slot = hash(key) & mask;; slot = (slot + 1) & mask) {
+            uint64_t k = keys[slot].load(std::memory_order_relaxed);
+            if (k == EMPTY) {
+                keys[slot].store(key, std::memory_order_relaxed);
+                num += 1;
+            } else if (k != key) {
+                continue;
+            }
+            values[slot].store(value, std::memory_order_relaxed);
+            return;
+        }
+    }
+
+    std::vector<std::atomic<uint64_t>> keys;
+    std::vector<std::atomic<int>> values;
+    std::atomic<int> num;
+};
+
+} // namespace qflow
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef EDGE_RANKS_H_
+#define EDGE_RANKS_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "field-math.hpp"
+#include "parallel.hpp"
+
+namespace qflow {
+
+// Rotation index between the orientation frames at the two ends of each undirected edge, i.e.
+// (second - first) mod 4 of compat_orientation_extrinsic_index_4 from edge.x to edge.y, packed
+// 2 bits per edge. The orientation field is final once the edges are built, so later stages look
+// the rank up instead of comparing the frames again; the rank from edge.y to edge.x is its
+// negation.
+class EdgeRanks {
+   public:
+    // Recomputes all edges, 16 per word in parallel
+    void compute(const MatrixXd& Q, const MatrixXd& N, const std::vector<DEdge>& edges) {
+        words.assign((edges.size() + 15) / 16, 0);
+        parallel_for(0, words.size(), [&](int w) {
+            uint32_t word = 0;
+            int end = std::min((int)edges.size(), w * 16 + 16);
+            for (int e = w * 16; e < end; ++e) word |= rank(Q, N, edges[e]) << (e % 16 * 2);
+            words[w] = word;
+        });
+    }
+    // Recomputes edge |e| after it was added or changed
+    void update(const MatrixXd& Q, const MatrixXd& N, const std::vector<DEdge>& edges, int e) {
+        if (e / 16 >= words.size()) words.resize(e / 16 + 1, 0);
+        words[e / 16] &= ~(3u << (e % 16 * 2));
+        words[e / 16] |= rank(Q, N, edges[e]) << (e % 16 * 2);
+    }
+
+    int operator[](int e) const { return (words[e / 16] >> (e % 16 * 2)) & 3; }
+
+   private:
+    static uint32_t rank(const MatrixXd& Q, const MatrixXd& N, const DEdge& edge) {
+        auto index = compat_orientation_extrinsic_index_4(Q.col(edge.x), N.col(edge.x),
+                                                          Q.col(edge.y), N.col(edge.y));
+        return (index.second + 4 - index.first) % 4;
+    }
+
+    std::vector<uint32_t> words;
+};
+
+} // namespace qflow
+
+#endif
@@ -275,9 +275,13 @@ inline Vector3d rotate_vector_into_plane(Vector3d q, const Vector3d &source_norm
     return q;
 }
 
+// Inverse affine map of a face, from offsets to its first vertex to barycentric coordinates
+typedef Matrix<double, 2, 3> Matrix23d;
+typedef std::vector<Matrix23d, aligned_allocator<Matrix23d>> TriangleSpaces;
+
 inline Vector3d Travel(Vector3d p, const Vector3d &dir, double &len, int &f, VectorXi &E2E,
                        MatrixXd &V, MatrixXi &F, MatrixXd &NF,
-                       std::vector<MatrixXd> &triangle_space, double *tx = 0, double *ty = 0) {
+                       const TriangleSpaces &triangle_space, double *tx = 0, double *ty = 0) {
     Vector3d N = NF.col(f);
     Vector3d pt = (dir - dir.dot(N) * N).normalized();
     int prev_id = -1;
@@ -286,21 +290,15 @@ inline Vector3d Travel(Vector3d p, const Vector3d &dir, double &len, int &f, Vec
         count += 1;
         Vector3d t1 = V.col(F(1, f)) - V.col(F(0, f));
         Vector3d t2 = V.col(F(2, f)) - V.col(F(0, f));
-        Vector3d N = NF.col(f);
         //		printf("point dis: %f\n", (p - V.col(F(1, f))).dot(N));
         int edge_id = f * 3;
         double max_len = 1e30;
         bool found = false;
         int next_id, next_f;
         Vector3d next_q;
-        Matrix3d m, n;
-        m.col(0) = t1;
-        m.col(1) = t2;
-        m.col(2) = N;
-        n = m.inverse();
-        MatrixXd &T = triangle_space[f];
-        VectorXd coord = T * Vector3d(p - V.col(F(0, f)));
-        VectorXd dirs = (T * pt);
+        const Matrix23d &T = triangle_space[f];
+        Vector2d coord = T * Vector3d(p - V.col(F(0, f)));
+        Vector2d dirs = T * pt;
 
         double lens[3];
         lens[0] = -coord.y() / dirs.y();
@@ -349,7 +347,7 @@ inline Vector3d Travel(Vector3d p, const Vector3d &dir, double &len, int &f, Vec
 }
 inline Vector3d TravelField(Vector3d p, Vector3d &pt, double &len, int &f, VectorXi &E2E,
                             MatrixXd &V, MatrixXi &F, MatrixXd &NF, MatrixXd &QF, MatrixXd &QV,
-                            MatrixXd &NV, std::vector<MatrixXd> &triangle_space, double *tx = 0,
+                            MatrixXd &NV, const TriangleSpaces &triangle_space, double *tx = 0,
                             double *ty = 0, Vector3d *dir_unfold = 0) {
     Vector3d N = NF.col(f);
     pt = (pt - pt.dot(N) * N).normalized();
@@ -400,14 +398,9 @@ inline Vector3d TravelField(Vector3d p, Vector3d &pt, double &len, int &f, Vecto
         bool found = false;
         int next_id = -1, next_f = -1;
         Vector3d next_q;
-        Matrix3d m, n;
-        m.col(0) = t1;
-        m.col(1) = t2;
-        m.col(2) = N;
-        n = m.inverse();
-        MatrixXd &T = triangle_space[f];
-        VectorXd coord = T * Vector3d(p - V.col(F(0, f)));
-        VectorXd dirs = (T * pt);
+        const Matrix23d &T = triangle_space[f];
+        Vector2d coord = T * Vector3d(p - V.col(F(0, f)));
+        Vector2d dirs = T * pt;
         double lens[3];
         lens[0] = -coord.y() / dirs.y();
         lens[1] = (1 - coord.x() - coord.y()) / (dirs.x() + dirs.y());
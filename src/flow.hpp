@@ -7,6 +7,7 @@
 #include <vector>
 
 #include "config.hpp"
+#include "packed-array.hpp"
 
 #include <boost/graph/adjacency_list.hpp>
 #include <boost/graph/boykov_kolmogorov_max_flow.hpp>
@@ -29,7 +30,7 @@ class MaxFlowHelper {
     virtual void resize(int n, int m) = 0;
     virtual void addEdge(int x, int y, int c, int rc, int v, int cost = 1) = 0;
     virtual int compute() = 0;
-    virtual void applyTo(std::vector<Vector2i>& edge_diff) = 0;
+    virtual void applyTo(DiffArray& edge_diff) = 0;
 };
 
 class BoykovMaxFlowHelper : public MaxFlowHelper {
@@ -80,7 +81,7 @@ class BoykovMaxFlowHelper : public MaxFlowHelper {
             edge_to_variables[e2] = std::make_pair(v, 1);
         }
     }
-    void applyTo(std::vector<Vector2i>& edge_diff) {
+    void applyTo(DiffArray& edge_diff) {
         property_map<Graph, edge_capacity_t>::type capacity = get(edge_capacity, g);
         property_map<Graph, edge_residual_capacity_t>::type residual_capacity =
             get(edge_residual_capacity, g);
@@ -94,8 +95,8 @@ class BoykovMaxFlowHelper : public MaxFlowHelper {
                     if (flow > 0) {
                         auto it = edge_to_variables.find(*ei);
                         if (it != edge_to_variables.end()) {
-                            edge_diff[it->second.first / 2][it->second.first % 2] +=
-                                it->second.second * flow;
+                            int e = it->second.first / 2, k = it->second.first % 2;
+                            edge_diff.set(e, k, edge_diff[e][k] + it->second.second * flow);
                         }
                     }
                 }
@@ -172,12 +173,12 @@ class NetworkSimplexFlowHelper : public MaxFlowHelper {
 
         return maxflow;
     }
-    void applyTo(std::vector<Vector2i>& edge_diff) {
+    void applyTo(DiffArray& edge_diff) {
         for (Graph::ArcIt e(graph); e != lemon::INVALID; ++e) {
             int var = variable[e].first;
             if (var == -1) continue;
             int sgn = variable[e].second;
-            edge_diff[var / 2][var % 2] -= sgn * flow[e];
+            edge_diff.set(var / 2, var % 2, edge_diff[var / 2][var % 2] - sgn * flow[e]);
         }
     }
 
@@ -253,7 +254,7 @@ class GurobiFlowHelper : public MaxFlowHelper {
         }
         return flow;
     }
-    virtual void applyTo(std::vector<Vector2i>& edge_diff) { assert(0); };
+    virtual void applyTo(DiffArray& edge_diff) { assert(0); };
 
    private:
     GRBEnv env = GRBEnv();
@@ -346,14 +347,13 @@ class ECMaxFlowHelper : public MaxFlowHelper {
         }
         return total_flow;
     }
-    void applyTo(std::vector<Vector2i>& edge_diff) {
+    void applyTo(DiffArray& edge_diff) {
         for (int i = 0; i < graph.size(); ++i) {
             for (auto& flow : graph[i]) {
                 if (flow.flow > 0 && flow.v != -1) {
                     if (flow.flow > 0) {
-                        edge_diff[flow.v / 2][flow.v % 2] += flow.d * flow.flow;
-                        if (abs(edge_diff[flow.v / 2][flow.v % 2]) > 2) {
-                        }
+                        int e = flow.v / 2, k = flow.v % 2;
+                        edge_diff.set(e, k, edge_diff[e][k] + flow.d * flow.flow);
                     }
                 }
             }
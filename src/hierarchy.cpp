@@ -1,16 +1,14 @@
 #include "hierarchy.hpp"
 #include <fstream>
 #include <algorithm>
+#include <atomic>
 #include <unordered_map>
 #include "config.hpp"
 #include "field-math.hpp"
 #include <queue>
 #include "localsat.hpp"
+#include "parallel.hpp"
 #include "pcg32/pcg32.h"
-#ifdef WITH_TBB
-#  include "tbb/tbb.h"
-#  include "pss/parallel_stable_sort.h"
-#endif
 
 namespace qflow {
 
@@ -23,6 +21,16 @@ Hierarchy::Hierarchy() {
     mToLower.resize(MAX_DEPTH);
     mToUpper.resize(MAX_DEPTH);
     rng_seed = 0;
+    deterministic = 0;
+    level_iterations = 6;
+    max_level_iterations = 30;
+    tolerance = 0;
+    multigrid_cycles = 0;
+    multigrid_gamma = 1;
+    multigrid_smoothing = 1;
+    multigrid_depth = 2;
+    serial_level_size = GRAIN_SIZE;
+    coarsest_level_size = 1;
 
     mCQ.reserve(MAX_DEPTH + 1);
     mCQw.reserve(MAX_DEPTH + 1);
@@ -34,13 +42,16 @@ Hierarchy::Hierarchy() {
 
 void Hierarchy::Initialize(double scale, int with_scale) {
     this->with_scale = with_scale;
-    generate_graph_coloring_deterministic(mAdj[0], mV[0].cols(), mPhases[0]);
+    auto generate_graph_coloring = deterministic
+                                       ? &Hierarchy::generate_graph_coloring_parallel
+                                       : &Hierarchy::generate_graph_coloring_deterministic;
+    (this->*generate_graph_coloring)(mAdj[0], mV[0].cols(), mPhases[0]);
 
     for (int i = 0; i < MAX_DEPTH; ++i) {
         DownsampleGraph(mAdj[i], mV[i], mN[i], mA[i], mV[i + 1], mN[i + 1], mA[i + 1], mToUpper[i],
                         mToLower[i], mAdj[i + 1]);
-        generate_graph_coloring_deterministic(mAdj[i + 1], mV[i + 1].cols(), mPhases[i + 1]);
-        if (mV[i + 1].cols() == 1) {
+        (this->*generate_graph_coloring)(mAdj[i + 1], mV[i + 1].cols(), mPhases[i + 1]);
+        if (mV[i + 1].cols() <= std::max(coarsest_level_size, 1)) {
             mAdj.resize(i + 2);
             mV.resize(i + 2);
             mN.resize(i + 2);
@@ -60,30 +71,27 @@ void Hierarchy::Initialize(double scale, int with_scale) {
     mCQ.resize(mV.size());
     mCQw.resize(mV.size());
 
-    //Set random seed
-    srand(rng_seed);
-
-    mScale = scale;
     for (int i = 0; i < mV.size(); ++i) {
         mQ[i].resize(mN[i].rows(), mN[i].cols());
         mO[i].resize(mN[i].rows(), mN[i].cols());
         mS[i].resize(2, mN[i].cols());
         mK[i].resize(2, mN[i].cols());
-        for (int j = 0; j < mN[i].cols(); ++j) {
-            Vector3d s, t;
-            coordinate_system(mN[i].col(j), s, t);
-            //rand() is not thread safe!
-            double angle = ((double)rand()) / RAND_MAX * 2 * M_PI;
-            double x = ((double)rand()) / RAND_MAX * 2 - 1.f;
-            double y = ((double)rand()) / RAND_MAX * 2 - 1.f;
-            mQ[i].col(j) = s * std::cos(angle) + t * std::sin(angle);
-            mO[i].col(j) = mV[i].col(j) + (s * x + t * y) * scale;
-            if (with_scale) {
-                mS[i].col(j) = Vector2d(1.0f, 1.0f);
-                mK[i].col(j) = Vector2d(0.0, 0.0);
-            }
-        }
     }
+    // The solvers start from random fields on the coarsest level only: every finer level is
+    // overwritten by prolongation before it is read, and optimize_scale fills all of mS.
+    // EstimateSlope accumulates into mK[0] and restricts it to the coarser levels.
+    int coarsest = mV.size() - 1;
+    parallel_for(0, mN[coarsest].cols(), [&](int j) {
+        // vertex j always takes numbers 3j..3j+2 of the stream, independent of the threads
+        pcg32 rng(rng_seed, coarsest);
+        rng.advance(3 * (int64_t)j);
+        double angle = rng.nextDouble() * 2 * M_PI;
+        Vector3d s, t;
+        coordinate_system(mN[coarsest].col(j), s, t);
+        mQ[coarsest].col(j) = s * std::cos(angle) + t * std::sin(angle);
+    });
+    InitializePositions(scale);
+    if (with_scale) mK[0].setZero();
 #ifdef WITH_CUDA
     printf("copy to device...\n");
     CopyToDevice();
@@ -91,107 +99,21 @@ void Hierarchy::Initialize(double scale, int with_scale) {
 #endif
 }
 
-#ifdef WITH_TBB
-void Hierarchy::generate_graph_coloring_deterministic(const AdjacentMatrix& adj, int size,
-                                                      std::vector<std::vector<int>>& phases) {
-    struct ColorData {
-        uint8_t nColors;
-        uint32_t nNodes[256];
-        ColorData() : nColors(0) {}
-    };
-
-    const uint8_t INVALID_COLOR = 0xFF;
-    phases.clear();
-
-    /* Generate a permutation */
-    std::vector<uint32_t> perm(size);
-    std::vector<tbb::spin_mutex> mutex(size);
-    for (uint32_t i = 0; i < size; ++i) perm[i] = i;
-
-    tbb::parallel_for(tbb::blocked_range<uint32_t>(0u, size, GRAIN_SIZE),
-                      [&](const tbb::blocked_range<uint32_t>& range) {
-                          pcg32 rng;
-                          rng.advance(range.begin());
-                          for (uint32_t i = range.begin(); i != range.end(); ++i) {
-                              uint32_t j = i, k = rng.nextUInt(size - i) + i;
-                              if (j == k) continue;
-                              if (j > k) std::swap(j, k);
-                              tbb::spin_mutex::scoped_lock l0(mutex[j]);
-                              tbb::spin_mutex::scoped_lock l1(mutex[k]);
-                              std::swap(perm[j], perm[k]);
-                          }
-                      });
-
-    std::vector<uint8_t> color(size, INVALID_COLOR);
-    ColorData colorData = tbb::parallel_reduce(
-        tbb::blocked_range<uint32_t>(0u, size, GRAIN_SIZE), ColorData(),
-        [&](const tbb::blocked_range<uint32_t>& range, ColorData colorData) -> ColorData {
-            std::vector<uint32_t> neighborhood;
-            bool possible_colors[256];
-
-            for (uint32_t pidx = range.begin(); pidx != range.end(); ++pidx) {
-                uint32_t i = perm[pidx];
-
-                neighborhood.clear();
-                neighborhood.push_back(i);
-                //            for (const Link *link = adj[i]; link != adj[i + 1]; ++link)
-                for (auto& link : adj[i]) neighborhood.push_back(link.id);
-                std::sort(neighborhood.begin(), neighborhood.end());
-                for (uint32_t j : neighborhood) mutex[j].lock();
-
-                std::fill(possible_colors, possible_colors + colorData.nColors, true);
-
-                //            for (const Link *link = adj[i]; link != adj[i + 1]; ++link) {
-                for (auto& link : adj[i]) {
-                    uint8_t c = color[link.id];
-                    if (c != INVALID_COLOR) {
-                        while (c >= colorData.nColors) {
-                            possible_colors[colorData.nColors] = true;
-                            colorData.nNodes[colorData.nColors] = 0;
-                            colorData.nColors++;
-                        }
-                        possible_colors[c] = false;
-                    }
-                }
-
-                uint8_t chosen_color = INVALID_COLOR;
-                for (uint8_t j = 0; j < colorData.nColors; ++j) {
-                    if (possible_colors[j]) {
-                        chosen_color = j;
-                        break;
-                    }
-                }
-                if (chosen_color == INVALID_COLOR) {
-                    if (colorData.nColors == INVALID_COLOR - 1)
-                        throw std::runtime_error(
-                            "Ran out of colors during graph coloring! "
-                            "The input mesh is very likely corrupt.");
-                    colorData.nNodes[colorData.nColors] = 1;
-                    color[i] = colorData.nColors++;
-                } else {
-                    colorData.nNodes[chosen_color]++;
-                    color[i] = chosen_color;
-                }
-
-                for (uint32_t j : neighborhood) mutex[j].unlock();
-            }
-            return colorData;
-        },
-        [](ColorData c1, ColorData c2) -> ColorData {
-            ColorData result;
-            result.nColors = std::max(c1.nColors, c2.nColors);
-            memset(result.nNodes, 0, sizeof(uint32_t) * result.nColors);
-            for (uint8_t i = 0; i < c1.nColors; ++i) result.nNodes[i] += c1.nNodes[i];
-            for (uint8_t i = 0; i < c2.nColors; ++i) result.nNodes[i] += c2.nNodes[i];
-            return result;
-        });
-
-    phases.resize(colorData.nColors);
-    for (int i = 0; i < colorData.nColors; ++i) phases[i].reserve(colorData.nNodes[i]);
-
-    for (uint32_t i = 0; i < size; ++i) phases[color[i]].push_back(i);
+void Hierarchy::InitializePositions(double scale) {
+    mScale = scale;
+    int coarsest = mV.size() - 1;
+    parallel_for(0, mN[coarsest].cols(), [&](int j) {
+        // the offsets are numbers 3j+1 and 3j+2 of the stream that drew the orientations
+        pcg32 rng(rng_seed, coarsest);
+        rng.advance(3 * (int64_t)j + 1);
+        double x = rng.nextDouble() * 2 - 1;
+        double y = rng.nextDouble() * 2 - 1;
+        Vector3d s, t;
+        coordinate_system(mN[coarsest].col(j), s, t);
+        mO[coarsest].col(j) = mV[coarsest].col(j) + (s * x + t * y) * scale;
+    });
 }
-#else
+
 void Hierarchy::generate_graph_coloring_deterministic(const AdjacentMatrix& adj, int size,
                                                       std::vector<std::vector<int>>& phases) {
     phases.clear();
@@ -237,7 +159,60 @@ void Hierarchy::generate_graph_coloring_deterministic(const AdjacentMatrix& adj,
     for (int i = 0; i < ncolors; ++i) phases[i].reserve(size_per_color[i]);
     for (uint32_t i = 0; i < size; ++i) phases[color[i]].push_back(i);
 }
-#endif
+
+// Jones-Plassmann coloring: in each round, every uncolored vertex whose random priority beats all
+// of its uncolored neighbors takes the smallest color free among its neighbors. Such vertices are
+// never adjacent, so a round runs in parallel and the result does not depend on the thread count.
+void Hierarchy::generate_graph_coloring_parallel(const AdjacentMatrix& adj, int size,
+                                                 std::vector<std::vector<int>>& phases) {
+    phases.clear();
+
+    std::vector<uint32_t> priority(size);
+    parallel_for(0, size, [&](int i) {
+        pcg32 rng(rng_seed);
+        rng.advance(i);
+        priority[i] = rng.nextUInt();
+    });
+    auto precedes = [&](int i, int j) {
+        return priority[i] > priority[j] || (priority[i] == priority[j] && i < j);
+    };
+
+    std::vector<int> color(size, -1);
+    std::vector<int> pending(size), selected(size, 0);
+    for (int i = 0; i < size; ++i) pending[i] = i;
+    while (!pending.empty()) {
+        parallel_for(0, pending.size(), [&](int pi) {
+            int i = pending[pi];
+            for (auto& link : adj[i]) {
+                if (color[link.id] == -1 && precedes(link.id, i)) return;
+            }
+            selected[pi] = 1;
+        });
+        parallel_for(0, pending.size(), [&](int pi) {
+            if (!selected[pi]) return;
+            int i = pending[pi];
+            std::vector<uint8_t> used(adj[i].size() + 1, 0);
+            for (auto& link : adj[i]) {
+                int c = color[link.id];
+                if (c >= 0 && c < used.size()) used[c] = 1;
+            }
+            int c = 0;
+            while (used[c]) ++c;
+            color[i] = c;
+        });
+        int num_pending = 0;
+        for (int pi = 0; pi < pending.size(); ++pi) {
+            if (!selected[pi]) pending[num_pending++] = pending[pi];
+            selected[pi] = 0;
+        }
+        pending.resize(num_pending);
+    }
+
+    int ncolors = 0;
+    for (int i = 0; i < size; ++i) ncolors = std::max(ncolors, color[i] + 1);
+    phases.resize(ncolors);
+    for (int i = 0; i < size; ++i) phases[color[i]].push_back(i);
+}
 
 void Hierarchy::DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, const MatrixXd& N,
                                 const VectorXd& A, MatrixXd& V_p, MatrixXd& N_p, VectorXd& A_p,
@@ -259,10 +234,7 @@ void Hierarchy::DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, con
         bases[i] = bases[i - 1] + adj[i - 1].size();
     }
 
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < V.cols(); ++i) {
+    parallel_for(0, V.cols(), [&](int i) {
         int base = bases[i];
         auto& ad = adj[i];
         auto entry_it = entries.begin() + base;
@@ -272,13 +244,9 @@ void Hierarchy::DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, con
             double ratio = A[i] > A[k] ? (A[i] / A[k]) : (A[k] / A[i]);
             *entry_it = Entry(i, k, dp * ratio);
         }
-    }
+    });
 
-#ifdef WITH_TBB
-    pss::parallel_stable_sort(entries.begin(), entries.end(), std::less<Entry>());
-#else
-    std::stable_sort(entries.begin(), entries.end(), std::less<Entry>());
-#endif
+    parallel_stable_sort(entries, std::less<Entry>());
 
     std::vector<bool> mergeFlag(V.cols(), false);
 
@@ -298,10 +266,7 @@ void Hierarchy::DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, con
     to_upper.resize(2, vertexCount);
     to_lower.resize(V.cols());
 
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < nCollapsed; ++i) {
+    parallel_for(0, nCollapsed, [&](int i) {
         const Entry& e = entries[i];
         const double area1 = A[e.i], area2 = A[e.j], surfaceArea = area1 + area2;
         if (surfaceArea > RCPOVERFLOW)
@@ -315,7 +280,7 @@ void Hierarchy::DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, con
         to_upper.col(i) << e.i, e.j;
         to_lower[e.i] = i;
         to_lower[e.j] = i;
-    }
+    });
 
     int offset = nCollapsed;
 
@@ -333,10 +298,7 @@ void Hierarchy::DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, con
     adj_p.resize(V_p.cols());
     std::vector<int> capacity(V_p.cols());
     std::vector<std::vector<Link>> scratches(V_p.cols());
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < V_p.cols(); ++i) {
+    parallel_for(0, V_p.cols(), [&](int i) {
         int t = 0;
         for (int j = 0; j < 2; ++j) {
             int upper = to_upper(j, i);
@@ -345,11 +307,8 @@ void Hierarchy::DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, con
         }
         scratches[i].reserve(t);
         adj_p[i].reserve(t);
-    }
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < V_p.cols(); ++i) {
+    });
+    parallel_for(0, V_p.cols(), [&](int i) {
         auto& scratch = scratches[i];
         for (int j = 0; j < 2; ++j) {
             int upper = to_upper(j, i);
@@ -370,7 +329,7 @@ void Hierarchy::DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, con
                 }
             }
         }
-    }
+    });
 }
 
 void Hierarchy::SaveToFile(FILE* fp) {
@@ -407,16 +366,53 @@ void Hierarchy::LoadFromFile(FILE* fp) {
     Read(fp, this->mPhases);
 }
 
-void Hierarchy::UpdateGraphValue(std::vector<Vector3i>& FQ, std::vector<Vector3i>& F2E,
-                                 std::vector<Vector2i>& edge_diff) {
-    FQ = std::move(mFQ[0]);
-    F2E = std::move(mF2E[0]);
-    edge_diff = std::move(mEdgeDiff[0]);
+void Hierarchy::UpdateGraphValue(OrientArray& FQ, std::vector<Vector3i>& F2E,
+                                 DiffArray& edge_diff) {
+    FQ = mFQ[0];
+    F2E = mF2E[0];
+    edge_diff = mEdgeDiff[0];
+}
+
+// Faces whose edge offsets do not sum to zero, in increasing order
+static std::vector<int> SingularFaces(const OrientArray& FQ, const std::vector<Vector3i>& F2E,
+                                      const DiffArray& edge_diff) {
+    std::vector<char> singular(F2E.size());
+    parallel_for(0, F2E.size(), [&](int i) {
+        Vector2i diff(0, 0);
+        for (int j = 0; j < 3; ++j) {
+            diff += rshift90(edge_diff[F2E[i][j]], FQ[i][j]);
+        }
+        singular[i] = diff != Vector2i::Zero();
+    });
+    std::vector<int> faces;
+    for (int i = 0; i < F2E.size(); ++i) {
+        if (singular[i]) faces.push_back(i);
+    }
+    return faces;
+}
+
+// Opposite of each directed face edge, from the two faces of each undirected edge
+static std::vector<int> BuildE2E(const std::vector<Vector3i>& F2E,
+                                 const std::vector<Vector2i>& E2F) {
+    std::vector<int> E2E(F2E.size() * 3, -1);
+    parallel_for(0, E2F.size(), [&](int i) {
+        int f1 = E2F[i][0];
+        int f2 = E2F[i][1];
+        int t1 = 0;
+        int t2 = 2;
+        if (f1 != -1) while (F2E[f1][t1] != i) t1 += 1;
+        if (f2 != -1) while (F2E[f2][t2] != i) t2 -= 1;
+        t1 += f1 * 3;
+        t2 += f2 * 3;
+        if (f1 != -1) E2E[t1] = (f2 == -1) ? -1 : t2;
+        if (f2 != -1) E2E[t2] = (f1 == -1) ? -1 : t1;
+    });
+    return E2E;
 }
 
-void Hierarchy::DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vector3i>& F2E,
-                                    std::vector<Vector2i>& edge_diff,
-                                    std::vector<int>& allow_changes, int level) {
+void Hierarchy::DownsampleEdgeGraph(const OrientArray& FQ, const std::vector<Vector3i>& F2E,
+                                    const DiffArray& edge_diff, const BitArray& allow_changes,
+                                    int level) {
     std::vector<Vector2i> E2F(edge_diff.size(), Vector2i(-1, -1));
     for (int i = 0; i < F2E.size(); ++i) {
         for (int j = 0; j < 3; ++j) {
@@ -428,6 +424,16 @@ void Hierarchy::DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vecto
         }
     }
     int levels = (level == -1) ? 100 : level;
+    mFQ.clear();
+    mF2E.clear();
+    mE2F.clear();
+    mEdgeDiff.clear();
+    mAllowChanges.clear();
+    mSing.clear();
+    mToUpperEdges.clear();
+    mToLowerEdges.clear();
+    mToUpperOrients.clear();
+    mToUpperFaces.clear();
     mFQ.resize(levels);
     mF2E.resize(levels);
     mE2F.resize(levels);
@@ -435,21 +441,14 @@ void Hierarchy::DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vecto
     mAllowChanges.resize(levels);
     mSing.resize(levels);
     mToUpperEdges.resize(levels - 1);
+    mToLowerEdges.resize(levels - 1);
     mToUpperOrients.resize(levels - 1);
-    for (int i = 0; i < FQ.size(); ++i) {
-        Vector2i diff(0, 0);
-        for (int j = 0; j < 3; ++j) {
-            diff += rshift90(edge_diff[F2E[i][j]], FQ[i][j]);
-        }
-        if (diff != Vector2i::Zero()) {
-            mSing[0].push_back(i);
-        }
-    }
+    mSing[0] = SingularFaces(FQ, F2E, edge_diff);
     mAllowChanges[0] = allow_changes;
-    mFQ[0] = std::move(FQ);
-    mF2E[0] = std::move(F2E);
+    mFQ[0] = FQ;
+    mF2E[0] = F2E;
     mE2F[0] = std::move(E2F);
-    mEdgeDiff[0] = std::move(edge_diff);
+    mEdgeDiff[0] = edge_diff;
     for (int l = 0; l < levels - 1; ++l) {
         auto& FQ = mFQ[l];
         auto& E2F = mE2F[l];
@@ -463,6 +462,7 @@ void Hierarchy::DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vecto
         }
 
         auto& toUpper = mToUpperEdges[l];
+        auto& toLower = mToLowerEdges[l];
         auto& toUpperOrients = mToUpperOrients[l];
         toUpper.resize(E2F.size(), -1);
         toUpperOrients.resize(E2F.size(), 0);
@@ -474,6 +474,8 @@ void Hierarchy::DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vecto
         auto& nEdgeDiff = mEdgeDiff[l + 1];
         auto& nSing = mSing[l + 1];
 
+        // greedily collapse zero edges whose faces have no collapsed or singular neighbor; the
+        // result depends on the visiting order, so this pass stays serial
         for (int i = 0; i < E2F.size(); ++i) {
             if (EdgeDiff[i] != Vector2i::Zero()) continue;
             if ((E2F[i][0] >= 0 && fixed_faces[E2F[i][0]]) ||
@@ -500,16 +502,18 @@ void Hierarchy::DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vecto
                 fixed_faces[E2F[i][1]] = 2;
             toUpper[i] = -2;
         }
-        for (int i = 0; i < E2F.size(); ++i) {
-            if (toUpper[i] == -2) continue;
+        parallel_for(0, E2F.size(), [&](int i) {
+            if (toUpper[i] == -2) return;
             if ((E2F[i][0] < 0 || fixed_faces[E2F[i][0]] == 2) && (E2F[i][1] < 0 || fixed_faces[E2F[i][1]] == 2)) {
                 toUpper[i] = -3;
-                continue;
             }
-        }
+        });
+        // number the coarse edges; |toLower| keeps the first fine edge of each, whose rotation
+        // to the coarse edge is zero
         int numE = 0;
         for (int i = 0; i < toUpper.size(); ++i) {
             if (toUpper[i] == -1) {
+                toLower.push_back(i);
                 if ((E2F[i][0] < 0 || fixed_faces[E2F[i][0]] < 2) && (E2F[i][1] < 0 || fixed_faces[E2F[i][1]] < 2)) {
                     nE2F.push_back(E2F[i]);
                     toUpperOrients[i] = 0;
@@ -575,46 +579,43 @@ void Hierarchy::DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vecto
             }
         }
         nEdgeDiff.resize(numE);
+        parallel_for(0, numE, [&](int i) { nEdgeDiff.set(i, EdgeDiff[toLower[i]]); });
         nAllow.resize(numE * 2, 1);
         for (int i = 0; i < toUpper.size(); ++i) {
-            if (toUpper[i] >= 0 && toUpperOrients[i] == 0) {
-                nEdgeDiff[toUpper[i]] = EdgeDiff[i];
-            }
             if (toUpper[i] >= 0) {
                 int dimension = toUpperOrients[i] % 2;
-                if (Allow[i * 2 + dimension] == 0)
-                    nAllow[toUpper[i] * 2] = 0;
-                else if (Allow[i * 2 + dimension] == 2)
-                    nAllow[toUpper[i] * 2] = 2;
-                if (Allow[i * 2 + 1 - dimension] == 0)
-                    nAllow[toUpper[i] * 2 + 1] = 0;
-                else if (Allow[i * 2 + 1 - dimension] == 2)
-                    nAllow[toUpper[i] * 2 + 1] = 2;
+                if (!Allow[i * 2 + dimension]) nAllow.set(toUpper[i] * 2, false);
+                if (!Allow[i * 2 + 1 - dimension]) nAllow.set(toUpper[i] * 2 + 1, false);
             }
         }
-        std::vector<int> upperface(F2E.size(), -1);
 
-        for (int i = 0; i < F2E.size(); ++i) {
-            Vector3i eid;
+        // faces with three coarse edges survive; they are listed in order after a parallel pass
+        std::vector<int> upperface(F2E.size(), -1);
+        std::vector<Vector3i> face_eid(F2E.size());
+        OrientArray face_orient(F2E.size());
+        parallel_for(0, F2E.size(), [&](int i) {
+            Vector3i eid, eid_orient;
             for (int j = 0; j < 3; ++j) {
                 eid[j] = toUpper[F2E[i][j]];
+                eid_orient[j] = (FQ[i][j] + 4 - toUpperOrients[F2E[i][j]]) % 4;
             }
+            face_eid[i] = eid;
+            face_orient.set(i, eid_orient);
+        });
+        for (int i = 0; i < F2E.size(); ++i) {
+            Vector3i& eid = face_eid[i];
             if (eid[0] >= 0 && eid[1] >= 0 && eid[2] >= 0) {
-                Vector3i eid_orient;
-                for (int j = 0; j < 3; ++j) {
-                    eid_orient[j] = (FQ[i][j] + 4 - toUpperOrients[F2E[i][j]]) % 4;
-                }
                 upperface[i] = nF2E.size();
                 nF2E.push_back(eid);
-                nFQ.push_back(eid_orient);
+                nFQ.push_back(face_orient[i]);
             }
         }
-        for (int i = 0; i < nE2F.size(); ++i) {
+        parallel_for(0, nE2F.size(), [&](int i) {
             for (int j = 0; j < 2; ++j) {
                 if (nE2F[i][j] >= 0)
                     nE2F[i][j] = upperface[nE2F[i][j]];
             }
-        }
+        });
 
         for (auto& s : Sing) {
             if (upperface[s] >= 0) nSing.push_back(upperface[s]);
@@ -634,6 +635,7 @@ void Hierarchy::DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vecto
     mEdgeDiff.resize(levels);
     mSing.resize(levels);
     mToUpperEdges.resize(levels - 1);
+    mToLowerEdges.resize(levels - 1);
     mToUpperOrients.resize(levels - 1);
 }
 
@@ -653,20 +655,7 @@ int Hierarchy::FixFlipSat(int depth, int threshold) {
     auto& EdgeDiff = mEdgeDiff[depth];
     auto& AllowChanges = mAllowChanges[depth];
 
-    // build E2E
-    std::vector<int> E2E(F2E.size() * 3, -1);
-    for (int i = 0; i < E2F.size(); ++i) {
-        int f1 = E2F[i][0];
-        int f2 = E2F[i][1];
-        int t1 = 0;
-        int t2 = 2;
-        if (f1 != -1) while (F2E[f1][t1] != i) t1 += 1;
-        if (f2 != -1) while (F2E[f2][t2] != i) t2 -= 1;
-        t1 += f1 * 3;
-        t2 += f2 * 3;
-        if (f1 != -1) E2E[t1] = (f2 == -1) ? -1 : t2;
-        if (f2 != -1) E2E[t2] = (f1 == -1) ? -1 : t1;
-    }
+    std::vector<int> E2E = BuildE2E(F2E, E2F);
 
     auto IntegerArea = [&](int f) {
         Vector2i diff1 = rshift90(EdgeDiff[F2E[f][0]], FQ[f][0]);
@@ -758,7 +747,7 @@ int Hierarchy::FixFlipSat(int depth, int threshold) {
     }
     for (int i = 0; i < flexible.size(); ++i) {
         if (E2F[i][0] == E2F[i][1]) flexible[i] = false;
-        if (AllowChanges[i] == 0) flexible[i] = false;
+        if (!AllowChanges[i]) flexible[i] = false;
     }
 
     // Reindexing and solve
@@ -867,8 +856,8 @@ int Hierarchy::FixFlipSat(int depth, int threshold) {
     for (int i = 0; i < EdgeDiff.size(); ++i) {
         int group = groups[i];
         if (group == -1) continue;
-        EdgeDiff[i][0] = values[group][2 * indices[i] + 0];
-        EdgeDiff[i][1] = values[group][2 * indices[i] + 1];
+        EdgeDiff.set(i, Vector2i(values[group][2 * indices[i] + 0],
+                                 values[group][2 * indices[i] + 1]));
     }
     for (int i = 0; i < F2E.size(); ++i) {
         Vector2i diff(0, 0);
@@ -894,9 +883,9 @@ void Hierarchy::PushDownwardFlip(int depth) {
     for (int i = 0; i < toUpper.size(); ++i) {
         if (toUpper[i] >= 0) {
             int orient = (4 - toUpperOrients[i]) % 4;
-            nEdgeDiff[i] = rshift90(EdgeDiff[toUpper[i]], orient);
+            nEdgeDiff.set(i, rshift90(EdgeDiff[toUpper[i]], orient));
         } else {
-            nEdgeDiff[i] = Vector2i(0, 0);
+            nEdgeDiff.set(i, Vector2i(0, 0));
         }
     }
     auto& nF2E = mF2E[depth - 1];
@@ -928,24 +917,7 @@ void Hierarchy::FixFlip() {
     auto& EdgeDiff = mEdgeDiff[l];
     auto& AllowChange = mAllowChanges[l];
 
-    // build E2E
-    std::vector<int> E2E(F2E.size() * 3, -1);
-    for (int i = 0; i < E2F.size(); ++i) {
-        int v1 = E2F[i][0];
-        int v2 = E2F[i][1];
-        int t1 = 0;
-        int t2 = 2;
-        if (v1 != -1)
-            while (F2E[v1][t1] != i) t1 += 1;
-        if (v2 != -1)
-            while (F2E[v2][t2] != i) t2 -= 1;
-        t1 += v1 * 3;
-        t2 += v2 * 3;
-        if (v1 != -1)
-            E2E[t1] = (v2 == -1) ? -1 : t2;
-        if (v2 != -1)
-            E2E[t2] = (v1 == -1) ? -1 : t1;
-    }
+    std::vector<int> E2E = BuildE2E(F2E, E2F);
 
     auto Area = [&](int f) {
         Vector2i diff1 = rshift90(EdgeDiff[F2E[f][0]], FQ[f][0]);
@@ -1002,7 +974,7 @@ void Hierarchy::FixFlip() {
             int deid = corresponding_edges[i];
             int eid = F2E[deid / 3][deid % 3];
             for (int j = 0; j < 2; ++j) {
-                if (corresponding_diff[i][j] != 0 && AllowChange[eid * 2 + j] == 0) return false;
+                if (corresponding_diff[i][j] != 0 && !AllowChange[eid * 2 + j]) return false;
             }
             auto& res = new_values[eid];
             res -= corresponding_diff[i];
@@ -1019,7 +991,9 @@ void Hierarchy::FixFlip() {
             if (area < 0) prev_area += 1;
         }
         for (auto& p : new_values) {
-            std::swap(EdgeDiff[p.first], p.second);
+            Vector2i value = EdgeDiff[p.first];
+            EdgeDiff.set(p.first, p.second);
+            p.second = value;
         }
         for (int f = 0; f < corresponding_faces.size(); ++f) {
             int area = Area(corresponding_faces[f]);
@@ -1031,35 +1005,100 @@ void Hierarchy::FixFlip() {
             return true;
         }
         for (auto& p : new_values) {
-            std::swap(EdgeDiff[p.first], p.second);
+            Vector2i value = EdgeDiff[p.first];
+            EdgeDiff.set(p.first, p.second);
+            p.second = value;
         }
         return false;
     };
 
-    std::queue<int> flipped;
-    for (int i = 0; i < F2E.size(); ++i) {
-        int area = Area(i);
-        if (area < 0) {
-            flipped.push(i);
+    // Faces CheckShrink(deid) reads or changes: the fan it walks around the origin of deid
+    auto AddFanFaces = [&](int deid, std::vector<int>& faces) {
+        if (deid == -1) {
+            return;
+        }
+        int deid0 = deid;
+        while (deid != -1) {
+            deid = deid / 3 * 3 + (deid + 2) % 3;
+            if (E2E[deid] == -1)
+                break;
+            deid = E2E[deid];
+            if (deid == deid0)
+                break;
         }
+        int start = deid;
+        do {
+            faces.push_back(deid / 3);
+            deid = E2E[deid];
+            if (deid == -1) {
+                return;
+            }
+            deid = deid / 3 * 3 + (deid + 1) % 3;
+        } while (deid != start);
+    };
+
+    std::vector<char> is_flipped(F2E.size());
+    parallel_for(0, F2E.size(), [&](int i) { is_flipped[i] = Area(i) < 0; });
+    std::vector<int> flipped;
+    for (int i = 0; i < F2E.size(); ++i) {
+        if (is_flipped[i]) flipped.push_back(i);
     }
 
+    // The flipped faces are repaired in queue order by deterministic reservation: in each round
+    // the next faces reserve the fans of their vertices with their position, and the faces that
+    // hold all of their reservations touch disjoint fans and are repaired concurrently. The
+    // others wait for the next round, so the result equals the serial repair.
+    const int round_size = 4096;
+    std::vector<std::atomic<int>> reservation(F2E.size());
+    parallel_for(0, F2E.size(), [&](int i) { reservation[i] = round_size; });
     bool update = false;
     int max_len = 1;
     while (!update && max_len <= 2) {
-        while (!flipped.empty()) {
-            int f = flipped.front();
-            if (Area(f) >= 0) {
-                flipped.pop();
-                continue;
-            }
-            for (int i = 0; i < 3; ++i) {
-                if (CheckShrink(f * 3 + i, max_len) || CheckShrink(E2E[f * 3 + i], max_len)) {
-                    update = true;
-                    break;
+        std::vector<int> pending;
+        pending.swap(flipped);
+        int begin = 0;
+        while (begin < pending.size()) {
+            int num = std::min(round_size, (int)pending.size() - begin);
+            std::vector<std::vector<int>> fans(num);
+            parallel_for(0, num, [&](int k) {
+                int f = pending[begin + k];
+                fans[k].push_back(f);
+                for (int i = 0; i < 3; ++i) {
+                    AddFanFaces(f * 3 + i, fans[k]);
+                    AddFanFaces(E2E[f * 3 + i], fans[k]);
+                }
+                for (int g : fans[k]) {
+                    int current = reservation[g];
+                    while (k < current && !reservation[g].compare_exchange_weak(current, k)) {
+                    }
+                }
+            });
+            std::vector<char> status(num, 0);  // 1: repaired or not flipped, 2: changed diffs
+            parallel_for(0, num, [&](int k) {
+                for (int g : fans[k]) {
+                    if (reservation[g] != k) return;
+                }
+                status[k] = 1;
+                int f = pending[begin + k];
+                if (Area(f) >= 0) return;
+                for (int i = 0; i < 3; ++i) {
+                    if (CheckShrink(f * 3 + i, max_len) || CheckShrink(E2E[f * 3 + i], max_len)) {
+                        status[k] = 2;
+                        break;
+                    }
                 }
+            });
+            parallel_for(0, num, [&](int k) {
+                for (int g : fans[k]) reservation[g] = round_size;
+            });
+            // the deferred faces keep their order in front of the remaining ones
+            std::vector<int> deferred;
+            for (int k = 0; k < num; ++k) {
+                if (status[k] == 0) deferred.push_back(pending[begin + k]);
+                if (status[k] == 2) update = true;
             }
-            flipped.pop();
+            begin += num - deferred.size();
+            std::copy(deferred.begin(), deferred.end(), pending.begin() + begin);
         }
         max_len += 1;
     }
@@ -1086,16 +1125,16 @@ void Hierarchy::PropagateEdge() {
         for (int i = 0; i < toUpper.size(); ++i) {
             if (toUpper[i] >= 0) {
                 int orient = (4 - toUpperOrients[i]) % 4;
-                nEdgeDiff[i] = rshift90(EdgeDiff[toUpper[i]], orient);
+                nEdgeDiff.set(i, rshift90(EdgeDiff[toUpper[i]], orient));
             } else {
-                nEdgeDiff[i] = Vector2i(0, 0);
+                nEdgeDiff.set(i, Vector2i(0, 0));
             }
         }
         for (int i = 0; i < toUpperFace.size(); ++i) {
             if (toUpperFace[i] == -1) continue;
             Vector3i eid_orient = FQ[toUpperFace[i]];
             for (int j = 0; j < 3; ++j) {
-                nFQ[i][j] = (eid_orient[j] + toUpperOrients[F2E[i][j]]) % 4;
+                nFQ.set(i, j, (eid_orient[j] + toUpperOrients[F2E[i][j]]) % 4);
             }
         }
     }
@@ -9,6 +9,7 @@
 #include <vector>
 #include "adjacent-matrix.hpp"
 #include "config.hpp"
+#include "packed-array.hpp"
 #include "serialize.hpp"
 #define RCPOVERFLOW 2.93873587705571876e-39f
 
@@ -16,24 +17,33 @@ using namespace Eigen;
 
 namespace qflow {
 
+// Sweeps spent on a hierarchy level and the residual of the last one
+struct LevelStatistics {
+    int iterations;
+    double residual;
+};
+
 class Hierarchy {
    public:
     Hierarchy();
     void Initialize(double scale, int with_scale = 0);
+    // Sets the target edge length and redraws the random initial positions for it, so that one
+    // orientation field can be reused for several target resolutions
+    void InitializePositions(double scale);
     void DownsampleGraph(const AdjacentMatrix adj, const MatrixXd& V, const MatrixXd& N,
                          const VectorXd& A, MatrixXd& V_p, MatrixXd& N_p, VectorXd& A_p,
                          MatrixXi& to_upper, VectorXi& to_lower, AdjacentMatrix& adj_p);
     void generate_graph_coloring_deterministic(const AdjacentMatrix& adj, int size,
                                                std::vector<std::vector<int>>& phases);
+    void generate_graph_coloring_parallel(const AdjacentMatrix& adj, int size,
+                                          std::vector<std::vector<int>>& phases);
     void FixFlip();
     int FixFlipSat(int depth, int threshold = 0);
     void PushDownwardFlip(int depth);
     void PropagateEdge();
-    void DownsampleEdgeGraph(std::vector<Vector3i>& FQ, std::vector<Vector3i>& F2E,
-                             std::vector<Vector2i>& edge_diff,
-                             std::vector<int>& allow_changes, int level);
-    void UpdateGraphValue(std::vector<Vector3i>& FQ, std::vector<Vector3i>& F2E,
-                          std::vector<Vector2i>& edge_diff);
+    void DownsampleEdgeGraph(const OrientArray& FQ, const std::vector<Vector3i>& F2E,
+                             const DiffArray& edge_diff, const BitArray& allow_changes, int level);
+    void UpdateGraphValue(OrientArray& FQ, std::vector<Vector3i>& F2E, DiffArray& edge_diff);
 
     enum { MAX_DEPTH = 25 };
 
@@ -45,6 +55,30 @@ class Hierarchy {
 
     double mScale;
     int rng_seed;
+    // Color the levels in parallel and shuffle with pcg32, so the output only depends on
+    // rng_seed (not on the thread count or the standard library).
+    int deterministic;
+
+    // Gauss-Seidel sweeps per level. With tolerance > 0 a level is smoothed until the mean
+    // update (radians for orientations, edge lengths for positions) drops below it, using at
+    // most max_level_iterations sweeps.
+    int level_iterations;
+    int max_level_iterations;
+    double tolerance;
+    // With multigrid_cycles > 0 the finest level runs multigrid cycles instead of plain sweeps:
+    // the field is restricted multigrid_depth levels down and the coarse changes are carried
+    // back, with multigrid_smoothing sweeps before and after each correction.
+    int multigrid_cycles;
+    int multigrid_gamma;  // 1: V-cycle, 2: W-cycle
+    int multigrid_smoothing;
+    int multigrid_depth;
+    // Levels with fewer vertices than serial_level_size are smoothed by a serial kernel.
+    // Coarsening stops once a level has at most coarsest_level_size vertices; that level is
+    // solved to convergence.
+    int serial_level_size;
+    int coarsest_level_size;
+    std::vector<LevelStatistics> mOrientationStats;
+    std::vector<LevelStatistics> mPositionStats;
 
     MatrixXi mF;    // mF(i, j) i \in [0, 3) ith index in face j
     VectorXi mE2E;  // inverse edge
@@ -73,12 +107,13 @@ class Hierarchy {
     std::vector<std::vector<int>> mToUpperFaces;  // face correspondance
     std::vector<std::vector<int>> mSing;
     std::vector<std::vector<int>> mToUpperEdges; // edge correspondance
+    std::vector<std::vector<int>> mToLowerEdges; // a fine edge of each coarse edge, same rotation
     std::vector<std::vector<int>> mToUpperOrients; // rotation of edges from fine to coarse
-    std::vector<std::vector<Vector3i>> mFQ; // face_edgeOrients
+    std::vector<OrientArray> mFQ; // face_edgeOrients
     std::vector<std::vector<Vector3i>> mF2E; // face_edgeIds
     std::vector<std::vector<Vector2i>> mE2F; // undirect edges to face ID
-    std::vector<std::vector<int> > mAllowChanges;
-    std::vector<std::vector<Vector2i>> mEdgeDiff; // face_edgeDiff
+    std::vector<BitArray> mAllowChanges;
+    std::vector<DiffArray> mEdgeDiff; // face_edgeDiff
 
 #ifdef WITH_CUDA
     std::vector<Link*> cudaAdj;
@@ -0,0 +1,107 @@
+#include "instances.hpp"
+
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cstdint>
+
+#include "parallel.hpp"
+
+namespace qflow {
+
+// vertices of a component in input coordinates
+static MatrixXd input_positions(const Parametrizer& component) {
+    MatrixXd V = component.V * component.normalize_scale;
+    V.colwise() += component.normalize_offset;
+    return V;
+}
+
+int find_instances(const std::vector<Parametrizer>& components, std::vector<int>& instance_of,
+                   std::vector<Matrix3d>& rotations, std::vector<Vector3d>& translations) {
+    int num_components = components.size();
+    instance_of.resize(num_components);
+    rotations.assign(num_components, Matrix3d::Identity());
+    translations.assign(num_components, Vector3d::Zero());
+
+    // the shape key hashes the counts and the faces, which rigid copies share exactly
+    std::vector<std::pair<uint64_t, int>> keys(num_components);
+    std::vector<Vector3d> centroids(num_components), moments(num_components);
+    std::vector<double> radii(num_components);
+    parallel_for(0, num_components, [&](int c) {
+        const Parametrizer& component = components[c];
+        uint64_t key = 14695981039346656037ull;
+        auto mix = [&](uint64_t value) { key = (key ^ value) * 1099511628211ull; };
+        mix(component.V.cols());
+        mix(component.F.cols());
+        for (int f = 0; f < component.F.cols(); ++f) {
+            for (int j = 0; j < 3; ++j) mix(component.F(j, f));
+        }
+        keys[c] = std::make_pair(key, c);
+
+        MatrixXd V = input_positions(component);
+        Vector3d centroid = V.rowwise().mean();
+        MatrixXd X = V.colwise() - centroid;
+        Matrix3d covariance = X * X.transpose() / std::max((int)V.cols(), 1);
+        SelfAdjointEigenSolver<Matrix3d> solver(covariance);
+        centroids[c] = centroid;
+        moments[c] = solver.eigenvalues();
+        radii[c] = std::sqrt(std::max(covariance.trace(), 0.0));
+    }, 1);
+
+    // buckets of equal keys, each in component order
+    parallel_stable_sort(keys, [](const std::pair<uint64_t, int>& a,
+                                  const std::pair<uint64_t, int>& b) {
+        return a.first < b.first;
+    });
+    std::vector<int> bucket_begin;
+    for (int i = 0; i < num_components; ++i) {
+        if (i == 0 || keys[i].first != keys[i - 1].first) bucket_begin.push_back(i);
+    }
+    int num_buckets = bucket_begin.size();
+    bucket_begin.push_back(num_components);
+
+    std::vector<int> num_shapes(num_buckets, 0);
+    parallel_for(0, num_buckets, [&](int b) {
+        std::vector<int> shapes;
+        for (int i = bucket_begin[b]; i < bucket_begin[b + 1]; ++i) {
+            int c = keys[i].second;
+            instance_of[c] = c;
+            MatrixXd Q;
+            for (int s : shapes) {
+                const Parametrizer& shape = components[s];
+                const Parametrizer& component = components[c];
+                if (shape.V.cols() != component.V.cols() || shape.F != component.F) continue;
+                double radius = std::max(radii[s], radii[c]);
+                double tolerance = 1e-4 * radius;
+                // the principal moments are invariant under rigid motions
+                if ((moments[s] - moments[c]).norm() > 2 * tolerance * radius) continue;
+
+                // the rotation that best maps the vertices of s onto those of c
+                MatrixXd P = input_positions(shape);
+                if (Q.size() == 0) Q = input_positions(component);
+                Matrix3d H =
+                    (P.colwise() - centroids[s]) * (Q.colwise() - centroids[c]).transpose();
+                JacobiSVD<Matrix3d> svd(H, ComputeFullU | ComputeFullV);
+                // the closest proper rotation; the sign of det(VU^T) is arbitrary for flat parts,
+                // where H is singular, and mirror images fail the error test below
+                double det = (svd.matrixV() * svd.matrixU().transpose()).determinant();
+                Vector3d d(1, 1, det < 0 ? -1 : 1);
+                Matrix3d R = svd.matrixV() * d.asDiagonal() * svd.matrixU().transpose();
+                Vector3d t = centroids[c] - R * centroids[s];
+                double error = ((R * P).colwise() + t - Q).colwise().norm().maxCoeff();
+                if (error > tolerance) continue;
+                instance_of[c] = s;
+                rotations[c] = R;
+                translations[c] = t;
+                break;
+            }
+            if (instance_of[c] == c) shapes.push_back(c);
+        }
+        num_shapes[b] = shapes.size();
+    }, 1);
+
+    int total_shapes = 0;
+    for (int b = 0; b < num_buckets; ++b) total_shapes += num_shapes[b];
+    return total_shapes;
+}
+
+} // namespace qflow
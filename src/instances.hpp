@@ -0,0 +1,24 @@
+#ifndef INSTANCES_H_
+#define INSTANCES_H_
+
+#include <Eigen/Core>
+#include <vector>
+
+#include "parametrizer.hpp"
+
+namespace qflow {
+
+using namespace Eigen;
+
+// Finds the components that are rigid copies of an earlier component. Candidates share the
+// vertex and face counts, the connectivity and the principal moments about the centroid. The
+// pose is then fitted to the corresponding vertices, since the principal axes of symmetric parts
+// such as bolts are not unique. instance_of[c] is the first component with the shape of c, or c
+// itself. rotations[c] and translations[c] map that component onto c in input coordinates.
+// Returns the number of distinct shapes.
+int find_instances(const std::vector<Parametrizer>& components, std::vector<int>& instance_of,
+                   std::vector<Matrix3d>& rotations, std::vector<Vector3d>& translations);
+
+} // namespace qflow
+
+#endif
@@ -164,8 +164,8 @@ SolverStatus SolveSatProblem(int n_variable, std::vector<int> &value,
     return rcnf;
 }
 
-void ExportLocalSat(std::vector<Vector2i> &edge_diff, const std::vector<Vector3i> &face_edgeIds,
-                    const std::vector<Vector3i> &face_edgeOrients, const MatrixXi &F,
+void ExportLocalSat(DiffArray &edge_diff, const std::vector<Vector3i> &face_edgeIds,
+                    const OrientArray &face_edgeOrients, const MatrixXi &F,
                     const VectorXi &V2E, const VectorXi &E2E) {
     int flip_count = 0;
     int flip_count1 = 0;
@@ -287,8 +287,7 @@ void ExportLocalSat(std::vector<Vector2i> &edge_diff, const std::vector<Vector3i
                     constant_ge);
 
     for (int i = 0; i < edge_diff.size(); ++i) {
-        edge_diff[i][0] = value[2 * i + 0];
-        edge_diff[i][1] = value[2 * i + 1];
+        edge_diff.set(i, Vector2i(value[2 * i + 0], value[2 * i + 1]));
     }
 }
 
@@ -4,6 +4,8 @@
 #include <Eigen/Core>
 #include <vector>
 
+#include "packed-array.hpp"
+
 namespace qflow {
 
 using namespace Eigen;
@@ -22,8 +24,8 @@ SolverStatus SolveSatProblem(int n_variable, std::vector<int> &value,
                              const std::vector<Vector2i> &constant_ge,
                              int timeout = 8);
 
-void ExportLocalSat(std::vector<Vector2i> &edge_diff, const std::vector<Vector3i> &face_edgeIds,
-                    const std::vector<Vector3i> &face_edgeOrients, const MatrixXi &F,
+void ExportLocalSat(DiffArray &edge_diff, const std::vector<Vector3i> &face_edgeIds,
+                    const OrientArray &face_edgeOrients, const MatrixXi &F,
                     const VectorXi &V2E, const VectorXi &E2E);
 
 } // namespace qflow
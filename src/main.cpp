@@ -1,8 +1,13 @@
 #include "config.hpp"
 #include "field-math.hpp"
+#include "instances.hpp"
 #include "optimizer.hpp"
+#include "parallel.hpp"
 #include "parametrizer.hpp"
 #include <stdlib.h>
+#include <algorithm>
+#include <string>
+#include <vector>
 
 #ifdef WITH_CUDA
 #include <cuda_runtime.h>
@@ -12,53 +17,22 @@ using namespace qflow;
 
 Parametrizer field;
 
-int main(int argc, char** argv) {
-    setbuf(stdout, NULL);
+// smallest face budget of a component with -components
+const int MIN_COMPONENT_FACES = 8;
 
-#ifdef WITH_CUDA
-    cudaFree(0);
-#endif
+// Initialization, boundary constraints, orientation field and slope of a loaded mesh, prepared
+// for |faces| target faces
+static void PrepareField(Parametrizer& mesh, int faces, bool verbose) {
     int t1, t2;
-    std::string input_obj, output_obj;
-    int faces = -1;
-    for (int i = 0; i < argc; ++i) {
-        if (strcmp(argv[i], "-f") == 0) {
-            sscanf(argv[i + 1], "%d", &faces);
-        } else if (strcmp(argv[i], "-i") == 0) {
-            input_obj = argv[i + 1];
-        } else if (strcmp(argv[i], "-o") == 0) {
-            output_obj = argv[i + 1];
-        } else if (strcmp(argv[i], "-sharp") == 0) {
-            field.flag_preserve_sharp = 1;
-        } else if (strcmp(argv[i], "-boundary") == 0) {
-            field.flag_preserve_boundary = 1;
-        } else if (strcmp(argv[i], "-adaptive") == 0) {
-            field.flag_adaptive_scale = 1;
-        } else if (strcmp(argv[i], "-mcf") == 0) {
-            field.flag_minimum_cost_flow = 1;
-        } else if (strcmp(argv[i], "-sat") == 0) {
-            field.flag_aggresive_sat = 1;
-        } else if (strcmp(argv[i], "-seed") == 0) {
-            field.hierarchy.rng_seed = atoi(argv[i + 1]);
-        }
-    }
-    printf("%d %s %s\n", faces, input_obj.c_str(), output_obj.c_str());
-    if (input_obj.size() >= 1) {
-        field.Load(input_obj.c_str());
-    } else {
-        assert(0);
-        // field.Load((std::string(DATA_PATH) + "/fertility.obj").c_str());
-    }
-
-    printf("Initialize...\n");
+    if (verbose) printf("Initialize...\n");
     t1 = GetCurrentTime64();
-    field.Initialize(faces);
+    mesh.Initialize(faces);
     t2 = GetCurrentTime64();
-    printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
+    if (verbose) printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
 
-    if (field.flag_preserve_boundary) {
-        printf("Add boundary constrains...\n");
-        Hierarchy& mRes = field.hierarchy;
+    if (mesh.flag_preserve_boundary) {
+        if (verbose) printf("Add boundary constrains...\n");
+        Hierarchy& mRes = mesh.hierarchy;
         mRes.clearConstraints();
         for (uint32_t i = 0; i < 3 * mRes.mF.cols(); ++i) {
             if (mRes.mE2E[i] == -1) {
@@ -79,47 +53,271 @@ int main(int argc, char** argv) {
         mRes.propagateConstraints();
     }
 
-    printf("Solve Orientation Field...\n");
+    if (verbose) printf("Solve Orientation Field...\n");
     t1 = GetCurrentTime64();
 
-    Optimizer::optimize_orientations(field.hierarchy);
-    field.ComputeOrientationSingularities();
+    Optimizer::optimize_orientations(mesh.hierarchy);
+    mesh.ComputeOrientationSingularities();
     t2 = GetCurrentTime64();
-    printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
+    if (verbose) printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
 
-    if (field.flag_adaptive_scale == 1) {
-        printf("Estimate Slop...\n");
+    if (mesh.flag_adaptive_scale == 1) {
+        if (verbose) printf("Estimate Slop...\n");
         t1 = GetCurrentTime64();
-        field.EstimateSlope();
+        mesh.EstimateSlope();
         t2 = GetCurrentTime64();
-        printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
+        if (verbose) printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
     }
-    printf("Solve for scale...\n");
+}
+
+// Scale, position and integer stages for one target resolution of a prepared mesh
+static void ExtractQuadMesh(Parametrizer& lod, bool verbose) {
+    int t1, t2;
+    if (verbose) printf("Solve for scale...\n");
     t1 = GetCurrentTime64();
-    Optimizer::optimize_scale(field.hierarchy, field.rho, field.flag_adaptive_scale);
-    field.flag_adaptive_scale = 1;
+    Optimizer::optimize_scale(lod.hierarchy, lod.rho, lod.flag_adaptive_scale);
+    lod.flag_adaptive_scale = 1;
     t2 = GetCurrentTime64();
-    printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
+    if (verbose) printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
 
-    printf("Solve for position field...\n");
+    if (verbose) printf("Solve for position field...\n");
     t1 = GetCurrentTime64();
-    Optimizer::optimize_positions(field.hierarchy, field.flag_adaptive_scale);
+    Optimizer::optimize_positions(lod.hierarchy, lod.flag_adaptive_scale);
 
-    field.ComputePositionSingularities();
+    lod.ComputePositionSingularities();
     t2 = GetCurrentTime64();
-    printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
+    if (verbose) printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
     t1 = GetCurrentTime64();
-    printf("Solve index map...\n");
-    field.ComputeIndexMap();
+    if (verbose) printf("Solve index map...\n");
+    lod.ComputeIndexMap();
     t2 = GetCurrentTime64();
-    printf("Indexmap Use %lf seconds\n", (t2 - t1) * 1e-3);
-    printf("Writing the file...\n");
+    if (verbose) printf("Indexmap Use %lf seconds\n", (t2 - t1) * 1e-3);
+}
 
+static void WriteMesh(Parametrizer& lod, const std::string& output_obj, bool verbose) {
+    if (verbose) printf("Writing the file...\n");
     if (output_obj.size() < 1) {
         assert(0);
-        // field.OutputMesh((std::string(DATA_PATH) + "/result.obj").c_str());
+        // lod.OutputMesh((std::string(DATA_PATH) + "/result.obj").c_str());
     } else {
-        field.OutputMesh(output_obj.c_str());
+        lod.OutputMesh(output_obj.c_str());
+    }
+}
+
+// output.obj -> output_2000.obj
+static std::string TargetOutputName(const std::string& output_obj, int faces) {
+    size_t dot = output_obj.find_last_of('.');
+    size_t slash = output_obj.find_last_of("/\\");
+    if (dot == std::string::npos || (slash != std::string::npos && dot < slash))
+        dot = output_obj.size();
+    return output_obj.substr(0, dot) + "_" + std::to_string(faces) + output_obj.substr(dot);
+}
+
+// Remeshes the connected components of the loaded mesh concurrently, each with the share of the
+// target faces of its surface area, and writes one merged quad mesh per target. With |instances|,
+// rigid copies of a component reuse its quad mesh.
+static void RemeshComponents(const std::vector<int>& targets, const std::string& output_obj,
+                             bool instances) {
+    int t1 = GetCurrentTime64();
+    std::vector<Parametrizer> components;
+    field.SplitComponents(components);
+    int num_components = components.size();
+    std::vector<double> areas(num_components);
+    double total_area = 0;
+    for (int c = 0; c < num_components; ++c) {
+        components[c].ComputeMeshStatus();
+        double scale = components[c].normalize_scale;
+        areas[c] = components[c].surface_area * scale * scale;
+        // components without area have nothing to remesh
+        if (areas[c] > 0) total_area += areas[c];
+    }
+    int num_targets = std::max((int)targets.size(), 1);
+    auto budget = [&](int c, int t) {
+        if (targets.empty() || targets[t] <= 0) return -1;
+        return std::max(MIN_COMPONENT_FACES, (int)std::round(targets[t] * areas[c] / total_area));
+    };
+    std::vector<int> instance_of(num_components);
+    std::vector<Matrix3d> rotations;
+    std::vector<Vector3d> translations;
+    if (instances) {
+        int num_shapes = find_instances(components, instance_of, rotations, translations);
+        printf("Found %d distinct shapes in %d components\n", num_shapes, num_components);
+    } else {
+        for (int c = 0; c < num_components; ++c) instance_of[c] = c;
+    }
+    printf("Remesh %d components...\n", num_components);
+
+    std::vector<Parametrizer> quads(num_components * num_targets);
+    TaskGroup group;
+    for (int c = 0; c < num_components; ++c) {
+        if (!(areas[c] > 0) || instance_of[c] != c) continue;
+        auto task = [&, c]() {
+            Parametrizer& component = components[c];
+            int faces = budget(c, 0);
+            for (int t = 1; t < num_targets; ++t) faces = std::max(faces, budget(c, t));
+            PrepareField(component, faces, false);
+            for (int t = 0; t < num_targets; ++t) {
+                Parametrizer* lod = &component;
+                Parametrizer copy;
+                if (num_targets > 1) {
+                    copy = component;
+                    copy.SetTargetFaces(budget(c, t));
+                    lod = &copy;
+                }
+                ExtractQuadMesh(*lod, false);
+                // only the quad mesh is kept
+                Parametrizer& quad = quads[c * num_targets + t];
+                quad.O_compact = std::move(lod->O_compact);
+                quad.F_compact = std::move(lod->F_compact);
+                quad.normalize_scale = lod->normalize_scale;
+                quad.normalize_offset = lod->normalize_offset;
+            }
+            component = Parametrizer();
+        };
+        if (field.flag_aggresive_sat)
+            task();
+        else
+            group.run(task);
+    }
+    group.wait();
+    // the copies move the quad mesh of their shape into place
+    parallel_for(0, num_components, [&](int c) {
+        int s = instance_of[c];
+        if (s == c || !(areas[c] > 0)) return;
+        for (int t = 0; t < num_targets; ++t) {
+            const Parametrizer& shape = quads[s * num_targets + t];
+            Parametrizer& quad = quads[c * num_targets + t];
+            quad.O_compact.resize(shape.O_compact.size());
+            for (int i = 0; i < shape.O_compact.size(); ++i) {
+                Vector3d p = shape.O_compact[i] * shape.normalize_scale + shape.normalize_offset;
+                quad.O_compact[i] = rotations[c] * p + translations[c];
+            }
+            quad.F_compact = shape.F_compact;
+            quad.normalize_scale = 1;
+            quad.normalize_offset = Vector3d::Zero();
+        }
+        components[c] = Parametrizer();
+    }, 1);
+    int t2 = GetCurrentTime64();
+    printf("Use %lf seconds\n", (t2 - t1) * 1e-3);
+
+    for (int t = 0; t < num_targets; ++t) {
+        field.O_compact.clear();
+        field.F_compact.clear();
+        for (int c = 0; c < num_components; ++c) field.MergeQuadMesh(quads[c * num_targets + t]);
+        WriteMesh(field, num_targets > 1 ? TargetOutputName(output_obj, targets[t]) : output_obj,
+                  true);
+    }
+}
+
+int main(int argc, char** argv) {
+    setbuf(stdout, NULL);
+
+#ifdef WITH_CUDA
+    cudaFree(0);
+#endif
+    std::string input_obj, output_obj;
+    int faces = -1;
+    std::vector<int> targets;
+    int flag_components = 0, flag_instances = 0;
+    for (int i = 0; i < argc; ++i) {
+        if (strcmp(argv[i], "-f") == 0) {
+            // a comma separated list writes one output per target face count
+            for (char* p = argv[i + 1]; *p;) {
+                targets.push_back(strtol(p, &p, 10));
+                if (*p != ',') break;
+                ++p;
+            }
+        } else if (strcmp(argv[i], "-i") == 0) {
+            input_obj = argv[i + 1];
+        } else if (strcmp(argv[i], "-o") == 0) {
+            output_obj = argv[i + 1];
+        } else if (strcmp(argv[i], "-sharp") == 0) {
+            field.flag_preserve_sharp = 1;
+        } else if (strcmp(argv[i], "-boundary") == 0) {
+            field.flag_preserve_boundary = 1;
+        } else if (strcmp(argv[i], "-adaptive") == 0) {
+            field.flag_adaptive_scale = 1;
+        } else if (strcmp(argv[i], "-mcf") == 0) {
+            field.flag_minimum_cost_flow = 1;
+        } else if (strcmp(argv[i], "-components") == 0) {
+            flag_components = 1;
+        } else if (strcmp(argv[i], "-instances") == 0) {
+            flag_components = 1;
+            flag_instances = 1;
+        } else if (strcmp(argv[i], "-decimate") == 0) {
+            field.flag_decimate = 1;
+        } else if (strcmp(argv[i], "-sat") == 0) {
+            field.flag_aggresive_sat = 1;
+        } else if (strcmp(argv[i], "-seed") == 0) {
+            field.hierarchy.rng_seed = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-iterations") == 0) {
+            field.hierarchy.level_iterations = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-max-iterations") == 0) {
+            field.hierarchy.max_level_iterations = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-tolerance") == 0) {
+            field.hierarchy.tolerance = atof(argv[i + 1]);
+        } else if (strcmp(argv[i], "-vcycle") == 0 || strcmp(argv[i], "-wcycle") == 0) {
+            field.hierarchy.multigrid_cycles = atoi(argv[i + 1]);
+            field.hierarchy.multigrid_gamma = argv[i][1] == 'w' ? 2 : 1;
+        } else if (strcmp(argv[i], "-coarsest") == 0) {
+            field.hierarchy.coarsest_level_size = atoi(argv[i + 1]);
+        } else if (strcmp(argv[i], "-threads") == 0) {
+            set_num_threads(atoi(argv[i + 1]));
+        } else if (strcmp(argv[i], "-deterministic") == 0) {
+            field.hierarchy.deterministic = 1;
+        }
+    }
+    if (targets.size() > 1) {
+        for (int target : targets) {
+            if (target <= 0) {
+                printf("Invalid target face count %d\n", target);
+                exit(1);
+            }
+        }
+    }
+    // the mesh is prepared for the finest target
+    if (!targets.empty()) faces = *std::max_element(targets.begin(), targets.end());
+    printf("%d %s %s\n", faces, input_obj.c_str(), output_obj.c_str());
+    if (input_obj.size() >= 1) {
+        field.Load(input_obj.c_str());
+    } else {
+        assert(0);
+        // field.Load((std::string(DATA_PATH) + "/fertility.obj").c_str());
+    }
+
+    if (flag_components) {
+        RemeshComponents(targets, output_obj, flag_instances);
+    } else {
+        PrepareField(field, faces, true);
+        if (targets.size() <= 1) {
+            ExtractQuadMesh(field, true);
+            WriteMesh(field, output_obj, true);
+        } else {
+            // the targets share everything up to the orientation field and run in parallel
+            // from there, each on its own copy; the SAT solver exchanges fixed file names, so
+            // -sat runs them one after another. The stages of concurrent targets would
+            // interleave, so each target reports a single line.
+            printf("Solve %d targets...\n", (int)targets.size());
+            TaskGroup group;
+            for (int target : targets) {
+                std::string target_obj = TargetOutputName(output_obj, target);
+                auto task = [target, target_obj]() {
+                    int t1 = GetCurrentTime64();
+                    Parametrizer lod = field;
+                    lod.SetTargetFaces(target);
+                    ExtractQuadMesh(lod, false);
+                    WriteMesh(lod, target_obj, false);
+                    int t2 = GetCurrentTime64();
+                    printf("Target %d faces use %lf seconds\n", target, (t2 - t1) * 1e-3);
+                };
+                if (field.flag_aggresive_sat)
+                    task();
+                else
+                    group.run(task);
+            }
+            group.wait();
+        }
     }
     printf("finish...\n");
     //	field.LoopFace(2);
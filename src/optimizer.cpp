@@ -6,12 +6,15 @@
 #include <iostream>
 #include <memory>
 #include <queue>
-#include <unordered_map>
 
+#include "bvh.hpp"
 #include "config.hpp"
 #include "field-math.hpp"
 #include "flow.hpp"
+#include "parallel.hpp"
 #include "parametrizer.hpp"
+#include "sparse-assembly.hpp"
+#include "sparse-solver.hpp"
 
 namespace qflow {
 
@@ -29,6 +32,447 @@ using LinearSolver = Eigen::SparseLU<T>;
 
 Optimizer::Optimizer() {}
 
+// Value a Gauss-Seidel update assigns to orientation i: the weighted average of its neighbors,
+// blended with its constraint. Returns false for vertices without neighbors.
+static bool average_orientation(const Hierarchy& mRes, int level, int i, Vector3d& sum) {
+    const AdjacentMatrix& adj = mRes.mAdj[level];
+    const MatrixXd& N = mRes.mN[level];
+    const MatrixXd& CQ = mRes.mCQ[level];
+    const VectorXd& CQw = mRes.mCQw[level];
+    const MatrixXd& Q = mRes.mQ[level];
+    const Vector3d n_i = N.col(i);
+    double weight_sum = 0.0f;
+    sum = Q.col(i);
+    for (auto& link : adj[i]) {
+        const int j = link.id;
+        const double weight = link.weight;
+        if (weight == 0) continue;
+        const Vector3d n_j = N.col(j);
+        Vector3d q_j = Q.col(j);
+        std::pair<Vector3d, Vector3d> value = compat_orientation_extrinsic_4(sum, n_i, q_j, n_j);
+        sum = value.first * weight_sum + value.second * weight;
+        sum -= n_i * n_i.dot(sum);
+        weight_sum += weight;
+        double norm = sum.norm();
+        if (norm > RCPOVERFLOW) sum /= norm;
+    }
+
+    if (CQw.size() > 0) {
+        float cw = CQw[i];
+        if (cw != 0) {
+            std::pair<Vector3d, Vector3d> value =
+                compat_orientation_extrinsic_4(sum, n_i, CQ.col(i), n_i);
+            sum = value.first * (1 - cw) + value.second * cw;
+            sum -= n_i * n_i.dot(sum);
+
+            float norm = sum.norm();
+            if (norm > RCPOVERFLOW) sum /= norm;
+        }
+    }
+    return weight_sum > 0;
+}
+
+static void position_scale(const Hierarchy& mRes, int level, int with_scale, int i,
+                           double& scale_x, double& scale_y) {
+    scale_x = mRes.mScale;
+    scale_y = mRes.mScale;
+    if (with_scale) {
+        scale_x *= mRes.mS[level](0, i);
+        scale_y *= mRes.mS[level](1, i);
+    }
+}
+
+// Value a Gauss-Seidel update assigns to position i before it is rounded to the lattice point
+// closest to the vertex. Returns false for vertices without neighbors.
+static bool average_position(const Hierarchy& mRes, int level, int with_scale, int i,
+                             Vector3d& sum) {
+    const AdjacentMatrix& adj = mRes.mAdj[level];
+    const MatrixXd &N = mRes.mN[level], &Q = mRes.mQ[level], &V = mRes.mV[level];
+    const MatrixXd& CQ = mRes.mCQ[level];
+    const MatrixXd& CO = mRes.mCO[level];
+    const VectorXd& COw = mRes.mCOw[level];
+    const MatrixXd& O = mRes.mO[level];
+    double scale_x, scale_y;
+    position_scale(mRes, level, with_scale, i, scale_x, scale_y);
+    double inv_scale_x = 1.0f / scale_x;
+    double inv_scale_y = 1.0f / scale_y;
+    const Vector3d n_i = N.col(i), v_i = V.col(i);
+    Vector3d q_i = Q.col(i);
+
+    sum = O.col(i);
+    double weight_sum = 0.0f;
+
+    q_i.normalize();
+    for (auto& link : adj[i]) {
+        const int j = link.id;
+        const double weight = link.weight;
+        if (weight == 0) continue;
+        double scale_x_1, scale_y_1;
+        position_scale(mRes, level, with_scale, j, scale_x_1, scale_y_1);
+        double inv_scale_x_1 = 1.0f / scale_x_1;
+        double inv_scale_y_1 = 1.0f / scale_y_1;
+
+        const Vector3d n_j = N.col(j), v_j = V.col(j);
+        Vector3d q_j = Q.col(j), o_j = O.col(j);
+
+        q_j.normalize();
+
+        std::pair<Vector3d, Vector3d> value = compat_position_extrinsic_4(
+            v_i, n_i, q_i, sum, v_j, n_j, q_j, o_j, scale_x, scale_y, inv_scale_x, inv_scale_y,
+            scale_x_1, scale_y_1, inv_scale_x_1, inv_scale_y_1);
+
+        sum = value.first * weight_sum + value.second * weight;
+        weight_sum += weight;
+        if (weight_sum > RCPOVERFLOW) sum /= weight_sum;
+        sum -= n_i.dot(sum - v_i) * n_i;
+    }
+
+    if (COw.size() > 0) {
+        float cw = COw[i];
+        if (cw != 0) {
+            Vector3d co = CO.col(i), cq = CQ.col(i);
+            Vector3d d = co - sum;
+            d -= cq.dot(d) * cq;
+            sum += cw * d;
+            sum -= n_i.dot(sum - v_i) * n_i;
+        }
+    }
+    return weight_sum > 0;
+}
+
+static Vector3d rotate_in_plane(const Vector3d& q, const Vector3d& n, double angle) {
+    return q * std::cos(angle) + n.cross(q) * std::sin(angle);
+}
+
+// Signed angle of the rotation about n taking |from| to the closest representative of |to|
+static double rotation_angle(const Vector3d& from, const Vector3d& to, const Vector3d& n) {
+    auto value = compat_orientation_extrinsic_4(to, n, from, n);
+    return std::atan2(n.dot(value.second.cross(value.first)), value.second.dot(value.first));
+}
+
+// Shortest representative of the displacement d modulo the position lattice
+static Vector3d lattice_reduce(const Vector3d& d, const Vector3d& q, const Vector3d& n,
+                               double scale_x, double scale_y) {
+    Vector3d t = n.cross(q);
+    return d - q * (std::round(q.dot(d) / scale_x) * scale_x) -
+           t * (std::round(t.dot(d) / scale_y) * scale_y);
+}
+
+// Gauss-Seidel update of orientation i, rotated by the multigrid offset |rhs| if given. Returns
+// the rotation of the vertex when |residual| is set.
+static double update_orientation(Hierarchy& mRes, int level, int i, bool residual,
+                                 const MatrixXd* rhs) {
+    MatrixXd& Q = mRes.mQ[level];
+    Vector3d sum;
+    if (!average_orientation(mRes, level, i, sum)) return 0;
+    const Vector3d n_i = mRes.mN[level].col(i);
+    if (rhs) sum = rotate_in_plane(sum, n_i, (*rhs)(0, i));
+    double change = residual ? std::abs(rotation_angle(Q.col(i), sum, n_i)) : 0;
+    Q.col(i) = sum;
+    return change;
+}
+
+// Gauss-Seidel update of position i, shifted by the multigrid offset |rhs| if given. Returns the
+// displacement of the vertex when |residual| is set.
+static double update_position(Hierarchy& mRes, int level, int with_scale, int i, bool residual,
+                              const MatrixXd* rhs) {
+    MatrixXd& O = mRes.mO[level];
+    Vector3d sum;
+    if (!average_position(mRes, level, with_scale, i, sum)) return 0;
+    if (rhs) sum += rhs->col(i);
+    double scale_x, scale_y;
+    position_scale(mRes, level, with_scale, i, scale_x, scale_y);
+    Vector3d q_i = mRes.mQ[level].col(i).normalized();
+    Vector3d o_i = position_round_4(sum, q_i, mRes.mN[level].col(i), mRes.mV[level].col(i),
+                                    scale_x, scale_y, 1.0f / scale_x, 1.0f / scale_y);
+    double change = residual ? (o_i - O.col(i)).norm() : 0;
+    O.col(i) = o_i;
+    return change;
+}
+
+// One Gauss-Seidel sweep over the color phases of a level. |rhs| holds per-vertex rotations
+// added to each update by the multigrid cycles. With |residual| set, the mean rotation of the
+// field (in radians) over the sweep is returned. Levels below serial_level_size are swept
+// serially in vertex order, where the phase barriers would cost more than the updates.
+static double relax_orientations(Hierarchy& mRes, int level, bool residual,
+                                 const MatrixXd* rhs = nullptr) {
+    int num = mRes.mN[level].cols();
+    double change = 0;
+    if (num < mRes.serial_level_size) {
+        for (int i = 0; i < num; ++i) change += update_orientation(mRes, level, i, residual, rhs);
+        return change / std::max(num, 1);
+    }
+    auto& phases = mRes.mPhases[level];
+    for (int phase = 0; phase < phases.size(); ++phase) {
+        auto& p = phases[phase];
+        change += parallel_sum(0, p.size(),
+                               [&](int pi) { return update_orientation(mRes, level, p[pi], residual, rhs); });
+    }
+    return change / std::max(num, 1);
+}
+
+// One Gauss-Seidel sweep of the position field, with optional per-vertex offsets |rhs|. With
+// |residual| set, the mean displacement relative to the target edge length is returned.
+static double relax_positions(Hierarchy& mRes, int level, int with_scale, bool residual,
+                              const MatrixXd* rhs = nullptr) {
+    int num = mRes.mN[level].cols();
+    double change = 0;
+    if (num < mRes.serial_level_size) {
+        for (int i = 0; i < num; ++i)
+            change += update_position(mRes, level, with_scale, i, residual, rhs);
+        return change / (mRes.mScale * std::max(num, 1));
+    }
+    auto& phases = mRes.mPhases[level];
+    for (int phase = 0; phase < phases.size(); ++phase) {
+        auto& p = phases[phase];
+        change += parallel_sum(0, p.size(),
+                               [&](int pi) { return update_position(mRes, level, with_scale, p[pi], residual, rhs); });
+    }
+    return change / (mRes.mScale * std::max(num, 1));
+}
+
+// Runs the sweeps of one level: exactly level_iterations of them, or with a positive tolerance
+// until the residual drops below it (at most max_level_iterations).
+template <class Relax>
+static LevelStatistics smooth_level(const Hierarchy& mRes, const Relax& relax) {
+    LevelStatistics stats;
+    stats.iterations = 0;
+    stats.residual = 0;
+    if (mRes.tolerance > 0) {
+        while (stats.iterations < mRes.max_level_iterations) {
+            stats.residual = relax(true);
+            stats.iterations += 1;
+            if (stats.residual < mRes.tolerance) break;
+        }
+    } else {
+        for (int iter = 0; iter < mRes.level_iterations; ++iter) {
+            stats.residual = relax(iter + 1 == mRes.level_iterations);
+            stats.iterations += 1;
+        }
+    }
+    return stats;
+}
+
+// The coarsest level is small enough to be solved outright: it is swept until the field stops
+// changing, using at most max_level_iterations sweeps.
+template <class Relax>
+static LevelStatistics solve_coarsest(const Hierarchy& mRes, const Relax& relax) {
+    LevelStatistics stats;
+    stats.iterations = 0;
+    stats.residual = 0;
+    while (stats.iterations < std::max(mRes.max_level_iterations, 1)) {
+        stats.residual = relax(true);
+        stats.iterations += 1;
+        if (stats.residual < 1e-6) break;
+    }
+    return stats;
+}
+
+// Restricts the orientation field of level l to level l + 1.
+static void restrict_orientations(Hierarchy& mRes, int l) {
+    const MatrixXd& N = mRes.mN[l];
+    const MatrixXd& N_next = mRes.mN[l + 1];
+    const MatrixXd& Q = mRes.mQ[l];
+    MatrixXd& Q_next = mRes.mQ[l + 1];
+    auto& toUpper = mRes.mToUpper[l];
+    parallel_for(0, toUpper.cols(), [&](int i) {
+        Vector2i upper = toUpper.col(i);
+        Vector3d q0 = Q.col(upper[0]);
+        Vector3d n0 = N.col(upper[0]);
+        Vector3d q;
+
+        if (upper[1] != -1) {
+            Vector3d q1 = Q.col(upper[1]);
+            Vector3d n1 = N.col(upper[1]);
+            auto result = compat_orientation_extrinsic_4(q0, n0, q1, n1);
+            q = result.first + result.second;
+        } else {
+            q = q0;
+        }
+        Vector3d n = N_next.col(i);
+        q -= n.dot(q) * n;
+        if (q.squaredNorm() > RCPOVERFLOW) q.normalize();
+
+        Q_next.col(i) = q;
+    });
+}
+
+// Multigrid cycles solve the smoothing problem in full approximation storage form: the coarse
+// level relaxes towards the restricted fine field plus the restricted defect of the fine level,
+// so a converged fine field is left untouched and only the smooth error is carried back.
+struct OrientationCycle {
+    Hierarchy& mRes;
+
+    std::vector<MatrixXd>& field() { return mRes.mQ; }
+    double relax(int level, bool residual, const MatrixXd* rhs) {
+        return relax_orientations(mRes, level, residual, rhs);
+    }
+    // rotation each vertex still needs to reach the value of a sweep
+    void defect(int level, const MatrixXd* rhs, MatrixXd& r) {
+        const MatrixXd &N = mRes.mN[level], &Q = mRes.mQ[level];
+        r.setZero(1, N.cols());
+        parallel_for(0, N.cols(), [&](int i) {
+            Vector3d sum, n_i = N.col(i);
+            if (!average_orientation(mRes, level, i, sum)) return;
+            if (rhs) sum = rotate_in_plane(sum, n_i, (*rhs)(0, i));
+            r(0, i) = rotation_angle(Q.col(i), sum, n_i);
+        });
+    }
+    void restrict_field(int level) { restrict_orientations(mRes, level); }
+    void restrict_defect(int level, const MatrixXd& r, MatrixXd& r_next) {
+        const MatrixXi& toUpper = mRes.mToUpper[level];
+        r_next.resize(1, toUpper.cols());
+        for (int i = 0; i < toUpper.cols(); ++i) {
+            int i0 = toUpper(0, i), i1 = toUpper(1, i);
+            r_next(0, i) = (i1 == -1) ? r(0, i0) : 0.5 * (r(0, i0) + r(0, i1));
+        }
+    }
+    // rotates the orientations of level - 1 by the change made to the restricted field
+    void correct(int level, const MatrixXd& Q_restricted) {
+        const MatrixXd& Q = mRes.mQ[level];
+        const MatrixXd& N = mRes.mN[level];
+        const MatrixXi& toUpper = mRes.mToUpper[level - 1];
+        MatrixXd& destField = mRes.mQ[level - 1];
+        const MatrixXd& N_dest = mRes.mN[level - 1];
+        parallel_for(0, Q.cols(), [&](int i) {
+            double angle = rotation_angle(Q_restricted.col(i), Q.col(i), N.col(i));
+            for (int k = 0; k < 2; ++k) {
+                int dest = toUpper(k, i);
+                if (dest == -1) continue;
+                destField.col(dest) = rotate_in_plane(destField.col(dest), N_dest.col(dest), angle);
+            }
+        });
+    }
+};
+
+struct PositionCycle {
+    Hierarchy& mRes;
+    int with_scale;
+
+    std::vector<MatrixXd>& field() { return mRes.mO; }
+    double relax(int level, bool residual, const MatrixXd* rhs) {
+        return relax_positions(mRes, level, with_scale, residual, rhs);
+    }
+    // displacement each vertex still needs to reach the value of a sweep
+    void defect(int level, const MatrixXd* rhs, MatrixXd& r) {
+        const MatrixXd &N = mRes.mN[level], &Q = mRes.mQ[level], &O = mRes.mO[level];
+        r.setZero(3, N.cols());
+        parallel_for(0, N.cols(), [&](int i) {
+            Vector3d sum;
+            if (!average_position(mRes, level, with_scale, i, sum)) return;
+            if (rhs) sum += rhs->col(i);
+            double scale_x, scale_y;
+            position_scale(mRes, level, with_scale, i, scale_x, scale_y);
+            r.col(i) =
+                lattice_reduce(sum - O.col(i), Q.col(i).normalized(), N.col(i), scale_x, scale_y);
+        });
+    }
+    void restrict_field(int level) {
+        const MatrixXd &N = mRes.mN[level], &Q = mRes.mQ[level], &V = mRes.mV[level];
+        const MatrixXd& O = mRes.mO[level];
+        const MatrixXd &N_next = mRes.mN[level + 1], &V_next = mRes.mV[level + 1];
+        MatrixXd& O_next = mRes.mO[level + 1];
+        const MatrixXi& toUpper = mRes.mToUpper[level];
+        parallel_for(0, toUpper.cols(), [&](int i) {
+            int i0 = toUpper(0, i), i1 = toUpper(1, i);
+            Vector3d o = O.col(i0);
+            if (i1 != -1) {
+                double scale_x, scale_y, scale_x_1, scale_y_1;
+                position_scale(mRes, level, with_scale, i0, scale_x, scale_y);
+                position_scale(mRes, level, with_scale, i1, scale_x_1, scale_y_1);
+                auto value = compat_position_extrinsic_4(
+                    V.col(i0), N.col(i0), Q.col(i0), O.col(i0), V.col(i1), N.col(i1), Q.col(i1),
+                    O.col(i1), scale_x, scale_y, 1.0 / scale_x, 1.0 / scale_y, scale_x_1,
+                    scale_y_1, 1.0 / scale_x_1, 1.0 / scale_y_1);
+                o = (value.first + value.second) * 0.5;
+            }
+            Vector3d n = N_next.col(i), v = V_next.col(i);
+            o -= n * n.dot(o - v);
+            O_next.col(i) = o;
+        });
+    }
+    void restrict_defect(int level, const MatrixXd& r, MatrixXd& r_next) {
+        const MatrixXd& N_next = mRes.mN[level + 1];
+        const MatrixXi& toUpper = mRes.mToUpper[level];
+        r_next.resize(3, toUpper.cols());
+        for (int i = 0; i < toUpper.cols(); ++i) {
+            int i0 = toUpper(0, i), i1 = toUpper(1, i);
+            Vector3d d = (i1 == -1) ? Vector3d(r.col(i0)) : Vector3d(0.5 * (r.col(i0) + r.col(i1)));
+            Vector3d n = N_next.col(i);
+            r_next.col(i) = d - n * n.dot(d);
+        }
+    }
+    // moves the positions of level - 1 by the change made to the restricted field
+    void correct(int level, const MatrixXd& O_restricted) {
+        const MatrixXd &O = mRes.mO[level], &N = mRes.mN[level], &Q = mRes.mQ[level];
+        const MatrixXi& toUpper = mRes.mToUpper[level - 1];
+        MatrixXd& destField = mRes.mO[level - 1];
+        const MatrixXd &N_dest = mRes.mN[level - 1], &V_dest = mRes.mV[level - 1];
+        parallel_for(0, O.cols(), [&](int i) {
+            double scale_x, scale_y;
+            position_scale(mRes, level, with_scale, i, scale_x, scale_y);
+            Vector3d delta = lattice_reduce(O.col(i) - O_restricted.col(i), Q.col(i).normalized(),
+                                            N.col(i), scale_x, scale_y);
+            for (int k = 0; k < 2; ++k) {
+                int dest = toUpper(k, i);
+                if (dest == -1) continue;
+                Vector3d o = destField.col(dest) + delta, n = N_dest.col(dest);
+                o -= n * n.dot(o - V_dest.col(dest));
+                destField.col(dest) = o;
+            }
+        });
+    }
+};
+
+// One multigrid cycle rooted at |level|: pre-smoothing, restriction, multigrid_gamma recursive
+// cycles on the next level (1: V-cycle, 2: W-cycle), coarse correction and post-smoothing.
+// Returns the residual of the last post-smoothing sweep.
+template <class Cycle>
+static double multigrid_cycle(Hierarchy& mRes, Cycle& cycle, int level, int depth,
+                              const MatrixXd* rhs) {
+    for (int i = 0; i < mRes.multigrid_smoothing; ++i) cycle.relax(level, false, rhs);
+    if (depth > 0 && level + 1 < cycle.field().size()) {
+        MatrixXd r, r_next, rhs_next;
+        cycle.defect(level, rhs, r);
+        cycle.restrict_field(level);
+        MatrixXd restricted = cycle.field()[level + 1];
+        cycle.defect(level + 1, nullptr, rhs_next);
+        cycle.restrict_defect(level, r, r_next);
+        rhs_next = r_next - rhs_next;
+        for (int k = 0; k < mRes.multigrid_gamma; ++k)
+            multigrid_cycle(mRes, cycle, level + 1, depth - 1, &rhs_next);
+        cycle.correct(level + 1, restricted);
+    }
+    double residual = 0;
+    for (int i = 0; i < mRes.multigrid_smoothing; ++i)
+        residual = cycle.relax(level, i + 1 == mRes.multigrid_smoothing, rhs);
+    return residual;
+}
+
+// Smooths a level with multigrid cycles instead of plain sweeps: multigrid_cycles of them, or
+// with a positive tolerance until the residual drops below it.
+template <class Cycle>
+static LevelStatistics cycle_level(Hierarchy& mRes, Cycle& cycle, int level) {
+    LevelStatistics stats;
+    stats.iterations = 0;
+    stats.residual = 0;
+    for (int k = 0; k < mRes.multigrid_cycles; ++k) {
+        stats.residual = multigrid_cycle(mRes, cycle, level, mRes.multigrid_depth, nullptr);
+        stats.iterations += 2 * mRes.multigrid_smoothing;
+        if (mRes.tolerance > 0 && stats.residual < mRes.tolerance) break;
+    }
+    return stats;
+}
+
+static void report_levels(const char* name, const Hierarchy& mRes,
+                          const std::vector<LevelStatistics>& stats) {
+    lprintf("  %s field sweeps:\n", name);
+    for (int level = stats.size() - 1; level >= 0; --level) {
+        lprintf("  level %2d: %8d vertices, %3d iterations, residual %.3e\n", level,
+                (int)mRes.mV[level].cols(), stats[level].iterations, stats[level].residual);
+    }
+}
+
 void Optimizer::optimize_orientations(Hierarchy& mRes) {
 #ifdef WITH_CUDA
     optimize_orientations_cuda(mRes);
@@ -38,108 +482,36 @@ void Optimizer::optimize_orientations(Hierarchy& mRes) {
 
 #else
 
-    int levelIterations = 6;
+    OrientationCycle cycle = {mRes};
+    mRes.mOrientationStats.resize(mRes.mN.size());
     for (int level = mRes.mN.size() - 1; level >= 0; --level) {
-        AdjacentMatrix& adj = mRes.mAdj[level];
-        const MatrixXd& N = mRes.mN[level];
-        const MatrixXd& CQ = mRes.mCQ[level];
-        const VectorXd& CQw = mRes.mCQw[level];
-        MatrixXd& Q = mRes.mQ[level];
-        auto& phases = mRes.mPhases[level];
-        for (int iter = 0; iter < levelIterations; ++iter) {
-            for (int phase = 0; phase < phases.size(); ++phase) {
-                auto& p = phases[phase];
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-                for (int pi = 0; pi < p.size(); ++pi) {
-                    int i = p[pi];
-                    const Vector3d n_i = N.col(i);
-                    double weight_sum = 0.0f;
-                    Vector3d sum = Q.col(i);
-                    for (auto& link : adj[i]) {
-                        const int j = link.id;
-                        const double weight = link.weight;
-                        if (weight == 0) continue;
-                        const Vector3d n_j = N.col(j);
-                        Vector3d q_j = Q.col(j);
-                        std::pair<Vector3d, Vector3d> value =
-                            compat_orientation_extrinsic_4(sum, n_i, q_j, n_j);
-                        sum = value.first * weight_sum + value.second * weight;
-                        sum -= n_i * n_i.dot(sum);
-                        weight_sum += weight;
-                        double norm = sum.norm();
-                        if (norm > RCPOVERFLOW) sum /= norm;
-                    }
-
-                    if (CQw.size() > 0) {
-                        float cw = CQw[i];
-                        if (cw != 0) {
-                            std::pair<Vector3d, Vector3d> value =
-                                compat_orientation_extrinsic_4(sum, n_i, CQ.col(i), n_i);
-                            sum = value.first * (1 - cw) + value.second * cw;
-                            sum -= n_i * n_i.dot(sum);
-
-                            float norm = sum.norm();
-                            if (norm > RCPOVERFLOW) sum /= norm;
-                        }
-                    }
-
-                    if (weight_sum > 0) {
-                        Q.col(i) = sum;
-                    }
-                }
-            }
+        if (level == 0 && mRes.multigrid_cycles > 0) {
+            mRes.mOrientationStats[level] = cycle_level(mRes, cycle, level);
+        } else if (level + 1 == mRes.mN.size()) {
+            mRes.mOrientationStats[level] = solve_coarsest(
+                mRes, [&](bool residual) { return relax_orientations(mRes, level, residual); });
+        } else {
+            mRes.mOrientationStats[level] = smooth_level(
+                mRes, [&](bool residual) { return relax_orientations(mRes, level, residual); });
         }
         if (level > 0) {
             const MatrixXd& srcField = mRes.mQ[level];
             const MatrixXi& toUpper = mRes.mToUpper[level - 1];
             MatrixXd& destField = mRes.mQ[level - 1];
             const MatrixXd& N = mRes.mN[level - 1];
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-            for (int i = 0; i < srcField.cols(); ++i) {
+            parallel_for(0, srcField.cols(), [&](int i) {
                 for (int k = 0; k < 2; ++k) {
                     int dest = toUpper(k, i);
                     if (dest == -1) continue;
                     Vector3d q = srcField.col(i), n = N.col(dest);
                     destField.col(dest) = q - n * n.dot(q);
                 }
-            }
+            });
         }
     }
+    report_levels("orientation", mRes, mRes.mOrientationStats);
 
-    for (int l = 0; l < mRes.mN.size() - 1; ++l) {
-        const MatrixXd& N = mRes.mN[l];
-        const MatrixXd& N_next = mRes.mN[l + 1];
-        const MatrixXd& Q = mRes.mQ[l];
-        MatrixXd& Q_next = mRes.mQ[l + 1];
-        auto& toUpper = mRes.mToUpper[l];
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-        for (int i = 0; i < toUpper.cols(); ++i) {
-            Vector2i upper = toUpper.col(i);
-            Vector3d q0 = Q.col(upper[0]);
-            Vector3d n0 = N.col(upper[0]);
-            Vector3d q;
-
-            if (upper[1] != -1) {
-                Vector3d q1 = Q.col(upper[1]);
-                Vector3d n1 = N.col(upper[1]);
-                auto result = compat_orientation_extrinsic_4(q0, n0, q1, n1);
-                q = result.first + result.second;
-            } else {
-                q = q0;
-            }
-            Vector3d n = N_next.col(i);
-            q -= n.dot(q) * n;
-            if (q.squaredNorm() > RCPOVERFLOW) q.normalize();
-
-            Q_next.col(i) = q;
-        }
-    }
+    for (int l = 0; l < mRes.mN.size() - 1; ++l) restrict_orientations(mRes, l);
 
 #endif
 }
@@ -153,83 +525,99 @@ void Optimizer::optimize_scale(Hierarchy& mRes, VectorXd& rho, int adaptive) {
     MatrixXi& F = mRes.mF;
 
     if (adaptive) {
-        std::vector<Eigen::Triplet<double>> lhsTriplets;
-
-        lhsTriplets.reserve(F.cols() * 6);
-        for (int i = 0; i < V.cols(); ++i) {
+        parallel_for(0, V.cols(), [&](int i) {
             for (int j = 0; j < 2; ++j) {
                 S(j, i) = 1.0;
                 double sc1 = std::max(0.75 * S(j, i), rho[i] * 1.0 / mRes.mScale);
                 S(j, i) = std::min(S(j, i), sc1);
             }
-        }
-
-        std::vector<std::map<int, double>> entries(V.cols() * 2);
+        });
+
+        // lambda |s - S|^2 plus, for every directed edge, (v2_x - scale_x * v1_x)^2 and the same in
+        // y. Each edge writes its own 8 slots, so the system is assembled without locks.
+        int num = V.cols() * 2, num_dedges = F.cols() * 3;
+        int num_slots = num + num_dedges * 8;
+        std::vector<int> slot_rows(num_slots), slot_cols(num_slots);
+        std::vector<double> slot_values(num_slots);
         double lambda = 1;
-        for (int i = 0; i < entries.size(); ++i) {
-            entries[i][i] = lambda;
-        }
-        for (int i = 0; i < F.cols(); ++i) {
-            for (int j = 0; j < 3; ++j) {
-                int v1 = F(j, i);
-                int v2 = F((j + 1) % 3, i);
-                Vector3d diff = V.col(v2) - V.col(v1);
-                Vector3d q_1 = Q.col(v1);
-                Vector3d q_2 = Q.col(v2);
-                Vector3d n_1 = N.col(v1);
-                Vector3d n_2 = N.col(v2);
-                Vector3d q_1_y = n_1.cross(q_1);
-                auto index = compat_orientation_extrinsic_index_4(q_1, n_1, q_2, n_2);
-                int v1_x = v1 * 2, v1_y = v1 * 2 + 1, v2_x = v2 * 2, v2_y = v2 * 2 + 1;
-
-                double dx = diff.dot(q_1);
-                double dy = diff.dot(q_1_y);
-
-                double kx_g = K(0, v1);
-                double ky_g = K(1, v1);
-
-                if (index.first % 2 != index.second % 2) {
-                    std::swap(v2_x, v2_y);
-                }
-                double scale_x = (fmin(fmax(1 + kx_g * dy, 0.3), 3));
-                double scale_y = (fmin(fmax(1 + ky_g * dx, 0.3), 3));
-                //                (v2_x - scale_x * v1_x)^2 = 0
-                // x^2 - 2s xy + s^2 y^2
-                entries[v2_x][v2_x] += 1;
-                entries[v1_x][v1_x] += scale_x * scale_x;
-                entries[v2_y][v2_y] += 1;
-                entries[v1_y][v1_y] += scale_y * scale_y;
-                auto it = entries[v1_x].find(v2_x);
-                if (it == entries[v1_x].end()) {
-                    entries[v1_x][v2_x] = -scale_x;
-                    entries[v2_x][v1_x] = -scale_x;
-                    entries[v1_y][v2_y] = -scale_y;
-                    entries[v2_y][v1_y] = -scale_y;
-                } else {
-                    it->second -= scale_x;
-                    entries[v2_x][v1_x] -= scale_x;
-                    entries[v1_y][v2_y] -= scale_y;
-                    entries[v2_y][v1_y] -= scale_y;
-                }
-            }
-        }
+        parallel_for(0, num, [&](int i) {
+            slot_rows[i] = slot_cols[i] = i;
+            slot_values[i] = lambda;
+        });
+        parallel_for(0, num_dedges, [&](int e) {
+            int i = e / 3, j = e % 3;
+            int v1 = F(j, i);
+            int v2 = F((j + 1) % 3, i);
+            Vector3d diff = V.col(v2) - V.col(v1);
+            Vector3d q_1 = Q.col(v1);
+            Vector3d q_2 = Q.col(v2);
+            Vector3d n_1 = N.col(v1);
+            Vector3d n_2 = N.col(v2);
+            Vector3d q_1_y = n_1.cross(q_1);
+            auto index = compat_orientation_extrinsic_index_4(q_1, n_1, q_2, n_2);
+            int v1_x = v1 * 2, v1_y = v1 * 2 + 1, v2_x = v2 * 2, v2_y = v2 * 2 + 1;
 
-        Eigen::SparseMatrix<double> A(V.cols() * 2, V.cols() * 2);
-        VectorXd rhs(V.cols() * 2);
-        rhs.setZero();
-        for (int i = 0; i < entries.size(); ++i) {
-            rhs(i) = lambda * S(i % 2, i / 2);
-            for (auto& rec : entries[i]) {
-                lhsTriplets.push_back(Eigen::Triplet<double>(i, rec.first, rec.second));
-            }
-        }
-        A.setFromTriplets(lhsTriplets.begin(), lhsTriplets.end());
-        LinearSolver<Eigen::SparseMatrix<double>> solver;
-        solver.analyzePattern(A);
+            double dx = diff.dot(q_1);
+            double dy = diff.dot(q_1_y);
 
-        solver.factorize(A);
+            double kx_g = K(0, v1);
+            double ky_g = K(1, v1);
 
-        VectorXd result = solver.solve(rhs);
+            if (index.first % 2 != index.second % 2) {
+                std::swap(v2_x, v2_y);
+            }
+            double scale_x = (fmin(fmax(1 + kx_g * dy, 0.3), 3));
+            double scale_y = (fmin(fmax(1 + ky_g * dx, 0.3), 3));
+            //                (v2_x - scale_x * v1_x)^2 = 0
+            // x^2 - 2s xy + s^2 y^2
+            int slot = num + e * 8;
+            auto add = [&](int row, int col, double value) {
+                slot_rows[slot] = row;
+                slot_cols[slot] = col;
+                slot_values[slot++] = value;
+            };
+            add(v2_x, v2_x, 1);
+            add(v1_x, v1_x, scale_x * scale_x);
+            add(v2_y, v2_y, 1);
+            add(v1_y, v1_y, scale_y * scale_y);
+            add(v1_x, v2_x, -scale_x);
+            add(v2_x, v1_x, -scale_x);
+            add(v1_y, v2_y, -scale_y);
+            add(v2_y, v1_y, -scale_y);
+        });
+
+        SparseAssembly assembly;
+        assembly.analyze(num, num, slot_rows, slot_cols);
+        SparseAssembly::Matrix A;
+        assembly.assemble(slot_values, A);
+        VectorXd x0(num);
+        parallel_for(0, V.cols(), [&](int i) {
+            x0(i * 2) = S(0, i);
+            x0(i * 2 + 1) = S(1, i);
+        });
+        VectorXd rhs = lambda * x0;
+
+#ifdef LOG_OUTPUT
+        int t1 = GetCurrentTime64();
+#endif
+        // The system is SPD with eigenvalues in [lambda, lambda + O(valence)], so Jacobi-
+        // preconditioned CG started from the clamped scales needs a few dozen iterations.
+        Eigen::ConjugateGradient<SparseAssembly::Matrix, Eigen::Lower | Eigen::Upper> solver;
+        solver.setTolerance(1e-8);
+        solver.setMaxIterations(1000);
+        solver.compute(A);
+        VectorXd result = solver.solveWithGuess(rhs, x0);
+        if (solver.info() != Eigen::Success) {
+            Eigen::SparseMatrix<double> B = A;
+            LinearSolver<Eigen::SparseMatrix<double>> direct;
+            direct.compute(B);
+            result = direct.solve(rhs);
+        }
+#ifdef LOG_OUTPUT
+        int t2 = GetCurrentTime64();
+        printf("[Scale] CG: %d iterations, error %.3e, %d nonzeros, %lf seconds.\n",
+               (int)solver.iterations(), solver.error(), assembly.num_entries(), (t2 - t1) * 1e-3);
+#endif
 
         double total_area = 0;
         for (int i = 0; i < V.cols(); ++i) {
@@ -266,89 +654,24 @@ void Optimizer::optimize_scale(Hierarchy& mRes, VectorXd& rho, int adaptive) {
 }
 
 void Optimizer::optimize_positions(Hierarchy& mRes, int with_scale) {
-    int levelIterations = 6;
 #ifdef WITH_CUDA
     optimize_positions_cuda(mRes);
     cudaMemcpy(mRes.mO[0].data(), mRes.cudaO[0], sizeof(glm::dvec3) * mRes.mO[0].cols(),
                cudaMemcpyDeviceToHost);
 #else
+    PositionCycle cycle = {mRes, with_scale};
+    mRes.mPositionStats.resize(mRes.mAdj.size());
     for (int level = mRes.mAdj.size() - 1; level >= 0; --level) {
-        for (int iter = 0; iter < levelIterations; ++iter) {
-            AdjacentMatrix& adj = mRes.mAdj[level];
-            const MatrixXd &N = mRes.mN[level], &Q = mRes.mQ[level], &V = mRes.mV[level];
-            const MatrixXd& CQ = mRes.mCQ[level];
-            const MatrixXd& CO = mRes.mCO[level];
-            const VectorXd& COw = mRes.mCOw[level];
-            MatrixXd& O = mRes.mO[level];
-            MatrixXd& S = mRes.mS[level];
-            auto& phases = mRes.mPhases[level];
-            for (int phase = 0; phase < phases.size(); ++phase) {
-                auto& p = phases[phase];
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-                for (int pi = 0; pi < p.size(); ++pi) {
-                    int i = p[pi];
-                    double scale_x = mRes.mScale;
-                    double scale_y = mRes.mScale;
-                    if (with_scale) {
-                        scale_x *= S(0, i);
-                        scale_y *= S(1, i);
-                    }
-                    double inv_scale_x = 1.0f / scale_x;
-                    double inv_scale_y = 1.0f / scale_y;
-                    const Vector3d n_i = N.col(i), v_i = V.col(i);
-                    Vector3d q_i = Q.col(i);
-
-                    Vector3d sum = O.col(i);
-                    double weight_sum = 0.0f;
-
-                    q_i.normalize();
-                    for (auto& link : adj[i]) {
-                        const int j = link.id;
-                        const double weight = link.weight;
-                        if (weight == 0) continue;
-                        double scale_x_1 = mRes.mScale;
-                        double scale_y_1 = mRes.mScale;
-                        if (with_scale) {
-                            scale_x_1 *= S(0, j);
-                            scale_y_1 *= S(1, j);
-                        }
-                        double inv_scale_x_1 = 1.0f / scale_x_1;
-                        double inv_scale_y_1 = 1.0f / scale_y_1;
-
-                        const Vector3d n_j = N.col(j), v_j = V.col(j);
-                        Vector3d q_j = Q.col(j), o_j = O.col(j);
-
-                        q_j.normalize();
-
-                        std::pair<Vector3d, Vector3d> value = compat_position_extrinsic_4(
-                            v_i, n_i, q_i, sum, v_j, n_j, q_j, o_j, scale_x, scale_y, inv_scale_x,
-                            inv_scale_y, scale_x_1, scale_y_1, inv_scale_x_1, inv_scale_y_1);
-
-                        sum = value.first * weight_sum + value.second * weight;
-                        weight_sum += weight;
-                        if (weight_sum > RCPOVERFLOW) sum /= weight_sum;
-                        sum -= n_i.dot(sum - v_i) * n_i;
-                    }
-
-                    if (COw.size() > 0) {
-                        float cw = COw[i];
-                        if (cw != 0) {
-                            Vector3d co = CO.col(i), cq = CQ.col(i);
-                            Vector3d d = co - sum;
-                            d -= cq.dot(d) * cq;
-                            sum += cw * d;
-                            sum -= n_i.dot(sum - v_i) * n_i;
-                        }
-                    }
-
-                    if (weight_sum > 0) {
-                        O.col(i) = position_round_4(sum, q_i, n_i, v_i, scale_x, scale_y,
-                                                    inv_scale_x, inv_scale_y);
-                    }
-                }
-            }
+        if (level == 0 && mRes.multigrid_cycles > 0) {
+            mRes.mPositionStats[level] = cycle_level(mRes, cycle, level);
+        } else if (level + 1 == mRes.mAdj.size()) {
+            mRes.mPositionStats[level] = solve_coarsest(mRes, [&](bool residual) {
+                return relax_positions(mRes, level, with_scale, residual);
+            });
+        } else {
+            mRes.mPositionStats[level] = smooth_level(mRes, [&](bool residual) {
+                return relax_positions(mRes, level, with_scale, residual);
+            });
         }
         if (level > 0) {
             const MatrixXd& srcField = mRes.mO[level];
@@ -356,10 +679,7 @@ void Optimizer::optimize_positions(Hierarchy& mRes, int with_scale) {
             MatrixXd& destField = mRes.mO[level - 1];
             const MatrixXd& N = mRes.mN[level - 1];
             const MatrixXd& V = mRes.mV[level - 1];
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-            for (int i = 0; i < srcField.cols(); ++i) {
+            parallel_for(0, srcField.cols(), [&](int i) {
                 for (int k = 0; k < 2; ++k) {
                     int dest = toUpper(k, i);
                     if (dest == -1) continue;
@@ -367,39 +687,138 @@ void Optimizer::optimize_positions(Hierarchy& mRes, int with_scale) {
                     o -= n * n.dot(o - v);
                     destField.col(dest) = o;
                 }
-            }
+            });
         }
     }
+    report_levels("position", mRes, mRes.mPositionStats);
 #endif
 }
 
+// Least squares over the two tangent coordinates of each vertex: link (i, j) adds the 4x4 block
+// w w^T with w = {qx_j, qy_j, -qx_i, -qy_i} and target t, rows in |fixed_dim| keep their value and
+// rows without links get a unit diagonal. The pattern only depends on the links, so the assembly
+// and the multigrid hierarchy are shared by every system over the same links.
+struct PositionSystem {
+    std::vector<Vector2i> links;
+    std::vector<int> linked;
+    SparseAssembly assembly;
+    AMGPreconditioner preconditioner;
+    SparseAssembly::Matrix A;
+    VectorXd rhs;
+
+    void analyze(int num) {
+        int num_slots = links.size() * 16 + num * 2;
+        std::vector<int> slot_rows(num_slots), slot_cols(num_slots);
+        linked.assign(num * 2, 0);
+        parallel_for(0, links.size(), [&](int l) {
+            int i = links[l][0], j = links[l][1];
+            int vid[] = {j * 2, j * 2 + 1, i * 2, i * 2 + 1};
+            for (int ii = 0; ii < 4; ++ii) {
+                linked[vid[ii]] = 1;
+                for (int jj = 0; jj < 4; ++jj) {
+                    slot_rows[l * 16 + ii * 4 + jj] = vid[ii];
+                    slot_cols[l * 16 + ii * 4 + jj] = vid[jj];
+                }
+            }
+        });
+        for (int i = 0; i < num * 2; ++i) {
+            slot_rows[links.size() * 16 + i] = i;
+            slot_cols[links.size() * 16 + i] = i;
+        }
+        assembly.analyze(num * 2, num * 2, slot_rows, slot_cols);
+    }
+
+    // |weights| holds four vectors per link, |x| the current values
+    void assemble(const std::vector<Vector3d>& weights, const std::vector<Vector3d>& targets,
+                  const std::vector<int>& fixed_dim, const std::vector<double>& x) {
+        int num_links = links.size();
+        std::vector<double> values(assembly.num_slots());
+        std::vector<double> link_rhs(num_links * 4);
+        parallel_for(0, num_links, [&](int l) {
+            int i = links[l][0], j = links[l][1];
+            int vid[] = {j * 2, j * 2 + 1, i * 2, i * 2 + 1};
+            const Vector3d* w = &weights[l * 4];
+            for (int ii = 0; ii < 4; ++ii) {
+                double b = w[ii].dot(targets[l]);
+                for (int jj = 0; jj < 4; ++jj) {
+                    double& value = values[l * 16 + ii * 4 + jj];
+                    value = w[ii].dot(w[jj]);
+                    // fixed columns move to the right hand side
+                    if (!fixed_dim[vid[ii]] && fixed_dim[vid[jj]]) b -= value * x[vid[jj]];
+                    if (fixed_dim[vid[ii]] || fixed_dim[vid[jj]]) value = 0;
+                }
+                link_rhs[l * 4 + ii] = b;
+            }
+        });
+        rhs = VectorXd::Zero(x.size());
+        for (int l = 0; l < num_links; ++l) {
+            int i = links[l][0], j = links[l][1];
+            int vid[] = {j * 2, j * 2 + 1, i * 2, i * 2 + 1};
+            for (int ii = 0; ii < 4; ++ii) rhs[vid[ii]] += link_rhs[l * 4 + ii];
+        }
+        parallel_for(0, x.size(), [&](int i) {
+            bool identity = fixed_dim[i] || !linked[i];
+            values[num_links * 16 + i] = identity ? 1 : 0;
+            if (identity) rhs[i] = x[i];
+        });
+        assembly.assemble(values, A);
+    }
+
+    // Multigrid-preconditioned CG from |x|, with the direct solver as a fallback
+    void solve(VectorXd& x) {
+#ifdef LOG_OUTPUT
+        int t1 = GetCurrentTime64();
+#endif
+        if (preconditioner.ready(A))
+            preconditioner.refresh(A);
+        else
+            preconditioner.setup(A);
+        double error = 0;
+        int max_iterations = 1000;
+        int iterations =
+            conjugate_gradient(A, rhs, x, preconditioner, 1e-8, max_iterations, error);
+        if (iterations == max_iterations || !(error < 1e-8)) {
+            Eigen::SparseMatrix<double> B = A;
+            LinearSolver<Eigen::SparseMatrix<double>> direct;
+            direct.compute(B);
+            x = direct.solve(rhs);
+        }
+#ifdef LOG_OUTPUT
+        int t2 = GetCurrentTime64();
+        printf("[LSQ] CG: %d iterations, error %.3e, %d levels, %lf seconds.\n", iterations,
+               error, preconditioner.num_levels(), (t2 - t1) * 1e-3);
+#endif
+    }
+};
+
 void Optimizer::optimize_positions_dynamic(
     MatrixXi& F, MatrixXd& V, MatrixXd& N, MatrixXd& Q, std::vector<std::vector<int>>& Vset,
     std::vector<Vector3d>& O_compact, std::vector<Vector4i>& F_compact,
     std::vector<int>& V2E_compact, std::vector<int>& E2E_compact, double mScale,
     std::vector<Vector3d>& diffs, std::vector<int>& diff_count,
-    std::map<std::pair<int, int>, int>& o2e, std::vector<int>& sharp_o,
+    const EdgeHashMap& o2e, std::vector<int>& sharp_o,
     std::map<int, std::pair<Vector3d, Vector3d>>& compact_sharp_constraints, int with_scale) {
+    // directed edges without a target, counting only the edge |o2e| keeps for a vertex pair
+    auto unobserved_edge = [&](int e) {
+        return diff_count[e] == 0 &&
+               o2e.find(F_compact[e / 4][e % 4], F_compact[e / 4][(e + 1) % 4]) == e;
+    };
     std::set<int> uncertain;
-    for (auto& info : o2e) {
-        if (diff_count[info.second] == 0) {
-            uncertain.insert(info.first.first);
-            uncertain.insert(info.first.second);
+    for (int e = 0; e < F_compact.size() * 4; ++e) {
+        if (unobserved_edge(e)) {
+            uncertain.insert(F_compact[e / 4][e % 4]);
+            uncertain.insert(F_compact[e / 4][(e + 1) % 4]);
         }
     }
     std::vector<int> Vind(O_compact.size(), -1);
     std::vector<std::list<int>> links(O_compact.size());
     std::vector<std::list<int>> dedges(O_compact.size());
-    std::vector<std::vector<int>> adj(V.cols());
-    for (int i = 0; i < F.cols(); ++i) {
-        for (int j = 0; j < 3; ++j) {
-            int v1 = F(j, i);
-            int v2 = F((j + 1) % 3, i);
-            adj[v1].push_back(v2);
-        }
-    }
+    // the compact vertices live in the tangent planes at their closest points on the input
+    TriangleBVH bvh;
+    bvh.build(F, V);
+    std::vector<Vector3d> surface(O_compact.size());
     auto FindNearest = [&]() {
-        for (int i = 0; i < O_compact.size(); ++i) {
+        parallel_for(0, O_compact.size(), [&](int i) {
             if (Vind[i] == -1) {
                 double min_dis = 1e30;
                 int min_ind = -1;
@@ -412,41 +831,43 @@ void Optimizer::optimize_positions_dynamic(
                 }
                 if (min_ind > -1) {
                     Vind[i] = min_ind;
+                    surface[i] = V.col(min_ind);
                     double x = (O_compact[i] - V.col(min_ind)).dot(N.col(min_ind));
                     O_compact[i] -= x * N.col(min_ind);
                 }
             } else {
                 int current_v = Vind[i];
                 Vector3d n = N.col(current_v);
-                double current_dis = (O_compact[i] - V.col(current_v)).squaredNorm();
-                while (true) {
-                    int next_v = -1;
-                    for (auto& v : adj[current_v]) {
-                        if (N.col(v).dot(n) < cos(10.0 / 180.0 * 3.141592654)) continue;
-                        double dis = (O_compact[i] - V.col(v)).squaredNorm();
-                        if (dis < current_dis) {
-                            current_dis = dis;
-                            next_v = v;
-                        }
-                    }
-                    if (next_v == -1) break;
-                    // rotate ideal distance
-                    Vector3d n1 = N.col(current_v);
-                    Vector3d n2 = N.col(next_v);
-                    Vector3d axis = n1.cross(n2);
-                    double len = axis.norm();
-                    double angle = atan2(len, n1.dot(n2));
-                    axis.normalized();
-                    Matrix3d m = AngleAxisd(angle, axis).toRotationMatrix();
-                    for (auto e : dedges[i]) {
-                        Vector3d& d = diffs[e];
-                        d = m * d;
-                    }
-                    current_v = next_v;
+                surface[i] = V.col(current_v);
+                // only move over the surface that stays within 10 degrees of the current normal
+                double min_cos = cos(10.0 / 180.0 * 3.141592654);
+                Vector3d closest;
+                auto similar = [&](int f) { return bvh.face_normal(f).dot(n) >= min_cos; };
+                int f = bvh.closest_point(O_compact[i], similar, closest,
+                                          (surface[i] - O_compact[i]).squaredNorm());
+                if (f == -1) return;
+                surface[i] = closest;
+                int next_v = F(0, f);
+                for (int k = 1; k < 3; ++k) {
+                    if ((V.col(F(k, f)) - closest).squaredNorm() <
+                        (V.col(next_v) - closest).squaredNorm())
+                        next_v = F(k, f);
+                }
+                if (next_v == current_v) return;
+                // rotate ideal distance
+                Vector3d n2 = N.col(next_v);
+                Vector3d axis = n.cross(n2);
+                double len = axis.norm();
+                double angle = atan2(len, n.dot(n2));
+                axis.normalize();
+                Matrix3d m = AngleAxisd(angle, axis).toRotationMatrix();
+                for (auto e : dedges[i]) {
+                    Vector3d& d = diffs[e];
+                    d = m * d;
                 }
-                Vind[i] = current_v;
+                Vind[i] = next_v;
             }
-        }
+        });
     };
 
     auto BuildConnection = [&]() {
@@ -478,10 +899,8 @@ void Optimizer::optimize_positions_dynamic(
     std::vector<Vector3d> lines;
     auto ComputeDistance = [&]() {
         std::set<int> unobserved;
-        for (auto& info : o2e) {
-            if (diff_count[info.second] == 0) {
-                unobserved.insert(info.first.first);
-            }
+        for (int e = 0; e < F_compact.size() * 4; ++e) {
+            if (unobserved_edge(e)) unobserved.insert(F_compact[e / 4][e % 4]);
         }
         while (true) {
             bool update = false;
@@ -559,34 +978,40 @@ void Optimizer::optimize_positions_dynamic(
     };
 
     BuildConnection();
+    // the links stay the same over the iterations, only the frames and targets move
+    PositionSystem system;
+    std::vector<int> link_dedges;
+    for (int i = 0; i < links.size(); ++i) {
+        for (int j : links[i]) {
+            system.links.push_back(Vector2i(i, j));
+            link_dedges.push_back(o2e.find(i, j));
+        }
+    }
+    system.analyze(O_compact.size());
+    std::vector<Vector3d> weights(system.links.size() * 4), targets(system.links.size());
     int max_iter = 10;
     for (int iter = 0; iter < max_iter; ++iter) {
         FindNearest();
         ComputeDistance();
 
-        std::vector<std::unordered_map<int, double>> entries(O_compact.size() * 2);
         std::vector<int> fixed_dim(O_compact.size() * 2, 0);
         for (auto& info : compact_sharp_constraints) {
             fixed_dim[info.first * 2 + 1] = 1;
             if (info.second.second.norm() < 0.5) fixed_dim[info.first * 2] = 1;
         }
-        std::vector<double> b(O_compact.size() * 2);
         std::vector<double> x(O_compact.size() * 2);
         std::vector<Vector3d> Q_compact(O_compact.size());
         std::vector<Vector3d> N_compact(O_compact.size());
         std::vector<Vector3d> V_compact(O_compact.size());
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-        for (int i = 0; i < O_compact.size(); ++i) {
+        parallel_for(0, O_compact.size(), [&](int i) {
             Q_compact[i] = Q.col(Vind[i]);
             N_compact[i] = N.col(Vind[i]);
-            V_compact[i] = V.col(Vind[i]);
+            V_compact[i] = surface[i];
             if (fixed_dim[i * 2 + 1] && !fixed_dim[i * 2]) {
                 Q_compact[i] = compact_sharp_constraints[i].second;
                 V_compact[i] = compact_sharp_constraints[i].first;
             }
-        }
+        });
         for (int i = 0; i < O_compact.size(); ++i) {
             Vector3d q = Q_compact[i];
             Vector3d n = N_compact[i];
@@ -595,106 +1020,18 @@ void Optimizer::optimize_positions_dynamic(
             x[i * 2] = (O_compact[i] - Vi).dot(q);
             x[i * 2 + 1] = (O_compact[i] - Vi).dot(q_y);
         }
-        for (int i = 0; i < O_compact.size(); ++i) {
-            Vector3d qx = Q_compact[i];
-            Vector3d qy = N_compact[i];
-            qy = qy.cross(qx);
-            auto dedge_it = dedges[i].begin();
-            for (auto it = links[i].begin(); it != links[i].end(); ++it, ++dedge_it) {
-                int j = *it;
-                Vector3d qx2 = Q_compact[j];
-                Vector3d qy2 = N_compact[j];
-                qy2 = qy2.cross(qx2);
-
-                int de = o2e[std::make_pair(i, j)];
-                double lambda = (diff_count[de] == 1) ? 1 : 1;
-                Vector3d target_offset = diffs[de];
-
-                auto Vi = V_compact[i];
-                auto Vj = V_compact[j];
-
-                Vector3d offset = Vj - Vi;
-
-                //                target_offset.normalize();
-                //                target_offset *= mScale;
-                Vector3d C = target_offset - offset;
-                int vid[] = {j * 2, j * 2 + 1, i * 2, i * 2 + 1};
-                Vector3d weights[] = {qx2, qy2, -qx, -qy};
-                for (int ii = 0; ii < 4; ++ii) {
-                    for (int jj = 0; jj < 4; ++jj) {
-                        auto it = entries[vid[ii]].find(vid[jj]);
-                        if (it == entries[vid[ii]].end()) {
-                            entries[vid[ii]][vid[jj]] = lambda * weights[ii].dot(weights[jj]);
-                        } else {
-                            entries[vid[ii]][vid[jj]] += lambda * weights[ii].dot(weights[jj]);
-                        }
-                    }
-                    b[vid[ii]] += lambda * weights[ii].dot(C);
-                }
-            }
-        }
-
-        // fix sharp edges
-        for (int i = 0; i < entries.size(); ++i) {
-            if (entries[i].size() == 0) {
-                entries[i][i] = 1;
-                b[i] = x[i];
-            }
-            if (fixed_dim[i]) {
-                b[i] = x[i];
-                entries[i].clear();
-                entries[i][i] = 1;
-            } else {
-                std::unordered_map<int, double> newmap;
-                for (auto& rec : entries[i]) {
-                    if (fixed_dim[rec.first]) {
-                        b[i] -= rec.second * x[rec.first];
-                    } else {
-                        newmap[rec.first] = rec.second;
-                    }
-                }
-                std::swap(entries[i], newmap);
-            }
-        }
-        std::vector<Eigen::Triplet<double>> lhsTriplets;
-        lhsTriplets.reserve(F_compact.size() * 8);
-        Eigen::SparseMatrix<double> A(O_compact.size() * 2, O_compact.size() * 2);
-        VectorXd rhs(O_compact.size() * 2);
-        rhs.setZero();
-        for (int i = 0; i < entries.size(); ++i) {
-            rhs(i) = b[i];
-            for (auto& rec : entries[i]) {
-                lhsTriplets.push_back(Eigen::Triplet<double>(i, rec.first, rec.second));
-            }
-        }
-
-        A.setFromTriplets(lhsTriplets.begin(), lhsTriplets.end());
-
-#ifdef LOG_OUTPUT
-        int t1 = GetCurrentTime64();
-#endif
-
-        // FIXME: IncompleteCholesky Preconditioner will fail here so I fallback to Diagonal one.
-        // I suspected either there is a implementation bug in IncompleteCholesky Preconditioner
-        // or there is a memory corruption somewhere.  However, g++'s address sanitizer does not
-        // report anything useful.
-        LinearSolver<Eigen::SparseMatrix<double>> solver;
-        solver.analyzePattern(A);
-        solver.factorize(A);
-        //        Eigen::setNbThreads(1);
-        //        ConjugateGradient<SparseMatrix<double>, Lower | Upper> solver;
-        //        VectorXd x0 = VectorXd::Map(x.data(), x.size());
-        //        solver.setMaxIterations(40);
-
-        //        solver.compute(A);
-        VectorXd x_new = solver.solve(rhs);  // solver.solveWithGuess(rhs, x0);
+        parallel_for(0, system.links.size(), [&](int l) {
+            int i = system.links[l][0], j = system.links[l][1];
+            weights[l * 4] = Q_compact[j];
+            weights[l * 4 + 1] = N_compact[j].cross(Q_compact[j]);
+            weights[l * 4 + 2] = -Q_compact[i];
+            weights[l * 4 + 3] = -N_compact[i].cross(Q_compact[i]);
+            targets[l] = diffs[link_dedges[l]] - (V_compact[j] - V_compact[i]);
+        });
+        system.assemble(weights, targets, fixed_dim, x);
+        VectorXd x_new = VectorXd::Map(x.data(), x.size());
+        system.solve(x_new);
 
-#ifdef LOG_OUTPUT
-        // std::cout << "[LSQ] n_iteration:" << solver.iterations() << std::endl;
-        // std::cout << "[LSQ] estimated error:" << solver.error() << std::endl;
-        int t2 = GetCurrentTime64();
-        printf("[LSQ] Linear solver uses %lf seconds.\n", (t2 - t1) * 1e-3);
-#endif
         for (int i = 0; i < O_compact.size(); ++i) {
             // Vector3d q = Q.col(Vind[i]);
             Vector3d q = Q_compact[i];
@@ -730,10 +1067,10 @@ void Optimizer::optimize_positions_dynamic(
     }
 }
 
-void Optimizer::optimize_positions_sharp(
-    Hierarchy& mRes, std::vector<DEdge>& edge_values, std::vector<Vector2i>& edge_diff,
-    std::vector<int>& sharp_edges, std::set<int>& sharp_vertices,
-    std::map<int, std::pair<Vector3d, Vector3d>>& sharp_constraints, int with_scale) {
+void Optimizer::optimize_positions_sharp(Hierarchy& mRes, std::vector<DEdge>& edge_values,
+                                         DiffArray& edge_diff, BitArray& sharp_edges,
+                                         BitArray& sharp_vertices,
+                                         SharpConstraints& sharp_constraints, int with_scale) {
     auto& V = mRes.mV[0];
     auto& F = mRes.mF;
     auto& Q = mRes.mQ[0];
@@ -742,246 +1079,265 @@ void Optimizer::optimize_positions_sharp(
     auto& S = mRes.mS[0];
 
     DisajointTree tree(V.cols());
-    for (int i = 0; i < edge_diff.size(); ++i) {
-        if (edge_diff[i].array().abs().sum() == 0) {
-            tree.Merge(edge_values[i].x, edge_values[i].y);
-        }
-    }
-    tree.BuildCompactParent();
-    std::map<int, int> compact_sharp_indices;
-    std::set<DEdge> compact_sharp_edges;
-    for (int i = 0; i < sharp_edges.size(); ++i) {
-        if (sharp_edges[i] == 1) {
-            int v1 = tree.Index(F(i % 3, i / 3));
-            int v2 = tree.Index(F((i + 1) % 3, i / 3));
-            compact_sharp_edges.insert(DEdge(v1, v2));
-        }
-    }
-    for (auto& v : sharp_vertices) {
+    tree.BuildCompactParallel(edge_diff.size(), [&](int i, int& x, int& y) {
+        x = edge_values[i].x;
+        y = edge_values[i].y;
+        return edge_diff[i].array().abs().sum() == 0;
+    });
+    sharp_constraints.resize(V.cols());
+
+    int num_sharp_edges =
+        parallel_sum(0, sharp_edges.size(), [&](int i) { return sharp_edges[i]; });
+    EdgeHashMap compact_sharp_edges;
+    compact_sharp_edges.reserve(num_sharp_edges);
+    parallel_for(0, sharp_edges.size(), [&](int i) {
+        if (!sharp_edges[i]) return;
+        DEdge e(tree.Index(F(i % 3, i / 3)), tree.Index(F((i + 1) % 3, i / 3)));
+        compact_sharp_edges.insert_max(e.x, e.y, 0);
+    });
+    // sharp compact vertices in the order of their first sharp vertex
+    std::vector<int> compact_sharp_indices(tree.CompactNum(), -1);
+    int num = 0;
+    for (int v = 0; v < V.cols(); ++v) {
         int p = tree.Index(v);
-        if (compact_sharp_indices.count(p) == 0) {
-            int s = compact_sharp_indices.size();
-            compact_sharp_indices[p] = s;
-        }
+        if (sharp_vertices[v] && compact_sharp_indices[p] == -1) compact_sharp_indices[p] = num++;
     }
-    std::map<int, std::set<int>> sharp_vertices_links;
-    std::set<DEdge> sharp_dedges;
+
+    // number of distinct vertices each vertex is linked to by sharp edges
+    std::vector<std::pair<int, int>> sharp_links;
+    sharp_links.reserve(num_sharp_edges);
     for (int i = 0; i < sharp_edges.size(); ++i) {
-        if (sharp_edges[i]) {
-            int v1 = F(i % 3, i / 3);
-            int v2 = F((i + 1) % 3, i / 3);
-            if (sharp_vertices_links.count(v1) == 0) sharp_vertices_links[v1] = std::set<int>();
-            sharp_vertices_links[v1].insert(v2);
-            sharp_dedges.insert(DEdge(v1, v2));
-        }
+        if (sharp_edges[i])
+            sharp_links.push_back(std::make_pair(F(i % 3, i / 3), F((i + 1) % 3, i / 3)));
     }
-    std::vector<std::vector<int>> sharp_to_original_indices(compact_sharp_indices.size());
-    for (auto& v : sharp_vertices_links) {
-        if (v.second.size() == 2) continue;
-        int p = tree.Index(v.first);
-        sharp_to_original_indices[compact_sharp_indices[p]].push_back(v.first);
+    parallel_stable_sort(sharp_links, std::less<std::pair<int, int>>());
+    sharp_links.erase(std::unique(sharp_links.begin(), sharp_links.end()), sharp_links.end());
+    std::vector<int> sharp_degree(V.cols(), 0);
+    for (auto& link : sharp_links) sharp_degree[link.first] += 1;
+
+    std::vector<std::vector<int>> sharp_to_original_indices(num);
+    for (int v = 0; v < V.cols(); ++v) {
+        if (sharp_degree[v] == 0 || sharp_degree[v] == 2) continue;
+        sharp_to_original_indices[compact_sharp_indices[tree.Index(v)]].push_back(v);
     }
-    for (auto& v : sharp_vertices_links) {
-        if (v.second.size() != 2) continue;
-        int p = tree.Index(v.first);
-        sharp_to_original_indices[compact_sharp_indices[p]].push_back(v.first);
+    for (int v = 0; v < V.cols(); ++v) {
+        if (sharp_degree[v] != 2) continue;
+        sharp_to_original_indices[compact_sharp_indices[tree.Index(v)]].push_back(v);
     }
-
-    for (int i = 0; i < V.cols(); ++i) {
-        if (sharp_vertices.count(i)) continue;
-        int p = tree.Index(i);
-        if (compact_sharp_indices.count(p))
-            sharp_to_original_indices[compact_sharp_indices[p]].push_back(i);
+    for (int v = 0; v < V.cols(); ++v) {
+        if (sharp_vertices[v]) continue;
+        int p = tree.Index(v);
+        if (compact_sharp_indices[p] != -1)
+            sharp_to_original_indices[compact_sharp_indices[p]].push_back(v);
     }
 
-    int num = sharp_to_original_indices.size();
-    std::vector<std::set<int>> links(sharp_to_original_indices.size());
+    // links between the sharp compact vertices as sorted adjacency arrays
+    std::vector<char> is_link(edge_diff.size());
+    parallel_for(0, edge_diff.size(), [&](int e) {
+        int p1 = tree.Index(edge_values[e].x);
+        int p2 = tree.Index(edge_values[e].y);
+        is_link[e] = p1 != p2 && compact_sharp_edges.count(std::min(p1, p2), std::max(p1, p2));
+    });
+    std::vector<std::pair<int, int>> compact_links;
     for (int e = 0; e < edge_diff.size(); ++e) {
-        int v1 = edge_values[e].x;
-        int v2 = edge_values[e].y;
-        int p1 = tree.Index(v1);
-        int p2 = tree.Index(v2);
-        if (p1 == p2 || compact_sharp_edges.count(DEdge(p1, p2)) == 0) continue;
-        p1 = compact_sharp_indices[p1];
-        p2 = compact_sharp_indices[p2];
-
-        links[p1].insert(p2);
-        links[p2].insert(p1);
+        if (!is_link[e]) continue;
+        int p1 = compact_sharp_indices[tree.Index(edge_values[e].x)];
+        int p2 = compact_sharp_indices[tree.Index(edge_values[e].y)];
+        compact_links.push_back(std::make_pair(p1, p2));
+        compact_links.push_back(std::make_pair(p2, p1));
     }
+    parallel_stable_sort(compact_links, std::less<std::pair<int, int>>());
+    compact_links.erase(std::unique(compact_links.begin(), compact_links.end()),
+                        compact_links.end());
+    std::vector<int> link_offsets(num + 1, 0);
+    for (auto& link : compact_links) link_offsets[link.first + 1] += 1;
+    for (int i = 0; i < num; ++i) link_offsets[i + 1] += link_offsets[i];
+    auto degree = [&](int v) { return link_offsets[v + 1] - link_offsets[v]; };
+    // the neighbor of a vertex with two links that is not prev_v, the larger one if both are not
+    auto next_link = [&](int v, int prev_v) {
+        int next_v = -1;
+        for (int k = link_offsets[v]; k < link_offsets[v + 1]; ++k)
+            if (compact_links[k].second != prev_v) next_v = compact_links[k].second;
+        return next_v;
+    };
 
-    std::vector<int> hash(links.size(), 0);
-    std::vector<std::vector<Vector3d>> loops;
+    // A chain is a connected run of vertices with two links. It starts at its smallest vertex and
+    // owns its vertices, so the chains are resampled concurrently. Only the vertices with three
+    // or more links are shared between chains; they are fixed after all chains are done.
+    DisajointTree chain_tree(num);
+    chain_tree.BuildCompactParallel(compact_links.size(), [&](int i, int& x, int& y) {
+        x = compact_links[i].first;
+        y = compact_links[i].second;
+        return degree(x) == 2 && degree(y) == 2;
+    });
+    std::vector<int> chain_starts;
     for (int i = 0; i < num; ++i) {
-        if (hash[i] == 1) continue;
-        if (links[i].size() == 2) {
-            std::vector<int> q;
-            q.push_back(i);
-            hash[i] = 1;
+        if (degree(i) == 2 && chain_tree.parent[i] == i) chain_starts.push_back(i);
+    }
+    std::vector<int> hash(num, 0);
+    std::vector<std::vector<int>> chains(chain_starts.size());
+    parallel_for(0, chain_starts.size(), [&](int c) {
+        int i = chain_starts[c];
+        std::vector<int> q;
+        q.push_back(i);
+        hash[i] = 1;
+        int v = i;
+        int prev_v = -1;
+        bool is_loop = false;
+        while (degree(v) == 2) {
+            int next_v = next_link(v, prev_v);
+            if (hash[next_v]) {
+                is_loop = true;
+                break;
+            }
+            if (degree(next_v) == 2) hash[next_v] = true;
+            q.push_back(next_v);
+            prev_v = v;
+            v = next_v;
+        }
+        if (!is_loop && q.size() >= 2) {
+            std::vector<int> q1;
             int v = i;
-            int prev_v = -1;
-            bool is_loop = false;
-            while (links[v].size() == 2) {
-                int next_v = -1;
-                for (auto nv : links[v])
-                    if (nv != prev_v) next_v = nv;
+            int prev_v = q[1];
+            while (degree(v) == 2) {
+                int next_v = next_link(v, prev_v);
                 if (hash[next_v]) {
                     is_loop = true;
                     break;
                 }
-                if (links[next_v].size() == 2) hash[next_v] = true;
-                q.push_back(next_v);
+                if (degree(next_v) == 2) hash[next_v] = true;
+                q1.push_back(next_v);
                 prev_v = v;
                 v = next_v;
             }
-            if (!is_loop && q.size() >= 2) {
-                std::vector<int> q1;
-                int v = i;
-                int prev_v = q[1];
-                while (links[v].size() == 2) {
-                    int next_v = -1;
-                    for (auto nv : links[v])
-                        if (nv != prev_v) next_v = nv;
-                    if (hash[next_v]) {
-                        is_loop = true;
-                        break;
-                    }
-                    if (links[next_v].size() == 2) hash[next_v] = true;
-                    q1.push_back(next_v);
-                    prev_v = v;
-                    v = next_v;
-                }
-                std::reverse(q1.begin(), q1.end());
-                q1.insert(q1.end(), q.begin(), q.end());
-                std::swap(q1, q);
+            std::reverse(q1.begin(), q1.end());
+            q1.insert(q1.end(), q.begin(), q.end());
+            std::swap(q1, q);
+        }
+        if (q.size() < 3) return;
+        if (is_loop) q.push_back(q.front());
+        double len = 0, scale = 0;
+        std::vector<Vector3d> o(q.size()), new_o(q.size());
+        std::vector<double> sc(q.size());
+
+        for (int i = 0; i < q.size() - 1; ++i) {
+            int v1 = q[i];
+            int v2 = q[i + 1];
+            if (!std::binary_search(compact_links.begin() + link_offsets[v1],
+                                    compact_links.begin() + link_offsets[v1 + 1],
+                                    std::make_pair(v1, v2))) {
+                printf("Non exist!\n");
+                exit(0);
             }
-            if (q.size() < 3) continue;
-            if (is_loop) q.push_back(q.front());
-            double len = 0, scale = 0;
-            std::vector<Vector3d> o(q.size()), new_o(q.size());
-            std::vector<double> sc(q.size());
-
-            for (int i = 0; i < q.size() - 1; ++i) {
-                int v1 = q[i];
-                int v2 = q[i + 1];
-                auto it = links[v1].find(v2);
-                if (it == links[v1].end()) {
-                    printf("Non exist!\n");
-                    exit(0);
-                }
+        }
+
+        for (int i = 0; i < q.size(); ++i) {
+            if (sharp_to_original_indices[q[i]].size() == 0) {
+                continue;
             }
+            o[i] = O.col(sharp_to_original_indices[q[i]][0]);
+            Vector3d qx = Q.col(sharp_to_original_indices[q[i]][0]);
+            Vector3d qy = Vector3d(N.col(sharp_to_original_indices[q[i]][0])).cross(qx);
+            int fst = sharp_to_original_indices[q[1]][0];
+            Vector3d dis = (i == 0) ? (Vector3d(O.col(fst)) - o[i]) : o[i] - o[i - 1];
+            if (with_scale)
+                sc[i] = (abs(qx.dot(dis)) > abs(qy.dot(dis)))
+                            ? S(0, sharp_to_original_indices[q[i]][0])
+                            : S(1, sharp_to_original_indices[q[i]][0]);
+            else
+                sc[i] = 1;
+            new_o[i] = o[i];
+        }
 
+        if (is_loop) {
             for (int i = 0; i < q.size(); ++i) {
-                if (sharp_to_original_indices[q[i]].size() == 0) {
-                  continue;
+                Vector3d dir =
+                    (o[(i + 1) % q.size()] - o[(i + q.size() - 1) % q.size()]).normalized();
+                for (auto& ind : sharp_to_original_indices[q[i]]) {
+                    sharp_constraints.set(ind, o[i], dir);
                 }
-                o[i] = O.col(sharp_to_original_indices[q[i]][0]);
-                Vector3d qx = Q.col(sharp_to_original_indices[q[i]][0]);
-                Vector3d qy = Vector3d(N.col(sharp_to_original_indices[q[i]][0])).cross(qx);
-                int fst = sharp_to_original_indices[q[1]][0];
-                Vector3d dis = (i == 0) ? (Vector3d(O.col(fst)) - o[i]) : o[i] - o[i - 1];
-                if (with_scale)
-                    sc[i] = (abs(qx.dot(dis)) > abs(qy.dot(dis)))
-                                ? S(0, sharp_to_original_indices[q[i]][0])
-                                : S(1, sharp_to_original_indices[q[i]][0]);
-                else
-                    sc[i] = 1;
-                new_o[i] = o[i];
             }
-
-            if (is_loop) {
-                for (int i = 0; i < q.size(); ++i) {
-                    Vector3d dir =
-                        (o[(i + 1) % q.size()] - o[(i + q.size() - 1) % q.size()]).normalized();
-                    for (auto& ind : sharp_to_original_indices[q[i]]) {
-                        sharp_constraints[ind] = std::make_pair(o[i], dir);
-                    }
+        } else {
+            for (int i = 0; i < q.size(); ++i) {
+                if (degree(q[i]) > 2) continue;
+                Vector3d dir(0, 0, 0);
+                if (i != 0 && i + 1 != q.size())
+                    dir = (o[i + 1] - o[i - 1]).normalized();
+                else if (degree(q[i]) == 1) {
+                    if (i == 0)
+                        dir = (o[i + 1] - o[i]).normalized();
+                    else
+                        dir = (o[i] - o[i - 1]).normalized();
                 }
-            } else {
-                for (int i = 0; i < q.size(); ++i) {
-                    Vector3d dir(0, 0, 0);
-                    if (i != 0 && i + 1 != q.size())
-                        dir = (o[i + 1] - o[i - 1]).normalized();
-                    else if (links[q[i]].size() == 1) {
-                        if (i == 0)
-                            dir = (o[i + 1] - o[i]).normalized();
-                        else
-                            dir = (o[i] - o[i - 1]).normalized();
-                    }
-                    for (auto& ind : sharp_to_original_indices[q[i]]) {
-                        sharp_constraints[ind] = std::make_pair(o[i], dir);
-                    }
+                for (auto& ind : sharp_to_original_indices[q[i]]) {
+                    sharp_constraints.set(ind, o[i], dir);
                 }
             }
+        }
 
-            for (int i = 0; i < q.size() - 1; ++i) {
-                len += (o[i + 1] - o[i]).norm();
-                scale += sc[i];
-            }
+        for (int i = 0; i < q.size() - 1; ++i) {
+            len += (o[i + 1] - o[i]).norm();
+            scale += sc[i];
+        }
 
-            int next_m = q.size() - 1;
+        int next_m = q.size() - 1;
 
-            double left_norm = len * sc[0] / scale;
-            int current_v = 0;
-            double current_norm = (o[1] - o[0]).norm();
-            for (int i = 1; i < next_m; ++i) {
-                while (left_norm >= current_norm) {
-                    left_norm -= current_norm;
-                    current_v += 1;
-                    current_norm = (o[current_v + 1] - o[current_v]).norm();
-                }
-                new_o[i] =
-                    (o[current_v + 1] * left_norm + o[current_v] * (current_norm - left_norm)) /
-                    current_norm;
-                o[current_v] = new_o[i];
-                current_norm -= left_norm;
-                left_norm = len * sc[current_v] / scale;
+        double left_norm = len * sc[0] / scale;
+        int current_v = 0;
+        double current_norm = (o[1] - o[0]).norm();
+        for (int i = 1; i < next_m; ++i) {
+            while (left_norm >= current_norm) {
+                left_norm -= current_norm;
+                current_v += 1;
+                current_norm = (o[current_v + 1] - o[current_v]).norm();
             }
+            new_o[i] =
+                (o[current_v + 1] * left_norm + o[current_v] * (current_norm - left_norm)) /
+                current_norm;
+            o[current_v] = new_o[i];
+            current_norm -= left_norm;
+            left_norm = len * sc[current_v] / scale;
+        }
 
-            for (int i = 0; i < q.size(); ++i) {
-                for (auto v : sharp_to_original_indices[q[i]]) {
-                    O.col(v) = new_o[i];
-                }
+        for (int i = 0; i < q.size(); ++i) {
+            if (degree(q[i]) > 2) continue;
+            for (auto v : sharp_to_original_indices[q[i]]) {
+                O.col(v) = new_o[i];
             }
-
-            loops.push_back(new_o);
         }
-    }
-    return;
-    std::ofstream os("/Users/jingwei/Desktop/sharp.obj");
-    for (int i = 0; i < loops.size(); ++i) {
-        for (auto& v : loops[i]) {
-            os << "v " << v[0] << " " << v[1] << " " << v[2] << "\n";
-        }
-    }
-    int offset = 1;
-    for (int i = 0; i < loops.size(); ++i) {
-        for (int j = 0; j < loops[i].size() - 1; ++j) {
-            os << "l " << offset + j << " " << offset + j + 1 << "\n";
+        chains[c].swap(q);
+    });
+
+    // the shared ends keep the position of their first vertex and have no direction
+    for (auto& q : chains) {
+        if (q.empty()) continue;
+        for (int p : {q.front(), q.back()}) {
+            if (degree(p) <= 2 || sharp_to_original_indices[p].empty()) continue;
+            Vector3d o = O.col(sharp_to_original_indices[p][0]);
+            for (auto v : sharp_to_original_indices[p]) {
+                sharp_constraints.set(v, o, Vector3d(0, 0, 0));
+                O.col(v) = o;
+            }
         }
-        offset += loops[i].size();
     }
-    os.close();
-    exit(0);
 }
 
 void Optimizer::optimize_positions_fixed(
-    Hierarchy& mRes, std::vector<DEdge>& edge_values, std::vector<Vector2i>& edge_diff,
-    std::set<int>& sharp_vertices, std::map<int, std::pair<Vector3d, Vector3d>>& sharp_constraints,
+    Hierarchy& mRes, std::vector<DEdge>& edge_values, DiffArray& edge_diff,
+    const EdgeRanks& edge_ranks, BitArray& sharp_vertices, SharpConstraints& sharp_constraints,
     int with_scale) {
     auto& V = mRes.mV[0];
-    auto& F = mRes.mF;
     auto& Q = mRes.mQ[0];
     auto& N = mRes.mN[0];
     auto& O = mRes.mO[0];
     auto& S = mRes.mS[0];
 
     DisajointTree tree(V.cols());
-    for (int i = 0; i < edge_diff.size(); ++i) {
-        if (edge_diff[i].array().abs().sum() == 0) {
-            tree.Merge(edge_values[i].x, edge_values[i].y);
-        }
-    }
-    tree.BuildCompactParent();
+    tree.BuildCompactParallel(edge_diff.size(), [&](int i, int& x, int& y) {
+        x = edge_values[i].x;
+        y = edge_values[i].y;
+        return edge_diff[i].array().abs().sum() == 0;
+    });
     int num = tree.CompactNum();
 
     // Find the most descriptive vertex
@@ -1006,15 +1362,15 @@ void Optimizer::optimize_positions_fixed(
         }
     }
 
-    std::set<int> compact_sharp_vertices;
-    for (auto& v : sharp_vertices) {
+    for (int v = 0; v < V.cols(); ++v) {
+        if (!sharp_vertices[v]) continue;
         v_positions[tree.Index(v)] = O.col(v);
         v_index[tree.Index(v)] = v;
         V.col(v) = O.col(v);
-        compact_sharp_vertices.insert(tree.Index(v));
     }
-    std::vector<std::map<int, std::pair<int, Vector3d>>> ideal_distances(tree.CompactNum());
-    for (int e = 0; e < edge_diff.size(); ++e) {
+    // offsets of all edges, averaged per compact vertex pair after a stable sort by pair
+    std::vector<Vector3d> edge_offsets(edge_diff.size());
+    parallel_for(0, edge_diff.size(), [&](int e) {
         int v1 = edge_values[e].x;
         int v2 = edge_values[e].y;
 
@@ -1030,10 +1386,9 @@ void Optimizer::optimize_positions_fixed(
         Vector3d n_2 = N.col(v2);
         Vector3d q_1_y = n_1.cross(q_1);
         Vector3d q_2_y = n_2.cross(q_2);
-        auto index = compat_orientation_extrinsic_index_4(q_1, n_1, q_2, n_2);
         double s_x1 = S(0, v1), s_y1 = S(1, v1);
         double s_x2 = S(0, v2), s_y2 = S(1, v2);
-        int rank_diff = (index.second + 4 - index.first) % 4;
+        int rank_diff = edge_ranks[e];
         if (rank_diff % 2 == 1) std::swap(s_x2, s_y2);
         Vector3d qd_x = 0.5 * (rotate90_by(q_2, n_2, rank_diff) + q_1);
         Vector3d qd_y = 0.5 * (rotate90_by(q_2_y, n_2, rank_diff) + q_1_y);
@@ -1045,63 +1400,49 @@ void Optimizer::optimize_positions_fixed(
             /*(sharp_constraints.count(q1)) ? sharp_constraints[q1].first : */ V.col(q1);
         Vector3d origin2 =
             /*(sharp_constraints.count(q2)) ? sharp_constraints[q2].first : */ V.col(q2);
-        Vector3d C = diff[0] * scale_x * qd_x + diff[1] * scale_y * qd_y + origin1 - origin2;
-        auto it = ideal_distances[p1].find(p2);
-        if (it == ideal_distances[p1].end()) {
-            ideal_distances[p1][p2] = std::make_pair(1, C);
-        } else {
-            it->second.first += 1;
-            it->second.second += C;
-        }
-    }
-
-    std::vector<std::unordered_map<int, double>> entries(num * 2);
-    std::vector<double> b(num * 2);
-
-    for (int m = 0; m < num; ++m) {
-        int v1 = v_index[m];
-        for (auto& info : ideal_distances[m]) {
-            int v2 = v_index[info.first];
-            Vector3d q_1 = Q.col(v1);
-            Vector3d q_2 = Q.col(v2);
-            if (sharp_constraints.count(v1)) {
-                Vector3d d = sharp_constraints[v1].second;
-                if (d != Vector3d::Zero()) q_1 = d;
-            }
-            if (sharp_constraints.count(v2)) {
-                Vector3d d = sharp_constraints[v2].second;
-                if (d != Vector3d::Zero()) q_2 = d;
-            }
-
-            Vector3d n_1 = N.col(v1);
-            Vector3d n_2 = N.col(v2);
-            Vector3d q_1_y = n_1.cross(q_1);
-            Vector3d q_2_y = n_2.cross(q_2);
-            Vector3d weights[] = {q_2, q_2_y, -q_1, -q_1_y};
-            int vid[] = {info.first * 2, info.first * 2 + 1, m * 2, m * 2 + 1};
-            Vector3d dis = info.second.second / info.second.first;
-            double lambda = 1;
-            if (sharp_vertices.count(v1) && sharp_vertices.count(v2)) lambda = 1;
-            for (int i = 0; i < 4; ++i) {
-                for (int j = 0; j < 4; ++j) {
-                    auto it = entries[vid[i]].find(vid[j]);
-                    if (it == entries[vid[i]].end()) {
-                        entries[vid[i]][vid[j]] = weights[i].dot(weights[j]) * lambda;
-                    } else {
-                        entries[vid[i]][vid[j]] += weights[i].dot(weights[j]) * lambda;
-                    }
-                }
-                b[vid[i]] += weights[i].dot(dis) * lambda;
-            }
-        }
+        edge_offsets[e] =
+            diff[0] * scale_x * qd_x + diff[1] * scale_y * qd_y + origin1 - origin2;
+    });
+    std::vector<std::pair<Vector2i, int>> edge_links(edge_diff.size());
+    parallel_for(0, edge_diff.size(), [&](int e) {
+        edge_links[e] = std::make_pair(
+            Vector2i(tree.Index(edge_values[e].x), tree.Index(edge_values[e].y)), e);
+    });
+    parallel_stable_sort(edge_links, [](const std::pair<Vector2i, int>& a,
+                                        const std::pair<Vector2i, int>& b) {
+        return a.first[0] < b.first[0] || (a.first[0] == b.first[0] && a.first[1] < b.first[1]);
+    });
+
+    PositionSystem system;
+    std::vector<Vector3d> targets;
+    for (int i = 0, j; i < edge_links.size(); i = j) {
+        Vector3d C = edge_offsets[edge_links[i].second];
+        for (j = i + 1; j < edge_links.size() && edge_links[j].first == edge_links[i].first; ++j)
+            C += edge_offsets[edge_links[j].second];
+        system.links.push_back(edge_links[i].first);
+        targets.push_back(C / (j - i));
     }
+    auto sharp_direction = [&](int v, Vector3d& q) {
+        if (sharp_constraints.count(v) && sharp_constraints[v].second != Vector3d::Zero())
+            q = sharp_constraints[v].second;
+    };
+    std::vector<Vector3d> weights(system.links.size() * 4);
+    parallel_for(0, system.links.size(), [&](int l) {
+        int v1 = v_index[system.links[l][0]];
+        int v2 = v_index[system.links[l][1]];
+        Vector3d q_1 = Q.col(v1);
+        Vector3d q_2 = Q.col(v2);
+        sharp_direction(v1, q_1);
+        sharp_direction(v2, q_2);
+        weights[l * 4] = q_2;
+        weights[l * 4 + 1] = Vector3d(N.col(v2)).cross(q_2);
+        weights[l * 4 + 2] = -q_1;
+        weights[l * 4 + 3] = -Vector3d(N.col(v1)).cross(q_1);
+    });
 
     std::vector<int> fixed_dim(num * 2, 0);
     std::vector<double> x(num * 2);
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < num; ++i) {
+    parallel_for(0, num, [&](int i) {
         int p = v_index[i];
         Vector3d q = Q.col(p);
 
@@ -1117,88 +1458,28 @@ void Optimizer::optimize_positions_fixed(
         Vector3d q_y = n.cross(q);
         x[i * 2] = (v_positions[i] - V.col(p)).dot(q);
         x[i * 2 + 1] = (v_positions[i] - V.col(p)).dot(q_y);
-    }
+    });
 
-    // fix sharp edges
-    for (int i = 0; i < entries.size(); ++i) {
-        if (fixed_dim[i]) {
-            b[i] = x[i];
-            entries[i].clear();
-            entries[i][i] = 1;
-        } else {
-            std::unordered_map<int, double> newmap;
-            for (auto& rec : entries[i]) {
-                if (fixed_dim[rec.first]) {
-                    b[i] -= rec.second * x[rec.first];
-                } else {
-                    newmap[rec.first] = rec.second;
-                }
-            }
-            std::swap(entries[i], newmap);
-        }
-    }
-    for (int i = 0; i < entries.size(); ++i) {
-        if (entries[i].size() == 0) {
-            entries[i][i] = 1;
+    system.analyze(num);
+    system.assemble(weights, targets, fixed_dim, x);
+    const double* values = system.A.valuePtr();
+    for (int i = 0; i < system.A.nonZeros(); ++i) {
+        if (std::isnan(values[i])) {
+            printf("Equation has nan!\n");
+            exit(0);
         }
     }
-
-    std::vector<Eigen::Triplet<double>> lhsTriplets;
-    lhsTriplets.reserve(F.cols() * 6);
-    Eigen::SparseMatrix<double> A(num * 2, num * 2);
-    VectorXd rhs(num * 2);
-    rhs.setZero();
-    for (int i = 0; i < entries.size(); ++i) {
-        rhs(i) = b[i];
-        if (std::isnan(b[i])) {
+    for (int i = 0; i < system.rhs.size(); ++i) {
+        if (std::isnan(system.rhs[i])) {
             printf("Equation has nan!\n");
             exit(0);
         }
-        for (auto& rec : entries[i]) {
-            lhsTriplets.push_back(Eigen::Triplet<double>(i, rec.first, rec.second));
-            if (std::isnan(rec.second)) {
-                printf("Equation has nan!\n");
-                exit(0);
-            }
-        }
     }
-    A.setFromTriplets(lhsTriplets.begin(), lhsTriplets.end());
-
-#ifdef LOG_OUTPUT
-    int t1 = GetCurrentTime64();
-#endif
-    /*
-        Eigen::setNbThreads(1);
-        ConjugateGradient<SparseMatrix<double>, Lower | Upper> solver;
-        VectorXd x0 = VectorXd::Map(x.data(), x.size());
-        solver.setMaxIterations(40);
-
-        solver.compute(A);
-     */
-    LinearSolver<Eigen::SparseMatrix<double>> solver;
-    solver.analyzePattern(A);
-    solver.factorize(A);
-
-    VectorXd x_new = solver.solve(rhs);
-#ifdef LOG_OUTPUT
-    // std::cout << "[LSQ] n_iteration:" << solver.iterations() << std::endl;
-    // std::cout << "[LSQ] estimated error:" << solver.error() << std::endl;
-    int t2 = GetCurrentTime64();
-    printf("[LSQ] Linear solver uses %lf seconds.\n", (t2 - t1) * 1e-3);
-#endif
 
+    VectorXd x_new = VectorXd::Map(x.data(), x.size());
+    system.solve(x_new);
     for (int i = 0; i < x.size(); ++i) {
-        if (!std::isnan(x_new[i])) {
-            if (!fixed_dim[i / 2 * 2 + 1]) {
-                double total = 0;
-                for (auto& res : entries[i]) {
-                    double t = x_new[res.first];
-                    if (std::isnan(t)) t = 0;
-                    total += t * res.second;
-                }
-            }
-            x[i] = x_new[i];
-        }
+        if (!std::isnan(x_new[i])) x[i] = x_new[i];
     }
 
     for (int i = 0; i < O.cols(); ++i) {
@@ -1215,11 +1496,11 @@ void Optimizer::optimize_positions_fixed(
     }
 }
 
-void Optimizer::optimize_integer_constraints(Hierarchy& mRes, std::map<int, int>& singularities,
+void Optimizer::optimize_integer_constraints(Hierarchy& mRes, FaceSingularities<int>& singularities,
                                              bool use_minimum_cost_flow) {
     int edge_capacity = 2;
     bool fullFlow = false;
-    std::vector<std::vector<int>>& AllowChange = mRes.mAllowChanges;
+    std::vector<BitArray>& AllowChange = mRes.mAllowChanges;
     for (int level = mRes.mToUpperEdges.size(); level >= 0; --level) {
         auto& EdgeDiff = mRes.mEdgeDiff[level];
         auto& FQ = mRes.mFQ[level];
@@ -1342,7 +1623,7 @@ void Optimizer::optimize_integer_constraints(Hierarchy& mRes, std::map<int, int>
             for (int i = 0; i < toUpper.size(); ++i) {
                 if (toUpper[i] >= 0) {
                     int orient = (4 - toUpperOrients[i]) % 4;
-                    nEdgeDiff[i] = rshift90(EdgeDiff[toUpper[i]], orient);
+                    nEdgeDiff.set(i, rshift90(EdgeDiff[toUpper[i]], orient));
                 }
             }
         }
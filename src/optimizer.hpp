@@ -1,33 +1,57 @@
 #ifndef OPTIMIZER_H_
 #define OPTIMIZER_H_
 #include "config.hpp"
+#include "edge-hash.hpp"
+#include "edge-ranks.hpp"
 #include "field-math.hpp"
 #include "hierarchy.hpp"
+#include "singularity.hpp"
 
 namespace qflow {
 
+// Position and direction of every vertex on a sharp feature chain, the direction is zero where
+// only the position is fixed. One slot per vertex, set() on different vertices may run
+// concurrently.
+class SharpConstraints {
+   public:
+    void resize(int size) {
+        fixed.assign(size, 0);
+        values.resize(size);
+    }
+    bool count(int v) const { return fixed[v]; }
+    const std::pair<Vector3d, Vector3d>& operator[](int v) const { return values[v]; }
+    void set(int v, const Vector3d& position, const Vector3d& dir) {
+        fixed[v] = 1;
+        values[v] = std::make_pair(position, dir);
+    }
+
+   private:
+    std::vector<char> fixed;
+    std::vector<std::pair<Vector3d, Vector3d>> values;
+};
+
 class Optimizer {
    public:
     Optimizer();
     static void optimize_orientations(Hierarchy& mRes);
     static void optimize_scale(Hierarchy& mRes, VectorXd& rho, int adaptive);
     static void optimize_positions(Hierarchy& mRes, int with_scale = 0);
-    static void optimize_integer_constraints(Hierarchy& mRes, std::map<int, int>& singularities,
+    static void optimize_integer_constraints(Hierarchy& mRes, FaceSingularities<int>& singularities,
                                              bool use_minimum_cost_flow);
     static void optimize_positions_fixed(
-        Hierarchy& mRes, std::vector<DEdge>& edge_values, std::vector<Vector2i>& edge_diff,
-        std::set<int>& sharp_vertices,
-        std::map<int, std::pair<Vector3d, Vector3d>>& sharp_constraints, int with_scale = 0);
+        Hierarchy& mRes, std::vector<DEdge>& edge_values, DiffArray& edge_diff,
+        const EdgeRanks& edge_ranks, BitArray& sharp_vertices,
+        SharpConstraints& sharp_constraints, int with_scale = 0);
     static void optimize_positions_sharp(
-        Hierarchy& mRes, std::vector<DEdge>& edge_values, std::vector<Vector2i>& edge_diff,
-        std::vector<int>& sharp_edges, std::set<int>& sharp_vertices,
-        std::map<int, std::pair<Vector3d, Vector3d>>& sharp_constraints, int with_scale = 0);
+        Hierarchy& mRes, std::vector<DEdge>& edge_values, DiffArray& edge_diff,
+        BitArray& sharp_edges, BitArray& sharp_vertices, SharpConstraints& sharp_constraints,
+        int with_scale = 0);
     static void optimize_positions_dynamic(
         MatrixXi& F, MatrixXd& V, MatrixXd& N, MatrixXd& Q, std::vector<std::vector<int>>& Vset,
         std::vector<Vector3d>& O_compact, std::vector<Vector4i>& F_compact,
         std::vector<int>& V2E_compact, std::vector<int>& E2E_compact, double mScale,
         std::vector<Vector3d>& diffs, std::vector<int>& diff_count,
-        std::map<std::pair<int, int>, int>& o2e, std::vector<int>& sharp_o,
+        const EdgeHashMap& o2e, std::vector<int>& sharp_o,
         std::map<int, std::pair<Vector3d, Vector3d>>& compact_sharp_constraints, int with_scale);
 #ifdef WITH_CUDA
     static void optimize_orientations_cuda(Hierarchy& mRes);
@@ -0,0 +1,133 @@
+#ifndef PACKED_ARRAY_H_
+#define PACKED_ARRAY_H_
+
+#include <Eigen/Core>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace qflow {
+
+using namespace Eigen;
+
+// Compact arrays for the integer grid stage, which keeps one copy of its edge and face data per
+// hierarchy level. Elements are read by value and written through set(), so assigning to an
+// element is a compile error rather than a write to a temporary. set() on neighbouring elements
+// of the same word is not thread-safe.
+
+// One bit per flag
+class BitArray {
+   public:
+    BitArray() {}
+    explicit BitArray(int size, bool value = false) { assign(size, value); }
+
+    void assign(int size, bool value) {
+        num = size;
+        words.assign((size + 63) / 64, value ? ~0ull : 0ull);
+        clear_padding();
+    }
+    void resize(int size, bool value = false) {
+        int old_num = num;
+        num = size;
+        words.resize((size + 63) / 64, value ? ~0ull : 0ull);
+        for (int i = old_num; i < size && i % 64 != 0; ++i) set(i, value);
+        clear_padding();
+    }
+    void push_back(bool value) { resize(num + 1, value); }
+    void clear() {
+        num = 0;
+        words.clear();
+    }
+    int size() const { return num; }
+
+    bool operator[](int i) const { return (words[i / 64] >> (i % 64)) & 1; }
+    void set(int i, bool value) {
+        if (value)
+            words[i / 64] |= 1ull << (i % 64);
+        else
+            words[i / 64] &= ~(1ull << (i % 64));
+    }
+
+    bool operator==(const BitArray& other) const {
+        return num == other.num && words == other.words;
+    }
+
+   private:
+    // Bits past the end are kept zero, so equal arrays have equal words
+    void clear_padding() {
+        if (num % 64) words.back() &= (1ull << (num % 64)) - 1;
+    }
+
+    std::vector<uint64_t> words;
+    int num = 0;
+};
+
+// Integer offset pair per edge as 16-bit integers; offsets are bounded by the extent of the
+// integer grid, which stays far below 2^15 units. Writing a value outside that range exits
+// instead of silently corrupting the integer constraints.
+class DiffArray {
+   public:
+    DiffArray() {}
+    explicit DiffArray(int size) { resize(size); }
+
+    void resize(int size) { data.resize(size * 2, 0); }
+    void push_back(const Vector2i& diff) {
+        data.push_back(narrow(diff[0]));
+        data.push_back(narrow(diff[1]));
+    }
+    void clear() { data.clear(); }
+    int size() const { return data.size() / 2; }
+
+    const Vector2i operator[](int e) const { return Vector2i(data[e * 2], data[e * 2 + 1]); }
+    void set(int e, const Vector2i& diff) {
+        data[e * 2] = narrow(diff[0]);
+        data[e * 2 + 1] = narrow(diff[1]);
+    }
+    void set(int e, int k, int value) { data[e * 2 + k] = narrow(value); }
+
+   private:
+    static int16_t narrow(int value) {
+        if (value < INT16_MIN || value > INT16_MAX) {
+            printf("Edge offset %d exceeds the 16-bit range of DiffArray\n", value);
+            exit(1);
+        }
+        return value;
+    }
+
+    std::vector<int16_t> data;
+};
+
+// Three rotation indices in [0, 4) per face, 2 bits each
+class OrientArray {
+   public:
+    OrientArray() {}
+    explicit OrientArray(int size) { resize(size); }
+
+    void resize(int size) { data.resize(size, 0); }
+    void push_back(const Vector3i& orients) {
+        data.push_back(0);
+        set(data.size() - 1, orients);
+    }
+    void clear() { data.clear(); }
+    int size() const { return data.size(); }
+
+    const Vector3i operator[](int f) const {
+        return Vector3i(data[f] & 3, (data[f] >> 2) & 3, (data[f] >> 4) & 3);
+    }
+    void set(int f, const Vector3i& orients) {
+        data[f] = (orients[0] & 3) | ((orients[1] & 3) << 2) | ((orients[2] & 3) << 4);
+    }
+    void set(int f, int j, int orient) {
+        data[f] = (data[f] & ~(3 << (j * 2))) | ((orient & 3) << (j * 2));
+    }
+
+    bool operator==(const OrientArray& other) const { return data == other.data; }
+
+   private:
+    std::vector<uint8_t> data;
+};
+
+} // namespace qflow
+
+#endif
@@ -0,0 +1,201 @@
+#include "parallel.hpp"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+
+namespace qflow {
+
+namespace {
+
+struct Task {
+    detail::RangeKernel kernel;
+    const void* context;
+    int begin, end, grain;
+    std::atomic<int>* pending;  // iterations (or tasks) of the job not finished yet
+};
+
+struct WorkQueue {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+};
+
+class ThreadPool {
+   public:
+    explicit ThreadPool(int num_threads);
+    ~ThreadPool();
+
+    int size() const { return queues.size(); }
+    void push(const Task& task);
+    void wait(std::atomic<int>& pending);
+
+   private:
+    bool pop(int index, Task& task);
+    bool steal(int index, Task& task);
+    void execute(Task task);
+    void worker(int index);
+
+    std::vector<std::unique_ptr<WorkQueue>> queues;  // queue 0 is shared by external threads
+    std::vector<std::thread> threads;
+    std::atomic<int> num_tasks;
+    std::atomic<int> num_sleeping;
+    std::atomic<bool> stop;
+    std::mutex sleep_mutex;
+    std::condition_variable wakeup;
+};
+
+thread_local int tls_queue = 0;
+
+ThreadPool::ThreadPool(int num_threads) : num_tasks(0), num_sleeping(0), stop(false) {
+    for (int i = 0; i < num_threads; ++i) queues.emplace_back(new WorkQueue());
+    for (int i = 1; i < num_threads; ++i) threads.emplace_back(&ThreadPool::worker, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        stop = true;
+    }
+    wakeup.notify_all();
+    for (auto& t : threads) t.join();
+}
+
+void ThreadPool::push(const Task& task) {
+    WorkQueue& queue = *queues[tls_queue];
+    {
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.tasks.push_back(task);
+    }
+    num_tasks.fetch_add(1);
+    if (num_sleeping.load() > 0) {
+        std::lock_guard<std::mutex> lock(sleep_mutex);
+        wakeup.notify_one();
+    }
+}
+
+bool ThreadPool::pop(int index, Task& task) {
+    WorkQueue& queue = *queues[index];
+    std::lock_guard<std::mutex> lock(queue.mutex);
+    if (queue.tasks.empty()) return false;
+    task = queue.tasks.back();
+    queue.tasks.pop_back();
+    num_tasks.fetch_sub(1);
+    return true;
+}
+
+bool ThreadPool::steal(int index, Task& task) {
+    for (int k = 1; k < size(); ++k) {
+        WorkQueue& queue = *queues[(index + k) % size()];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.tasks.empty()) continue;
+        // the oldest task holds the largest remaining range
+        task = queue.tasks.front();
+        queue.tasks.pop_front();
+        num_tasks.fetch_sub(1);
+        return true;
+    }
+    return false;
+}
+
+void ThreadPool::execute(Task task) {
+    while (task.end - task.begin > task.grain) {
+        Task right = task;
+        right.begin = task.begin + (task.end - task.begin) / 2;
+        task.end = right.begin;
+        push(right);
+    }
+    task.kernel(task.context, task.begin, task.end);
+    task.pending->fetch_sub(task.end - task.begin, std::memory_order_acq_rel);
+}
+
+void ThreadPool::wait(std::atomic<int>& pending) {
+    int index = tls_queue;
+    while (pending.load(std::memory_order_acquire) > 0) {
+        Task task;
+        if (pop(index, task) || steal(index, task))
+            execute(task);
+        else
+            std::this_thread::yield();
+    }
+}
+
+void ThreadPool::worker(int index) {
+    tls_queue = index;
+    while (true) {
+        Task task;
+        if (pop(index, task) || steal(index, task)) {
+            execute(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        num_sleeping.fetch_add(1);
+        wakeup.wait(lock, [&] { return stop.load() || num_tasks.load() > 0; });
+        num_sleeping.fetch_sub(1);
+        if (stop) break;
+    }
+}
+
+// The pool is owned by |pool| and replaced under |pool_mutex|; |current_pool| publishes it to
+// the lock-free fast path of get_pool().
+std::unique_ptr<ThreadPool> pool;
+std::atomic<ThreadPool*> current_pool(nullptr);
+std::mutex pool_mutex;
+
+ThreadPool& get_pool() {
+    ThreadPool* p = current_pool.load(std::memory_order_acquire);
+    if (p) return *p;
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    if (!pool) {
+        pool.reset(new ThreadPool(std::max(1u, std::thread::hardware_concurrency())));
+        current_pool.store(pool.get(), std::memory_order_release);
+    }
+    return *pool;
+}
+
+}  // namespace
+
+void set_num_threads(int num_threads) {
+    if (num_threads <= 0) num_threads = std::max(1u, std::thread::hardware_concurrency());
+    std::lock_guard<std::mutex> lock(pool_mutex);
+    current_pool.store(nullptr, std::memory_order_release);
+    pool.reset();
+    pool.reset(new ThreadPool(num_threads));
+    current_pool.store(pool.get(), std::memory_order_release);
+}
+
+int get_num_threads() { return get_pool().size(); }
+
+namespace detail {
+
+void parallel_for(int begin, int end, int grain, RangeKernel kernel, const void* context) {
+    std::atomic<int> pending(end - begin);
+    Task task = {kernel, context, begin, end, grain, &pending};
+    ThreadPool& p = get_pool();
+    p.push(task);
+    p.wait(pending);
+}
+
+}  // namespace detail
+
+void TaskGroup::run(std::function<void()> task) {
+    if (get_num_threads() == 1) {
+        task();
+        return;
+    }
+    pending.fetch_add(1);
+    Task t = {[](const void* context, int, int) {
+                  auto f = static_cast<const std::function<void()>*>(context);
+                  (*f)();
+                  delete f;
+              },
+              new std::function<void()>(std::move(task)), 0, 1, 1, &pending};
+    get_pool().push(t);
+}
+
+void TaskGroup::wait() {
+    if (pending.load() > 0) get_pool().wait(pending);
+}
+
+} // namespace qflow
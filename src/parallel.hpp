@@ -0,0 +1,125 @@
+#ifndef PARALLEL_H_
+#define PARALLEL_H_
+
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <thread>
+#include <vector>
+
+#include "config.hpp"
+
+namespace qflow {
+
+// All parallel loops of quadriflow run on one work-stealing thread pool. Loops are split
+// lazily: a thread runs the first half of its range and leaves the second half in its own
+// deque, where idle threads steal it. Threads waiting for a loop or a task group execute
+// pending work instead of blocking, so nested loops are safe.
+
+// Sets the number of threads used by the pool (including the calling thread); 0 uses all
+// hardware threads. Must not be called while parallel work is running.
+void set_num_threads(int num_threads);
+int get_num_threads();
+
+namespace detail {
+typedef void (*RangeKernel)(const void* context, int begin, int end);
+void parallel_for(int begin, int end, int grain, RangeKernel kernel, const void* context);
+}  // namespace detail
+
+// Calls func(begin, end) on disjoint chunks of at most |grain| iterations covering [begin, end).
+template <class Func>
+inline void parallel_for_range(int begin, int end, int grain, const Func& func) {
+    if (end - begin <= grain || get_num_threads() == 1) {
+        if (end > begin) func(begin, end);
+        return;
+    }
+    detail::parallel_for(begin, end, std::max(grain, 1),
+                         [](const void* context, int b, int e) {
+                             (*static_cast<const Func*>(context))(b, e);
+                         },
+                         &func);
+}
+
+// Calls func(i) for each i in [begin, end).
+template <class Func>
+inline void parallel_for(int begin, int end, const Func& func, int grain = GRAIN_SIZE) {
+    parallel_for_range(begin, end, grain, [&](int b, int e) {
+        for (int i = b; i < e; ++i) func(i);
+    });
+}
+
+// Reduces [begin, end) with func(begin, end) -> T on chunks of |grain| iterations. The chunks
+// do not depend on the number of threads and their results are combined in order, so the
+// result is reproducible for any thread count.
+template <class T, class Func, class Combine>
+inline T parallel_reduce(int begin, int end, int grain, const T& identity, const Func& func,
+                         const Combine& combine) {
+    if (end <= begin) return identity;
+    int num_chunks = (end - begin + grain - 1) / grain;
+    std::vector<T> partial(num_chunks, identity);
+    parallel_for_range(0, num_chunks, 1, [&](int b, int e) {
+        for (int c = b; c < e; ++c)
+            partial[c] = func(begin + c * grain, std::min(end, begin + (c + 1) * grain));
+    });
+    T result = identity;
+    for (auto& p : partial) result = combine(result, p);
+    return result;
+}
+
+// Sum of func(i) over [begin, end), reproducible for any thread count.
+template <class Func>
+inline double parallel_sum(int begin, int end, const Func& func, int grain = GRAIN_SIZE) {
+    return parallel_reduce(
+        begin, end, grain, 0.0,
+        [&](int b, int e) {
+            double sum = 0;
+            for (int i = b; i < e; ++i) sum += func(i);
+            return sum;
+        },
+        [](double a, double b) { return a + b; });
+}
+
+// Independent tasks run on the pool; wait() returns once all of them have finished.
+class TaskGroup {
+   public:
+    TaskGroup() : pending(0) {}
+    ~TaskGroup() { wait(); }
+    void run(std::function<void()> task);
+    void wait();
+
+   private:
+    std::atomic<int> pending;
+};
+
+// Stable sort that sorts chunks on the pool and merges them pairwise.
+template <class T, class Compare>
+void parallel_stable_sort(std::vector<T>& data, const Compare& compare) {
+    int size = data.size();
+    int chunk = std::max(GRAIN_SIZE, (size + 4 * get_num_threads() - 1) / (4 * get_num_threads()));
+    if (size <= chunk) {
+        std::stable_sort(data.begin(), data.end(), compare);
+        return;
+    }
+    int num_chunks = (size + chunk - 1) / chunk;
+    parallel_for(0, num_chunks, [&](int c) {
+        std::stable_sort(data.begin() + c * chunk, data.begin() + std::min(size, (c + 1) * chunk),
+                         compare);
+    }, 1);
+    std::vector<T> buffer(size);
+    std::vector<T>*src = &data, *dst = &buffer;
+    for (int width = chunk; width < size; width *= 2) {
+        int num_pairs = (size + 2 * width - 1) / (2 * width);
+        parallel_for(0, num_pairs, [&](int p) {
+            int begin = p * 2 * width;
+            int middle = std::min(size, begin + width), end = std::min(size, begin + 2 * width);
+            std::merge(src->begin() + begin, src->begin() + middle, src->begin() + middle,
+                       src->begin() + end, dst->begin() + begin, compare);
+        }, 1);
+        std::swap(src, dst);
+    }
+    if (src != &data) data.swap(buffer);
+}
+
+} // namespace qflow
+
+#endif
@@ -1,4 +1,5 @@
 #include "dedge.hpp"
+#include "parallel.hpp"
 #include "parametrizer.hpp"
 
 #include <algorithm>
@@ -8,68 +9,79 @@
 
 namespace qflow {
 
-double Parametrizer::QuadEnergy(std::vector<int>& loop_vertices, std::vector<Vector4i>& res_quads,
-                                int level) {
-    if (loop_vertices.size() < 4) return 0;
-    if (loop_vertices.size() == 4) {
-        double energy = 0;
-        for (int j = 0; j < 4; ++j) {
-            int v0 = loop_vertices[j];
-            int v2 = loop_vertices[(j + 1) % 4];
-            int v1 = loop_vertices[(j + 3) % 4];
-            Vector3d pt1 = (O_compact[v1] - O_compact[v0]).normalized();
-            Vector3d pt2 = (O_compact[v2] - O_compact[v0]).normalized();
-            Vector3d n = pt1.cross(pt2);
-            double sina = n.norm();
-            if (n.dot(N_compact[v0]) < 0) sina = -sina;
-            double cosa = pt1.dot(pt2);
-            double angle = atan2(sina, cosa) / 3.141592654 * 180.0;
-            if (angle < 0) angle = 360 + angle;
-            energy += angle * angle;
-        }
-        res_quads.push_back(
-            Vector4i(loop_vertices[0], loop_vertices[3], loop_vertices[2], loop_vertices[1]));
-        return energy;
+// Interior holes whose tiling would evaluate more candidate quads are left open
+const long long MAX_HOLE_WORK = 1 << 24;
+// Loops through the boundary of the input are only filled below this size, so that the open
+// boundaries of the input stay open
+const int MAX_BOUNDARY_HOLE_SIZE = 25;
+
+// Candidate quads evaluated by QuadEnergy on a loop of |n| vertices
+static long long quad_tiling_work(int n) {
+    long long work = 0;
+    for (int m = 4; m <= n; ++m) {
+        long long t = (m - 2) / 2;
+        work += (n - m + 1) * t * (t + 1) / 2;
     }
-    double max_energy = 1e30;
-    for (int seg1 = 2; seg1 < loop_vertices.size(); seg1 += 2) {
-        for (int seg2 = seg1 + 1; seg2 < loop_vertices.size(); seg2 += 2) {
-            std::vector<Vector4i> quads[4];
-            std::vector<int> vertices = {loop_vertices[0], loop_vertices[1], loop_vertices[seg1],
-                                         loop_vertices[seg2]};
-            double energy = 0;
-            energy += QuadEnergy(vertices, quads[0], level + 1);
-            if (seg1 > 2) {
-                std::vector<int> vertices(loop_vertices.begin() + 1, loop_vertices.begin() + seg1);
-                vertices.push_back(loop_vertices[seg1]);
-                energy += QuadEnergy(vertices, quads[1], level + 1);
-            }
-            if (seg2 != seg1 + 1) {
-                std::vector<int> vertices(loop_vertices.begin() + seg1,
-                                          loop_vertices.begin() + seg2);
-                vertices.push_back(loop_vertices[seg2]);
-                energy += QuadEnergy(vertices, quads[2], level + 2);
-            }
-            if (seg2 + 1 != loop_vertices.size()) {
-                std::vector<int> vertices(loop_vertices.begin() + seg2, loop_vertices.end());
-                vertices.push_back(loop_vertices[0]);
-                energy += QuadEnergy(vertices, quads[3], level + 1);
-            }
-            if (max_energy > energy) {
-                max_energy = energy;
-                res_quads.clear();
-                for (int i = 0; i < 4; ++i) {
-                    for (auto& v : quads[i]) {
-                        res_quads.push_back(v);
+    return work;
+}
+
+double Parametrizer::QuadEnergy(std::vector<int>& loop_vertices, std::vector<Vector4i>& res_quads,
+                                std::vector<double>& energy, std::vector<int>& split) {
+    int n = loop_vertices.size();
+    auto corner = [&](int prev, int v, int next) {
+        int v0 = loop_vertices[v];
+        Vector3d pt1 = (O_compact[loop_vertices[prev]] - O_compact[v0]).normalized();
+        Vector3d pt2 = (O_compact[loop_vertices[next]] - O_compact[v0]).normalized();
+        Vector3d normal = pt1.cross(pt2);
+        double sina = normal.norm();
+        if (normal.dot(N_compact[v0]) < 0) sina = -sina;
+        double cosa = pt1.dot(pt2);
+        double angle = atan2(sina, cosa) / 3.141592654 * 180.0;
+        if (angle < 0) angle = 360 + angle;
+        return angle * angle;
+    };
+    // energy[i * n + j] tiles the sub-loop i, i + 1, ..., j closed by the chord (j, i). Its
+    // quad on the chord is (i, a, b, j), leaving the sub-loops (i, a), (a, b) and (b, j); an odd
+    // vertex count is left to (b, j), where a triangle stays open.
+    energy.assign(n * n, 0);
+    split.assign(n * n, -1);
+    for (int m = 4; m <= n; ++m) {
+        for (int i = 0; i + m <= n; ++i) {
+            int j = i + m - 1;
+            double min_energy = 1e30;
+            for (int a = i + 1; a < j; a += 2) {
+                for (int b = a + 1; b < j; b += 2) {
+                    double e = energy[i * n + a] + energy[a * n + b] + energy[b * n + j];
+                    if (e >= min_energy) continue;
+                    e += corner(j, i, a) + corner(i, a, b) + corner(a, b, j) + corner(b, j, i);
+                    if (e < min_energy) {
+                        min_energy = e;
+                        split[i * n + j] = a * n + b;
                     }
                 }
             }
+            energy[i * n + j] = min_energy;
         }
     }
-    return max_energy;
+    if (n < 4) return 0;
+    std::vector<std::pair<int, int>> stack(1, std::make_pair(0, n - 1));
+    while (!stack.empty()) {
+        int i = stack.back().first, j = stack.back().second;
+        stack.pop_back();
+        if (split[i * n + j] == -1) continue;
+        int a = split[i * n + j] / n, b = split[i * n + j] % n;
+        res_quads.push_back(Vector4i(loop_vertices[i], loop_vertices[j], loop_vertices[b],
+                                     loop_vertices[a]));
+        stack.push_back(std::make_pair(b, j));
+        stack.push_back(std::make_pair(a, b));
+        stack.push_back(std::make_pair(i, a));
+    }
+    return energy[n - 1];
 }
 
-void Parametrizer::FixHoles(std::vector<int>& loop_vertices) {
+// Splits a boundary loop at its repeated vertices into simple loops
+static void split_hole_loop(std::vector<int>& loop_vertices,
+                            std::vector<std::vector<int>>& loops) {
     std::vector<std::vector<int>> loop_vertices_array;
     std::unordered_map<int, int> map_loops;
     for (int i = 0; i < loop_vertices.size(); ++i) {
@@ -99,23 +111,35 @@ void Parametrizer::FixHoles(std::vector<int>& loop_vertices) {
         }
     }
     for (int i = 0; i < loop_vertices_array.size(); ++i) {
-        auto& loop_vertices = loop_vertices_array[i];
-        if (loop_vertices.size() == 0) return;
-        std::vector<Vector4i> quads;
-#ifdef LOG_OUTPUT
-//        printf("Compute energy for loop: %d\n", (int)loop_vertices.size());
-#endif
-        QuadEnergy(loop_vertices, quads, 0);
-#ifdef LOG_OUTPUT
-//        printf("quads: %d\n", quads.size());
-#endif
+        if (loop_vertices_array[i].size() == 0) return;
+        loops.push_back(std::move(loop_vertices_array[i]));
+    }
+}
+
+void Parametrizer::FixHoles(std::vector<int>& loop_vertices) {
+    std::vector<std::vector<int>> loops;
+    split_hole_loop(loop_vertices, loops);
+    FixHoles(loops);
+}
+
+void Parametrizer::FixHoles(std::vector<std::vector<int>>& loops) {
+    // the tilings are independent, only adding the quads depends on the order
+    std::vector<std::vector<Vector4i>> loop_quads(loops.size());
+    parallel_for_range(0, loops.size(), 8, [&](int begin, int end) {
+        std::vector<double> energy;
+        std::vector<int> split;
+        for (int i = begin; i < end; ++i) {
+            if (quad_tiling_work(loops[i].size()) > MAX_HOLE_WORK) continue;
+            QuadEnergy(loops[i], loop_quads[i], energy, split);
+        }
+    });
+    for (auto& quads : loop_quads) {
         for (auto& p : quads) {
             bool flag = false;
             for (int j = 0; j < 4; ++j) {
                 int v1 = p[j];
                 int v2 = p[(j + 1) % 4];
-                auto key = std::make_pair(v1, v2);
-                if (Quad_edges.count(key)) {
+                if (Quad_edges.count(v1, v2)) {
                     flag = true;
                     break;
                 }
@@ -124,8 +148,7 @@ void Parametrizer::FixHoles(std::vector<int>& loop_vertices) {
                 for (int j = 0; j < 4; ++j) {
                     int v1 = p[j];
                     int v2 = p[(j + 1) % 4];
-                    auto key = std::make_pair(v1, v2);
-                    Quad_edges.insert(key);
+                    Quad_edges.insert(v1, v2, 1);
                 }
                 F_compact.push_back(p);
             }
@@ -138,10 +161,17 @@ void Parametrizer::FixHoles() {
         for (int j = 0; j < 4; ++j) {
             int v1 = F_compact[i][j];
             int v2 = F_compact[i][(j + 1) % 4];
-            auto key = std::make_pair(v1, v2);
-            Quad_edges.insert(key);
+            Quad_edges.insert(v1, v2, 1);
         }
     }
+    // compact vertices that merge a boundary vertex of the input
+    std::vector<char> input_boundary(Vset.size(), 0);
+    parallel_for(0, Vset.size(), [&](int i) {
+        for (int v : Vset[i]) {
+            if (boundary[v]) input_boundary[i] = 1;
+        }
+    });
+    std::vector<std::vector<int>> loops;
     std::vector<int> detected_boundary(E2E_compact.size(), 0);
     for (int i = 0; i < E2E_compact.size(); ++i) {
         if (detected_boundary[i] != 0 || E2E_compact[i] != -1) continue;
@@ -161,13 +191,22 @@ void Parametrizer::FixHoles() {
         for (int j = 0; j < loop_edges.size(); ++j) {
             loop_vertices[j] = F_compact[loop_edges[j] / 4][loop_edges[j] % 4];
         }
-        if (loop_vertices.size() < 25) FixHoles(loop_vertices);
+        bool on_input_boundary = false;
+        for (int v : loop_vertices) on_input_boundary |= input_boundary[v] != 0;
+        if (on_input_boundary && loop_vertices.size() >= MAX_BOUNDARY_HOLE_SIZE) continue;
+        split_hole_loop(loop_vertices, loops);
     }
+    FixHoles(loops);
+}
+
+void Parametrizer::BuildEdgeHierarchy() {
+    edge_hierarchy.DownsampleEdgeGraph(face_edgeOrients, face_edgeIds, edge_diff, allow_changes,
+                                       -1);
 }
 
 void Parametrizer::FixFlipHierarchy() {
-    Hierarchy fh;
-    fh.DownsampleEdgeGraph(face_edgeOrients, face_edgeIds, edge_diff, allow_changes, -1);
+    auto& fh = edge_hierarchy;
+    BuildEdgeHierarchy();
     fh.FixFlip();
     fh.UpdateGraphValue(face_edgeOrients, face_edgeIds, edge_diff);
 }
@@ -182,8 +221,8 @@ void Parametrizer::FixFlipSat() {
     for (int threshold = 1; threshold <= 4; ++threshold) {
         lprintf("[FixFlipSat] threshold = %d\n", threshold);
 
-        Hierarchy fh;
-        fh.DownsampleEdgeGraph(face_edgeOrients, face_edgeIds, edge_diff, allow_changes, -1);
+        auto& fh = edge_hierarchy;
+        BuildEdgeHierarchy();
         int nflip = 0;
         for (int depth = std::min(5, (int)fh.mFQ.size() - 1); depth >= 0; --depth) {
             nflip = fh.FixFlipSat(depth, threshold);
@@ -196,18 +235,17 @@ void Parametrizer::FixFlipSat() {
 }
 
 void Parametrizer::AdvancedExtractQuad() {
-    Hierarchy fh;
-    fh.DownsampleEdgeGraph(face_edgeOrients, face_edgeIds, edge_diff, allow_changes, -1);
+    auto& fh = edge_hierarchy;
+    BuildEdgeHierarchy();
     auto& V = hierarchy.mV[0];
     auto& F = hierarchy.mF;
     disajoint_tree = DisajointTree(V.cols());
     auto& diffs = fh.mEdgeDiff.front();
-    for (int i = 0; i < diffs.size(); ++i) {
-        if (diffs[i] == Vector2i::Zero()) {
-            disajoint_tree.Merge(edge_values[i].x, edge_values[i].y);
-        }
-    }
-    disajoint_tree.BuildCompactParent();
+    disajoint_tree.BuildCompactParallel(diffs.size(), [&](int i, int& x, int& y) {
+        x = edge_values[i].x;
+        y = edge_values[i].y;
+        return diffs[i] == Vector2i::Zero();
+    });
     auto& F2E = fh.mF2E.back();
     auto& E2F = fh.mE2F.back();
     auto& EdgeDiff = fh.mEdgeDiff.back();
@@ -242,24 +280,25 @@ void Parametrizer::AdvancedExtractQuad() {
     Q_compact.resize(num_v, Vector3d::Zero());
     N_compact.resize(num_v, Vector3d::Zero());
     counter.resize(num_v, 0);
-    for (int i = 0; i < O.cols(); ++i) {
-        int compact_v = disajoint_tree.Index(i);
-        Vset[compact_v].push_back(i);
-        O_compact[compact_v] += O.col(i);
-        N_compact[compact_v] = N_compact[compact_v] * counter[compact_v] + N.col(i);
-        N_compact[compact_v].normalize();
-        if (counter[compact_v] == 0)
-            Q_compact[compact_v] = Q.col(i);
-        else {
-            auto pairs = compat_orientation_extrinsic_4(Q_compact[compact_v], N_compact[compact_v],
-                                                        Q.col(i), N.col(i));
-            Q_compact[compact_v] = (pairs.first * counter[compact_v] + pairs.second).normalized();
+    for (int i = 0; i < O.cols(); ++i) Vset[disajoint_tree.Index(i)].push_back(i);
+    // the members of a compact vertex are visited in index order
+    parallel_for(0, num_v, [&](int compact_v) {
+        for (int i : Vset[compact_v]) {
+            O_compact[compact_v] += O.col(i);
+            N_compact[compact_v] = N_compact[compact_v] * counter[compact_v] + N.col(i);
+            N_compact[compact_v].normalize();
+            if (counter[compact_v] == 0)
+                Q_compact[compact_v] = Q.col(i);
+            else {
+                auto pairs = compat_orientation_extrinsic_4(
+                    Q_compact[compact_v], N_compact[compact_v], Q.col(i), N.col(i));
+                Q_compact[compact_v] =
+                    (pairs.first * counter[compact_v] + pairs.second).normalized();
+            }
+            counter[compact_v] += 1;
         }
-        counter[compact_v] += 1;
-    }
-    for (int i = 0; i < O_compact.size(); ++i) {
-        O_compact[i] /= counter[i];
-    }
+        O_compact[compact_v] /= counter[compact_v];
+    });
 
     BuildTriangleManifold(disajoint_tree, edge, face, edge_values, F2E, E2F, EdgeDiff, FQ);
 }
@@ -267,8 +306,7 @@ void Parametrizer::AdvancedExtractQuad() {
 void Parametrizer::BuildTriangleManifold(DisajointTree& disajoint_tree, std::vector<int>& edge,
                                          std::vector<int>& face, std::vector<DEdge>& edge_values,
                                          std::vector<Vector3i>& F2E, std::vector<Vector2i>& E2F,
-                                         std::vector<Vector2i>& EdgeDiff,
-                                         std::vector<Vector3i>& FQ) {
+                                         DiffArray& EdgeDiff, OrientArray& FQ) {
     auto& F = hierarchy.mF;
     std::vector<int> E2E(F2E.size() * 3, -1);
     for (int i = 0; i < E2F.size(); ++i) {
@@ -435,7 +473,8 @@ void Parametrizer::BuildTriangleManifold(DisajointTree& disajoint_tree, std::vec
     VectorXi NV2E, NE2E, NB, NN;
     compute_direct_graph(NV, NF, NV2E, NE2E, NB, NN);
 
-    std::map<DEdge, std::pair<Vector3i, Vector3i>> quads;
+    // diagonal edges sorted by key, each pairing its first and last triangle like a map would
+    std::vector<std::pair<DEdge, Vector3i>> diagonals;
     for (int i = 0; i < triangle_vertices.size(); ++i) {
         for (int j = 0; j < 3; ++j) {
             int e = triangle_edges[i][j];
@@ -443,19 +482,21 @@ void Parametrizer::BuildTriangleManifold(DisajointTree& disajoint_tree, std::vec
             int v2 = triangle_vertices[i][(j + 1) % 3];
             int v3 = triangle_vertices[i][(j + 2) % 3];
             if (abs(EdgeDiff[e][0]) == 1 && abs(EdgeDiff[e][1]) == 1) {
-                DEdge edge(v1, v2);
-                if (quads.count(edge))
-                    quads[edge].second = Vector3i(v1, v2, v3);
-                else
-                    quads[edge] = std::make_pair(Vector3i(v1, v2, v3), Vector3i(-1, -1, -1));
+                diagonals.push_back(std::make_pair(DEdge(v1, v2), Vector3i(v1, v2, v3)));
             }
         }
     }
+    parallel_stable_sort(diagonals,
+                         [](const std::pair<DEdge, Vector3i>& a,
+                            const std::pair<DEdge, Vector3i>& b) { return a.first < b.first; });
 
-    for (auto& p : quads) {
-        if (p.second.second[0] != -1 && p.second.first[2] != p.second.second[2]) {
-            F_compact.push_back(Vector4i(p.second.first[1], p.second.first[2], p.second.first[0],
-                                         p.second.second[2]));
+    for (int i = 0, j; i < diagonals.size(); i = j) {
+        for (j = i + 1; j < diagonals.size() && diagonals[j].first == diagonals[i].first; ++j) {
+        }
+        auto& first = diagonals[i].second;
+        auto& second = diagonals[j - 1].second;
+        if (j - i > 1 && first[2] != second[2]) {
+            F_compact.push_back(Vector4i(first[1], first[2], first[0], second[2]));
         }
     }
     std::swap(Vs, Vset);
@@ -5,6 +5,7 @@
 #include <vector>
 #include <random>
 #include "optimizer.hpp"
+#include "pcg32/pcg32.h"
 
 namespace qflow {
 
@@ -44,26 +45,39 @@ void Parametrizer::BuildEdgeInfo() {
                 if (eid != -1) face_edgeIds[eid / 3][eid % 3] = eID2;
             } else if (!singularities.count(i)) {
                 eID2 = face_edgeIds[eid / 3][eid % 3];
-                edge_diff[eID2] = diff2;
+                edge_diff.set(eID2, diff2);
             }
         }
     }
+    edge_ranks.compute(hierarchy.mQ[0], hierarchy.mN[0], edge_values);
 }
 
 void Parametrizer::BuildIntegerConstraints() {
     auto& F = hierarchy.mF;
-    auto& Q = hierarchy.mQ[0];
-    auto& N = hierarchy.mN[0];
     face_edgeOrients.resize(F.cols());
 
     //Random number generator (for shuffling)
     std::random_device rd;
     std::mt19937 g(rd());
     g.seed(hierarchy.rng_seed);
+    // pcg32 shuffles identically on every platform, std::shuffle depends on the standard library
+    pcg32 deterministic_rng(hierarchy.rng_seed);
+    auto shuffle = [&](std::vector<std::pair<int, int>>& values) {
+        if (hierarchy.deterministic)
+            deterministic_rng.shuffle(values.begin(), values.end());
+        else
+            std::shuffle(values.begin(), values.end(), g);
+    };
 
-    // undirected edge to direct edge
+    // undirected edge to direct edge, the first one in face order first
+    auto& E2E = hierarchy.mE2E;
     std::vector<std::pair<int, int>> E2D(edge_diff.size(), std::make_pair(-1, -1));
-    for (int i = 0; i < F.cols(); ++i) {
+    parallel_for(0, F.cols() * 3, [&](int i) {
+        int opposite = E2E[i];
+        if (opposite == -1 || i < opposite)
+            E2D[face_edgeIds[i / 3][i % 3]] = std::make_pair(i, opposite);
+    });
+    parallel_for(0, F.cols(), [&](int i) {
         int v0 = F(0, i);
         int v1 = F(1, i);
         int v2 = F(2, i);
@@ -73,13 +87,10 @@ void Parametrizer::BuildIntegerConstraints() {
         for (int i = 0; i < 3; ++i) {
             variable_id[i] = Vector2i(eid[i] * 2 + 1, eid[i] * 2 + 2);
         }
-        auto index1 =
-            compat_orientation_extrinsic_index_4(Q.col(v0), N.col(v0), Q.col(v1), N.col(v1));
-        auto index2 =
-            compat_orientation_extrinsic_index_4(Q.col(v0), N.col(v0), Q.col(v2), N.col(v2));
-
-        int rank1 = (index1.first - index1.second + 4) % 4;  // v1 -> v0
-        int rank2 = (index2.first - index2.second + 4) % 4;  // v2 -> v0
+        // edge ranks go from the smaller vertex to the larger one
+        int rank1 = edge_ranks[eid[0]], rank2 = edge_ranks[eid[2]];
+        if (v0 < v1) rank1 = (4 - rank1) % 4;  // v1 -> v0
+        if (v0 < v2) rank2 = (4 - rank2) % 4;  // v2 -> v0
         int orients[3] = {0};                                // == {0, 0, 0}
         if (v1 < v0) {
             variable_id[0] = -rshift90(variable_id[0], rank1);
@@ -101,15 +112,8 @@ void Parametrizer::BuildIntegerConstraints() {
             variable_id[2] = -variable_id[2];
             orients[2] = 2;
         }
-        face_edgeOrients[i] = Vector3i(orients[0], orients[1], orients[2]);
-        for (int j = 0; j < 3; ++j) {
-            int eid = face_edgeIds[i][j];
-            if (E2D[eid].first == -1)
-                E2D[eid].first = i * 3 + j;
-            else
-                E2D[eid].second = i * 3 + j;
-        }
-    }
+        face_edgeOrients.set(i, Vector3i(orients[0], orients[1], orients[2]));
+    });
 
     // a face disajoint tree
     DisajointOrientTree disajoint_orient_tree = DisajointOrientTree(F.cols());
@@ -122,49 +126,44 @@ void Parametrizer::BuildIntegerConstraints() {
         }
     }
 
+    // the merge order: edges between regular faces, then the edges of the singularities, then the
+    // sharp edges
+    std::vector<char> is_regular(E2D.size());
+    parallel_for(0, E2D.size(), [&](int i) {
+        int f0 = E2D[i].first / 3;
+        int f1 = E2D[i].second / 3;
+        is_regular[i] = E2D[i].first != -1 && E2D[i].second != -1 && !singularities.count(f0) &&
+                        !singularities.count(f1) && !sharpUE[i];
+    });
+    std::vector<int> tree_edges;
     for (int i = 0; i < E2D.size(); ++i) {
-        auto& edge_c = E2D[i];
-        int f0 = edge_c.first / 3;
-        int f1 = edge_c.second / 3;
-        if (edge_c.first == -1 || edge_c.second == -1) continue;
-        if (singularities.count(f0) || singularities.count(f1) || sharpUE[i]) continue;
-        int orient1 = face_edgeOrients[f0][edge_c.first % 3];
-        int orient0 = (face_edgeOrients[f1][edge_c.second % 3] + 2) % 4;
-        disajoint_orient_tree.Merge(f0, f1, orient0, orient1);
+        if (is_regular[i]) tree_edges.push_back(i);
     }
-
-    // merge singularity later
-    for (auto& f : singularities) {
+    for (int f : singularities.faces()) {
         for (int i = 0; i < 3; ++i) {
-            if (sharpUE[face_edgeIds[f.first][i]]) continue;
-            auto& edge_c = E2D[face_edgeIds[f.first][i]];
-            if (edge_c.first == -1 || edge_c.second == -1) continue;
-            int v0 = edge_c.first / 3;
-            int v1 = edge_c.second / 3;
-            int orient1 = face_edgeOrients[v0][edge_c.first % 3];
-            int orient0 = (face_edgeOrients[v1][edge_c.second % 3] + 2) % 4;
-            disajoint_orient_tree.Merge(v0, v1, orient0, orient1);
+            int e = face_edgeIds[f][i];
+            if (!sharpUE[e] && E2D[e].first != -1 && E2D[e].second != -1) tree_edges.push_back(e);
         }
     }
-
     for (int i = 0; i < sharpUE.size(); ++i) {
-        if (sharpUE[i] == 0) continue;
-        auto& edge_c = E2D[i];
-        if (edge_c.first == -1 || edge_c.second == -1) continue;
-        int f0 = edge_c.first / 3;
-        int f1 = edge_c.second / 3;
-        int orient1 = face_edgeOrients[f0][edge_c.first % 3];
-        int orient0 = (face_edgeOrients[f1][edge_c.second % 3] + 2) % 4;
-        disajoint_orient_tree.Merge(f0, f1, orient0, orient1);
+        if (sharpUE[i] && E2D[i].first != -1 && E2D[i].second != -1) tree_edges.push_back(i);
     }
+    disajoint_orient_tree.MergeParallel(
+        tree_edges.size(), [&](int i, int& f0, int& f1, int& orient0, int& orient1) {
+            auto& edge_c = E2D[tree_edges[i]];
+            f0 = edge_c.first / 3;
+            f1 = edge_c.second / 3;
+            orient1 = face_edgeOrients[f0][edge_c.first % 3];
+            orient0 = (face_edgeOrients[f1][edge_c.second % 3] + 2) % 4;
+        });
 
     // all the face has the same parent.  we rotate every face to the space of that parent.
-    for (int i = 0; i < face_edgeOrients.size(); ++i) {
-        for (int j = 0; j < 3; ++j) {
-            face_edgeOrients[i][j] =
-                (face_edgeOrients[i][j] + disajoint_orient_tree.Orient(i)) % 4;
-        }
-    }
+    parallel_for(0, face_edgeOrients.size(), [&](int i) {
+        int orient = disajoint_orient_tree.Orient(i);
+        Vector3i orients = face_edgeOrients[i];
+        for (int j = 0; j < 3; ++j) orients[j] = (orients[j] + orient) % 4;
+        face_edgeOrients.set(i, orients);
+    });
 
     std::vector<int> sharp_colors(face_edgeIds.size(), -1);
     int num_sharp_component = 0;
@@ -265,8 +264,7 @@ void Parametrizer::BuildIntegerConstraints() {
 
         // uniformly random manually modify variables so that the network has full flow.
         for (int i = 0; i < 2; ++i)
-            for (auto& modified_var : modified_variables[i])
-                std::shuffle(modified_var.begin(), modified_var.end(), g);
+            for (auto& modified_var : modified_variables[i]) shuffle(modified_var);
 
         for (int j = 0; j < total_flows.size(); ++j) {
             for (int ii = 0; ii < 2; ++ii) {
@@ -280,7 +278,8 @@ void Parametrizer::BuildIntegerConstraints() {
                 int dir = (total_flows[j] > 0) ? -1 : 1;
                 for (int i = 0; i < max_num; ++i) {
                     auto& info = modified_variables[ii][j][i];
-                    edge_diff[info.first / 2][info.first % 2] += info.second;
+                    edge_diff.set(info.first / 2, info.first % 2,
+                                  edge_diff[info.first / 2][info.first % 2] + info.second);
                     if (ii == 0)
                         total_flows[j] += 2 * dir;
                     else
@@ -392,8 +391,7 @@ void Parametrizer::BuildIntegerConstraints() {
 
     // uniformly random manually modify variables so that the network has full flow.
     for (int j = 0; j < 2; ++j) {
-        for (auto& modified_var : modified_variables[j])
-            std::shuffle(modified_var.begin(), modified_var.end(), g);
+        for (auto& modified_var : modified_variables[j]) shuffle(modified_var);
     }
     for (int j = 0; j < total_flows.size(); ++j) {
         for (int ii = 0; ii < 2; ++ii) {
@@ -406,7 +404,8 @@ void Parametrizer::BuildIntegerConstraints() {
             int dir = (total_flows[j] > 0) ? -1 : 1;
             for (int i = 0; i < max_num; ++i) {
                 auto& info = modified_variables[ii][j][i];
-                edge_diff[info.first / 2][info.first % 2] += info.second;
+                edge_diff.set(info.first / 2, info.first % 2,
+                              edge_diff[info.first / 2][info.first % 2] + info.second);
                 if (ii == 0)
                     total_flows[j] += 2 * dir;
                 else
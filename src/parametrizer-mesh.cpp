@@ -1,11 +1,15 @@
 #include "config.hpp"
+#include "decimate.hpp"
 #include "dedge.hpp"
 #include "field-math.hpp"
 #include "loader.hpp"
 #include "merge-vertex.hpp"
+#include "parallel.hpp"
 #include "parametrizer.hpp"
 #include "subdivide.hpp"
 #include "dedge.hpp"
+#include <algorithm>
+#include <deque>
 #include <queue>
 
 namespace qflow {
@@ -22,14 +26,11 @@ void Parametrizer::NormalizeMesh() {
     }
     double scale =
     std::max(std::max(maxV[0] - minV[0], maxV[1] - minV[1]), maxV[2] - minV[2]) * 0.5;
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < V.cols(); ++i) {
+    parallel_for(0, V.cols(), [&](int i) {
         for (int j = 0; j < 3; ++j) {
             V(j, i) = (V(j, i) - (maxV[j] + minV[j]) * 0.5) / scale;
         }
-    }
+    });
 #ifdef LOG_OUTPUT
     printf("vertices size: %d\n", (int)V.cols());
     printf("faces size: %d\n", (int)F.cols());
@@ -46,11 +47,6 @@ void Parametrizer::Load(const char* filename) {
 
 void Parametrizer::Initialize(int faces) {
     ComputeMeshStatus();
-    //ComputeCurvature(V, F, rho);
-    rho.resize(V.cols(), 1);
-    for (int i = 0; i < V.cols(); ++i) {
-        rho[i] = 1;
-    }
 #ifdef PERFORMANCE_TEST
     scale = sqrt(surface_area / (V.cols() * 10));
 #else
@@ -60,6 +56,22 @@ void Parametrizer::Initialize(int faces) {
         scale = std::sqrt(surface_area / faces);
     }
 #endif
+    // inputs much denser than the target are decimated to a quarter of the target scale first,
+    // the final positions are projected back onto them
+    if (flag_decimate && average_edge_length < scale / 8) {
+        V_input = V;
+        F_input = F;
+        decimate(F, V, scale / 4);
+#ifdef LOG_OUTPUT
+        printf("Decimate %d -> %d faces\n", (int)F_input.cols(), (int)F.cols());
+#endif
+        ComputeMeshStatus();
+    }
+    //ComputeCurvature(V, F, rho);
+    rho.resize(V.cols(), 1);
+    for (int i = 0; i < V.cols(); ++i) {
+        rho[i] = 1;
+    }
     double target_len = std::min(scale / 2, average_edge_length * 2);
 #ifdef PERFORMANCE_TEST
     scale = sqrt(surface_area / V.cols());
@@ -104,6 +116,13 @@ void Parametrizer::Initialize(int faces) {
     hierarchy.Initialize(scale, flag_adaptive_scale);
 }
 
+void Parametrizer::SetTargetFaces(int faces) {
+    scale = std::sqrt(surface_area / faces);
+    hierarchy.InitializePositions(scale);
+    // the slopes are traced with steps of the target scale
+    if (flag_adaptive_scale == 1) EstimateSlope();
+}
+
 void Parametrizer::ComputeMeshStatus() {
     surface_area = 0;
     average_edge_length = 0;
@@ -122,13 +141,13 @@ void Parametrizer::ComputeMeshStatus() {
 }
 
 void Parametrizer::ComputeSharpEdges() {
-    sharp_edges.resize(F.cols() * 3, 0);
+    sharp_edges.resize(F.cols() * 3, false);
 
     if (flag_preserve_boundary) {
         for (int i = 0; i < sharp_edges.size(); ++i) {
             int re = E2E[i];
             if (re == -1) {
-                sharp_edges[i] = 1;
+                sharp_edges.set(i, true);
             }
         }
     }
@@ -151,7 +170,7 @@ void Parametrizer::ComputeSharpEdges() {
         Vector3d& n1 = face_normals[e/3];
         Vector3d& n2 = face_normals[re/3];
         if (n1.dot(n2) < cos_thres) {
-            sharp_edges[i] = 1;
+            sharp_edges.set(i, true);
         }
     }
 }
@@ -162,61 +181,71 @@ void Parametrizer::ComputeSharpO() {
     auto& O = hierarchy.mO[0];
     auto& E2E = hierarchy.mE2E;
     DisajointTree tree(V.cols());
-    for (int i = 0; i < edge_diff.size(); ++i) {
-        if (edge_diff[i][0] == 0 && edge_diff[i][1] == 0) {
-            tree.Merge(edge_values[i].x, edge_values[i].y);
-        }
-    }
-    std::map<DEdge, std::vector<Vector3d> > edge_normals;
-    for (int i = 0; i < F.cols(); ++i) {
-        int pv[] = {tree.Parent(F(0, i)), tree.Parent(F(1, i)), tree.Parent(F(2, i))};
-        if (pv[0] == pv[1] || pv[1] == pv[2] || pv[2] == pv[0])
-            continue;
-        DEdge e[] = {DEdge(pv[0], pv[1]), DEdge(pv[1], pv[2]), DEdge(pv[2], pv[0])};
+    tree.BuildCompactParallel(edge_diff.size(), [&](int i, int& x, int& y) {
+        x = edge_values[i].x;
+        y = edge_values[i].y;
+        return edge_diff[i][0] == 0 && edge_diff[i][1] == 0;
+    });
+    // normals of the faces around every compact edge, grouped by edge with a stable sort
+    std::vector<std::pair<DEdge, Vector3d>> edge_normals(F.cols() * 3);
+    std::vector<char> is_valid(F.cols());
+    parallel_for(0, F.cols(), [&](int i) {
+        int pv[] = {tree.Index(F(0, i)), tree.Index(F(1, i)), tree.Index(F(2, i))};
+        is_valid[i] = pv[0] != pv[1] && pv[1] != pv[2] && pv[2] != pv[0];
+        if (!is_valid[i]) return;
         Vector3d d1 = O.col(F(1, i)) - O.col(F(0, i));
         Vector3d d2 = O.col(F(2, i)) - O.col(F(0, i));
         Vector3d n = d1.cross(d2).normalized();
-        for (int j = 0; j < 3; ++j) {
-            if (edge_normals.count(e[j]) == 0)
-                edge_normals[e[j]] = std::vector<Vector3d>();
-            edge_normals[e[j]].push_back(n);
-        }
+        for (int j = 0; j < 3; ++j)
+            edge_normals[i * 3 + j] = std::make_pair(DEdge(pv[j], pv[(j + 1) % 3]), n);
+    });
+    int num_normals = 0;
+    for (int i = 0; i < F.cols(); ++i) {
+        if (!is_valid[i]) continue;
+        for (int j = 0; j < 3; ++j) edge_normals[num_normals++] = edge_normals[i * 3 + j];
+    }
+    edge_normals.resize(num_normals);
+    parallel_stable_sort(edge_normals, [](const std::pair<DEdge, Vector3d>& a,
+                                          const std::pair<DEdge, Vector3d>& b) {
+        return a.first < b.first;
+    });
+    std::vector<int> groups;
+    for (int i = 0; i < num_normals; ++i) {
+        if (i == 0 || edge_normals[i].first != edge_normals[i - 1].first) groups.push_back(i);
     }
-    std::map<DEdge, int> sharps;
-    for (auto& info : edge_normals) {
-        auto& normals = info.second;
-        bool sharp = false;
-        for (int i = 0; i < normals.size(); ++i) {
-            for (int j = i + 1; j < normals.size(); ++j) {
-                if (normals[i].dot(normals[j]) < cos(60.0 / 180.0 * 3.141592654)) {
-                    sharp = true;
+    groups.push_back(num_normals);
+    std::vector<char> is_sharp(groups.size() - 1);
+    parallel_for(0, groups.size() - 1, [&](int g) {
+        for (int i = groups[g]; i < groups[g + 1] && !is_sharp[g]; ++i) {
+            for (int j = i + 1; j < groups[g + 1]; ++j) {
+                if (edge_normals[i].second.dot(edge_normals[j].second) <
+                    cos(60.0 / 180.0 * 3.141592654)) {
+                    is_sharp[g] = 1;
                     break;
                 }
             }
-            if (sharp)
-                break;
-        }
-        if (sharp) {
-            int s = sharps.size();
-            sharps[info.first] = s;
         }
+    });
+    EdgeHashMap sharps;
+    sharps.reserve(groups.size() - 1);
+    int num_sharps = 0;
+    for (int g = 0; g + 1 < groups.size(); ++g) {
+        const DEdge& e = edge_normals[groups[g]].first;
+        if (is_sharp[g]) sharps.insert(e.x, e.y, num_sharps++);
     }
-    for (auto& s : sharp_edges)
-        s = 0;
-    std::vector<int> sharp_hash(sharps.size(), 0);
+    sharp_edges.assign(sharp_edges.size(), false);
+    std::vector<int> sharp_hash(num_sharps, 0);
     for (int i = 0; i < F.cols(); ++i) {
         for (int j = 0; j < 3; ++j) {
-            int v1 = tree.Parent(F(j, i));
-            int v2 = tree.Parent(F((j + 1) % 3, i));
-            DEdge e(v1, v2);
-            if (sharps.count(e) == 0)
+            DEdge e(tree.Index(F(j, i)), tree.Index(F((j + 1) % 3, i)));
+            int id = sharps.find(e.x, e.y);
+            if (id == -1)
                 continue;
-            int id = sharps[e];
             if (sharp_hash[id])
                 continue;
             sharp_hash[id] = 1;
-            sharp_edges[i * 3 + j] = 1;
-            sharp_edges[E2E[i * 3 + j]] = 1;
+            sharp_edges.set(i * 3 + j, true);
+            sharp_edges.set(E2E[i * 3 + j], true);
         }
     }
     
@@ -225,10 +254,7 @@ void Parametrizer::ComputeSharpO() {
 void Parametrizer::ComputeSmoothNormal() {
     /* Compute face normals */
     Nf.resize(3, F.cols());
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int f = 0; f < F.cols(); ++f) {
+    parallel_for(0, F.cols(), [&](int f) {
         Vector3d v0 = V.col(F(0, f)), v1 = V.col(F(1, f)), v2 = V.col(F(2, f)),
         n = (v1 - v0).cross(v2 - v0);
         double norm = n.norm();
@@ -238,17 +264,14 @@ void Parametrizer::ComputeSmoothNormal() {
             n /= norm;
         }
         Nf.col(f) = n;
-    }
+    });
     
     N.resize(3, V.cols());
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < V2E.rows(); ++i) {
+    parallel_for(0, V2E.rows(), [&](int i) {
         int edge = V2E[i];
         if (nonManifold[i] || edge == -1) {
             N.col(i) = Vector3d::UnitX();
-            continue;
+            return;
         }
         
         
@@ -285,19 +308,16 @@ void Parametrizer::ComputeSmoothNormal() {
         } while (edge != stop);
         double norm = normal.norm();
         N.col(i) = norm > RCPOVERFLOW ? Vector3d(normal / norm) : Vector3d::UnitX();
-    }
+    });
 }
 
 void Parametrizer::ComputeVertexArea() {
     A.resize(V.cols());
     A.setZero();
     
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < V2E.size(); ++i) {
+    parallel_for(0, V2E.size(), [&](int i) {
         int edge = V2E[i], stop = edge;
-        if (nonManifold[i] || edge == -1) continue;
+        if (nonManifold[i] || edge == -1) return;
         double vertex_area = 0;
         do {
             int ep = dedge_prev_3(edge), en = dedge_next_3(edge);
@@ -319,19 +339,27 @@ void Parametrizer::ComputeVertexArea() {
         } while (edge != stop);
         
         A[i] = vertex_area;
-    }
+    });
 }
 
 void Parametrizer::FixValence()
 {
-    // Remove Valence 2
-    while (true) {
-        bool update = false;
-        std::vector<int> marks(V2E_compact.size(), 0);
-        std::vector<int> erasedF(F_compact.size(), 0);
-        for (int i = 0; i < V2E_compact.size(); ++i) {
+    // Remove Valence 2, revisiting only the vertices around a merge. The graph is rebuilt once
+    // the erased faces are compacted, and the changed vertices are checked again against it.
+    std::vector<int> pending(V2E_compact.size());
+    for (int i = 0; i < pending.size(); ++i) pending[i] = i;
+    while (!pending.empty()) {
+        LocalQuadGraph graph(F_compact, V2E_compact, E2E_compact, boundary_compact,
+                             nonManifold_compact);
+        std::vector<int> queued(V2E_compact.size(), 0), changed;
+        std::deque<int> worklist(pending.begin(), pending.end());
+        for (auto v : pending) queued[v] = 1;
+        while (!worklist.empty()) {
+            int i = worklist.front();
+            worklist.pop_front();
+            queued[i] = 0;
             int deid0 = V2E_compact[i];
-            if (marks[i] || deid0 == -1)
+            if (deid0 == -1)
                 continue;
             int deid = deid0;
             std::vector<int> dedges;
@@ -340,39 +368,40 @@ void Parametrizer::FixValence()
                 int deid1 = deid / 4 * 4 + (deid + 3) % 4;
                 deid = E2E_compact[deid1];
             } while (deid != deid0 && deid != -1);
-            if (dedges.size() == 2) {
-                int v1 = F_compact[dedges[0]/4][(dedges[0] + 1)%4];
-                int v2 = F_compact[dedges[0]/4][(dedges[0] + 2)%4];
-                int v3 = F_compact[dedges[1]/4][(dedges[1] + 1)%4];
-                int v4 = F_compact[dedges[1]/4][(dedges[1] + 2)%4];
-                if (marks[v1] || marks[v2] || marks[v3] || marks[v4])
-                    continue;
-                marks[v1] = true;
-                marks[v2] = true;
-                marks[v3] = true;
-                marks[v4] = true;
-                if (v1 == v2 || v1 == v3 || v1 == v4 || v2 == v3 || v2 == v4 || v3 == v4) {
-                    erasedF[dedges[0]/4] = 1;
-                } else {
-                    F_compact[dedges[0]/4] = Vector4i(v1, v2, v3, v4);
-                }
-                erasedF[dedges[1]/4] = 1;
-                update = true;
+            if (dedges.size() != 2)
+                continue;
+            int v1 = F_compact[dedges[0]/4][(dedges[0] + 1)%4];
+            int v2 = F_compact[dedges[0]/4][(dedges[0] + 2)%4];
+            int v3 = F_compact[dedges[1]/4][(dedges[1] + 1)%4];
+            int v4 = F_compact[dedges[1]/4][(dedges[1] + 2)%4];
+            if (v1 == v2 || v1 == v3 || v1 == v4 || v2 == v3 || v2 == v4 || v3 == v4) {
+                graph.erase_face(dedges[0]/4);
+            } else {
+                graph.set_face(dedges[0]/4, Vector4i(v1, v2, v3, v4));
             }
-        }
-        if (update) {
-            int top = 0;
-            for (int i = 0; i < erasedF.size(); ++i) {
-                if (erasedF[i] == 0) {
-                    F_compact[top++] = F_compact[i];
+            graph.erase_face(dedges[1]/4);
+            for (auto v : graph.update()) {
+                changed.push_back(v);
+                if (!queued[v]) {
+                    queued[v] = 1;
+                    worklist.push_back(v);
                 }
             }
-            F_compact.resize(top);
-            compute_direct_graph_quad(O_compact, F_compact, V2E_compact, E2E_compact, boundary_compact,
-                                      nonManifold_compact);
-        } else {
+        }
+        if (changed.empty())
             break;
+        int top = 0;
+        for (int i = 0; i < F_compact.size(); ++i) {
+            if (!graph.erased(i)) {
+                F_compact[top++] = F_compact[i];
+            }
         }
+        F_compact.resize(top);
+        compute_direct_graph_quad(O_compact, F_compact, V2E_compact, E2E_compact, boundary_compact,
+                                  nonManifold_compact);
+        std::sort(changed.begin(), changed.end());
+        changed.erase(std::unique(changed.begin(), changed.end()), changed.end());
+        pending.swap(changed);
     }
     std::vector<std::vector<int> > v_dedges(V2E_compact.size());
     for (int i = 0; i < F_compact.size(); ++i) {
@@ -421,15 +450,14 @@ void Parametrizer::FixValence()
     compute_direct_graph_quad(O_compact, F_compact, V2E_compact, E2E_compact, boundary_compact,
                               nonManifold_compact);
     
-    // Decrease Valence
-    while (true) {
-        bool update = false;
-        std::vector<int> marks(V2E_compact.size(), 0);
-        std::vector<int> valences(V2E_compact.size(), 0);
-        for (int i = 0; i < V2E_compact.size(); ++i) {
+    // Decrease Valence, queueing the vertices whose valence changed after each split
+    {
+        LocalQuadGraph graph(F_compact, V2E_compact, E2E_compact, boundary_compact,
+                             nonManifold_compact);
+        auto valence = [&](int i) {
             int deid0 = V2E_compact[i];
             if (deid0 == -1)
-                continue;
+                return 0;
             int deid = deid0;
             int count = 0;
             do {
@@ -443,38 +471,33 @@ void Parametrizer::FixValence()
             } while (deid != deid0 && deid != -1);
             if (deid == -1)
                 count += 1;
-            valences[i] = count;
-        }
+            return count;
+        };
         std::priority_queue<std::pair<int, int> > prior_queue;
-        for (int i = 0; i < valences.size(); ++i) {
-            if (valences[i] > 5)
-                prior_queue.push(std::make_pair(valences[i], i));
+        for (int i = 0; i < V2E_compact.size(); ++i) {
+            int count = valence(i);
+            if (count > 5)
+                prior_queue.push(std::make_pair(count, i));
         }
         while (!prior_queue.empty()) {
             auto info = prior_queue.top();
             prior_queue.pop();
-            if (marks[info.second])
+            if (valence(info.second) != info.first)
                 continue;
             int deid0 = V2E_compact[info.second];
-            if (deid0 == -1)
-                continue;
             int deid = deid0;
-            std::vector<int> loop_vertices, loop_dedges;;
-            bool marked = false;
+            std::vector<int> loop_vertices, loop_dedges;
             do {
                 int v = F_compact[deid/4][(deid+1)%4];
                 loop_dedges.push_back(deid);
                 loop_vertices.push_back(v);
-                if (marks[v])
-                    marked = true;
                 int deid1 = E2E_compact[deid];
                 if (deid1 == -1)
                     break;
                 deid = deid1 / 4 * 4 + (deid1 + 1) % 4;
             } while (deid != deid0 && deid != -1);
-            if (marked)
-                continue;
 
+            int split = O_compact.size();
             if (deid != -1) {
                 int step = (info.first + 1) / 2;
                 std::pair<int, int> min_val(0x7fffffff, 0x7fffffff);
@@ -482,8 +505,8 @@ void Parametrizer::FixValence()
                 for (int i = 0; i < loop_vertices.size(); ++i) {
                     if (i + step >= loop_vertices.size())
                         continue;
-                    int v1 = valences[loop_vertices[i]];
-                    int v2 = valences[loop_vertices[i + step]];
+                    int v1 = valence(loop_vertices[i]);
+                    int v2 = valence(loop_vertices[i + step]);
                     if (v1 < v2)
                         std::swap(v1, v2);
                     auto key = std::make_pair(v1, v2);
@@ -494,31 +517,30 @@ void Parametrizer::FixValence()
                 }
                 if (min_val.first >= info.first)
                     continue;
-                update = true;
+                graph.add_vertex();
                 for (int id = split_idx; id < split_idx + step; ++id) {
-                    F_compact[loop_dedges[id]/4][loop_dedges[id]%4] = O_compact.size();
+                    Vector4i face = F_compact[loop_dedges[id]/4];
+                    face[loop_dedges[id]%4] = split;
+                    graph.set_face(loop_dedges[id]/4, face);
                 }
-                F_compact.push_back(Vector4i(O_compact.size(), loop_vertices[(split_idx+loop_vertices.size()-1)%loop_vertices.size()],info.second, loop_vertices[(split_idx + step - 1 + loop_vertices.size()) % loop_vertices.size()]));
+                graph.set_face(F_compact.size(), Vector4i(split, loop_vertices[(split_idx+loop_vertices.size()-1)%loop_vertices.size()],info.second, loop_vertices[(split_idx + step - 1 + loop_vertices.size()) % loop_vertices.size()]));
             } else {
+                graph.add_vertex();
                 for (int id = loop_vertices.size() / 2; id < loop_vertices.size(); ++id) {
-                    F_compact[loop_dedges[id]/4][loop_dedges[id]%4] = O_compact.size();
+                    Vector4i face = F_compact[loop_dedges[id]/4];
+                    face[loop_dedges[id]%4] = split;
+                    graph.set_face(loop_dedges[id]/4, face);
                 }
-                update = true;
-            }
-            marks[info.second] = 1;
-            for (int i = 0; i < loop_vertices.size(); ++i) {
-                marks[loop_vertices[i]] = 1;
             }
             Vset.push_back(Vset[info.second]);
             O_compact.push_back(O_compact[info.second]);
             N_compact.push_back(N_compact[info.second]);
             Q_compact.push_back(Q_compact[info.second]);
-        }
-        if (!update) {
-            break;
-        } else {
-            compute_direct_graph_quad(O_compact, F_compact, V2E_compact, E2E_compact, boundary_compact,
-                                      nonManifold_compact);
+            for (auto v : graph.update()) {
+                int count = valence(v);
+                if (count > 5)
+                    prior_queue.push(std::make_pair(count, v));
+            }
         }
     }
     // Remove Zero Valence
@@ -598,6 +620,67 @@ void Parametrizer::FixValence()
     return;
 }
 
+void Parametrizer::SplitComponents(std::vector<Parametrizer>& components) {
+    VectorXi V2E_all, E2E_all, boundary_all, nonManifold_all;
+    while (!compute_direct_graph(V, F, V2E_all, E2E_all, boundary_all, nonManifold_all))
+        ;
+    DisajointTree face_tree(F.cols());
+    face_tree.BuildCompactParallel(F.cols() * 3, [&](int e, int& f0, int& f1) {
+        f0 = e / 3;
+        f1 = E2E_all[e] / 3;
+        return E2E_all[e] != -1;
+    });
+    int num_components = face_tree.CompactNum();
+    std::vector<int> offsets(num_components + 1, 0), faces(F.cols());
+    for (int f = 0; f < F.cols(); ++f) offsets[face_tree.Index(f) + 1] += 1;
+    for (int c = 0; c < num_components; ++c) offsets[c + 1] += offsets[c];
+    std::vector<int> position(offsets.begin(), offsets.end() - 1);
+    for (int f = 0; f < F.cols(); ++f) faces[position[face_tree.Index(f)]++] = f;
+
+    // the components copy the settings only
+    MatrixXd V_all;
+    MatrixXi F_all;
+    V.swap(V_all);
+    F.swap(F_all);
+    components.assign(num_components, *this);
+    V.swap(V_all);
+    F.swap(F_all);
+
+    parallel_for(0, num_components, [&](int c) {
+        Parametrizer& component = components[c];
+        std::vector<int> vertices;
+        for (int i = offsets[c]; i < offsets[c + 1]; ++i) {
+            for (int j = 0; j < 3; ++j) vertices.push_back(F(j, faces[i]));
+        }
+        std::sort(vertices.begin(), vertices.end());
+        vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+        component.V.resize(3, vertices.size());
+        for (int i = 0; i < vertices.size(); ++i) component.V.col(i) = V.col(vertices[i]);
+        component.F.resize(3, offsets[c + 1] - offsets[c]);
+        for (int i = offsets[c]; i < offsets[c + 1]; ++i) {
+            for (int j = 0; j < 3; ++j) {
+                component.F(j, i - offsets[c]) =
+                    std::lower_bound(vertices.begin(), vertices.end(), F(j, faces[i])) -
+                    vertices.begin();
+            }
+        }
+        component.NormalizeMesh();
+        component.normalize_offset =
+            component.normalize_offset * normalize_scale + normalize_offset;
+        component.normalize_scale *= normalize_scale;
+    }, 1);
+}
+
+void Parametrizer::MergeQuadMesh(const Parametrizer& component) {
+    int offset = O_compact.size();
+    for (auto& p : component.O_compact) {
+        O_compact.push_back(
+            (p * component.normalize_scale + component.normalize_offset - normalize_offset) /
+            normalize_scale);
+    }
+    for (auto& f : component.F_compact) F_compact.push_back(f + Vector4i::Constant(offset));
+}
+
 void Parametrizer::OutputMesh(const char* obj_name) {
     std::ofstream os(obj_name);
     for (int i = 0; i < O_compact.size(); ++i) {
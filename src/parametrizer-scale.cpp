@@ -1,4 +1,5 @@
 #include "parametrizer.hpp"
+#include "parallel.hpp"
 
 namespace qflow {
 
@@ -7,22 +8,14 @@ void Parametrizer::ComputeInverseAffine()
     if (flag_adaptive_scale == 0)
         return;
     triangle_space.resize(F.cols());
-#ifdef WITH_OMP
-#pragma omp parallel for
-#endif
-    for (int i = 0; i < F.cols(); ++i) {
+    parallel_for(0, F.cols(), [&](int i) {
         Matrix3d p, q;
         p.col(0) = V.col(F(1, i)) - V.col(F(0, i));
         p.col(1) = V.col(F(2, i)) - V.col(F(0, i));
         p.col(2) = Nf.col(i);
         q = p.inverse();
-        triangle_space[i].resize(2, 3);
-        for (int j = 0; j < 2; ++j) {
-            for (int k = 0; k < 3; ++k) {
-                triangle_space[i](j, k) = q(j, k);
-            }
-        }
-    }
+        triangle_space[i] = q.topRows<2>();
+    });
 }
 
 void Parametrizer::EstimateSlope() {
@@ -32,7 +25,7 @@ void Parametrizer::EstimateSlope() {
     auto& mV = hierarchy.mV[0];
     FS.resize(2, mF.cols());
     FQ.resize(3, mF.cols());
-    for (int i = 0; i < mF.cols(); ++i) {
+    parallel_for(0, mF.cols(), [&](int i) {
         const Vector3d& n = Nf.col(i);
         const Vector3d &q_1 = mQ.col(mF(0, i)), &q_2 = mQ.col(mF(1, i)), &q_3 = mQ.col(mF(2, i));
         const Vector3d &n_1 = mN.col(mF(0, i)), &n_2 = mN.col(mF(1, i)), &n_3 = mN.col(mF(2, i));
@@ -46,8 +39,9 @@ void Parametrizer::EstimateSlope() {
         q = (p.first * 2 + p.second);
         q = q - n * q.dot(n);
         FQ.col(i) = q.normalized();
-    }
-    for (int i = 0; i < mF.cols(); ++i) {
+    });
+    // every face traces its own geodesic steps and only writes its own column
+    parallel_for(0, mF.cols(), [&](int i) {
         double step = hierarchy.mScale * 1.f;
         
         const Vector3d &n = Nf.col(i);
@@ -73,13 +67,15 @@ void Parametrizer::EstimateSlope() {
         double dSx = (q_yr_unfold - q_yl_unfold).dot(q_x) / (2.0f * step);
         double dSy = (q_xr_unfold - q_xl_unfold).dot(q_y) / (2.0f * step);
         FS.col(i) = Vector2d(dSx, dSy);
-    }
-    
-    std::vector<double> areas(mV.cols(), 0.0);
-    for (int i = 0; i < mF.cols(); ++i) {
+    });
+
+    // the slopes are rotated into the vertex frames in parallel and summed in face order
+    std::vector<double> face_areas(mF.cols());
+    std::vector<Vector2d> corner_slopes(mF.cols() * 3);
+    parallel_for(0, mF.cols(), [&](int i) {
         Vector3d p1 = mV.col(mF(1, i)) - mV.col(mF(0, i));
         Vector3d p2 = mV.col(mF(2, i)) - mV.col(mF(0, i));
-        double area = p1.cross(p2).norm();
+        face_areas[i] = p1.cross(p2).norm();
         for (int j = 0; j < 3; ++j) {
             auto index = compat_orientation_extrinsic_index_4(FQ.col(i), Nf.col(i), mQ.col(mF(j, i)), mN.col(mF(j, i)));
             double scaleX = FS.col(i).x(), scaleY = FS.col(i).y();
@@ -90,7 +86,15 @@ void Parametrizer::EstimateSlope() {
                 scaleX = -scaleX;
                 scaleY = -scaleY;
             }
-            hierarchy.mK[0].col(mF(j, i)) += area * Vector2d(scaleX, scaleY);
+            corner_slopes[i * 3 + j] = Vector2d(scaleX, scaleY);
+        }
+    });
+    std::vector<double> areas(mV.cols(), 0.0);
+    hierarchy.mK[0].setZero();
+    for (int i = 0; i < mF.cols(); ++i) {
+        double area = face_areas[i];
+        for (int j = 0; j < 3; ++j) {
+            hierarchy.mK[0].col(mF(j, i)) += area * corner_slopes[i * 3 + j];
             areas[mF(j, i)] += area;
         }
     }
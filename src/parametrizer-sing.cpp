@@ -1,5 +1,6 @@
 #include "config.hpp"
 #include "field-math.hpp"
+#include "parallel.hpp"
 #include "parametrizer.hpp"
 
 namespace qflow {
@@ -7,25 +8,35 @@ namespace qflow {
 void Parametrizer::ComputeOrientationSingularities() {
     MatrixXd &N = hierarchy.mN[0], &Q = hierarchy.mQ[0];
     const MatrixXi& F = hierarchy.mF;
-    singularities.clear();
-    for (int f = 0; f < F.cols(); ++f) {
+    auto face_index = [&](int f) {
         int index = 0;
-        int abs_index = 0;
         for (int k = 0; k < 3; ++k) {
             int i = F(k, f), j = F(k == 2 ? 0 : (k + 1), f);
             auto value =
                 compat_orientation_extrinsic_index_4(Q.col(i), N.col(i), Q.col(j), N.col(j));
             index += value.second - value.first;
-            abs_index += std::abs(value.second - value.first);
         }
+        return index;
+    };
+    std::vector<int> indices(F.cols());
+    parallel_for(0, F.cols(), [&](int f) { indices[f] = face_index(f); });
+    // flipping the first vertex of a face changes the indices of the faces after it, which are
+    // recomputed in face order
+    std::vector<char> flipped(Q.cols(), 0);
+    singularities.resize(F.cols());
+    for (int f = 0; f < F.cols(); ++f) {
+        int index = indices[f];
+        if (flipped[F(0, f)] || flipped[F(1, f)] || flipped[F(2, f)]) index = face_index(f);
         int index_mod = modulo(index, 4);
         if (index_mod == 1 || index_mod == 3) {
             if (index >= 4 || index < 0) {
                 Q.col(F(0, f)) = -Q.col(F(0, f));
+                flipped[F(0, f)] = 1;
             }
-            singularities[f] = index_mod;
+            singularities.set(f, index_mod);
         }
     }
+    singularities.compact();
 }
 
 void Parametrizer::ComputePositionSingularities() {
@@ -33,10 +44,10 @@ void Parametrizer::ComputePositionSingularities() {
                    &O = hierarchy.mO[0];
     const MatrixXi& F = hierarchy.mF;
 
-    pos_sing.clear();
+    pos_sing.resize(F.cols());
     pos_rank.resize(F.rows(), F.cols());
     pos_index.resize(6, F.cols());
-    for (int f = 0; f < F.cols(); ++f) {
+    parallel_for(0, F.cols(), [&](int f) {
         Vector2i index = Vector2i::Zero();
         uint32_t i0 = F(0, f), i1 = F(1, f), i2 = F(2, f);
 
@@ -45,15 +56,28 @@ void Parametrizer::ComputePositionSingularities() {
         Vector3d o[3] = {O.col(i0), O.col(i1), O.col(i2)};
         Vector3d v[3] = {V.col(i0), V.col(i1), V.col(i2)};
 
+        // rotate90_by(q, n, r) is +-q or +-n x q, so the dot products of all 4 x 4 x 4 rotations
+        // are signed copies of four products per edge
+        Vector3d t[3] = {n[0].cross(q[0]), n[1].cross(q[1]), n[2].cross(q[2])};
+        double dots[3][2][2];
+        for (int k = 0; k < 3; ++k) {
+            int kn = k == 2 ? 0 : (k + 1);
+            dots[k][0][0] = q[k].dot(q[kn]);
+            dots[k][0][1] = q[k].dot(t[kn]);
+            dots[k][1][0] = t[k].dot(q[kn]);
+            dots[k][1][1] = t[k].dot(t[kn]);
+        }
+        auto dot = [&](int k, int r, int rn) {
+            double d = dots[k][r & 1][rn & 1];
+            return (r < 2) == (rn < 2) ? d : -d;
+        };
         int best[3];
         double best_dp = -std::numeric_limits<double>::infinity();
         for (int i = 0; i < 4; ++i) {
-            Vector3d v0 = rotate90_by(q[0], n[0], i);
             for (int j = 0; j < 4; ++j) {
-                Vector3d v1 = rotate90_by(q[1], n[1], j);
+                double dp01 = dot(0, i, j);
                 for (int k = 0; k < 4; ++k) {
-                    Vector3d v2 = rotate90_by(q[2], n[2], k);
-                    double dp = std::min(std::min(v0.dot(v1), v1.dot(v2)), v2.dot(v0));
+                    double dp = std::min(std::min(dp01, dot(1, j, k)), dot(2, k, i));
                     if (dp > best_dp) {
                         best_dp = dp;
                         best[0] = i;
@@ -92,17 +116,18 @@ void Parametrizer::ComputePositionSingularities() {
         }
 
         if (index != Vector2i::Zero()) {
-            pos_sing[f] = rshift90(index, best[0]);
+            pos_sing.set(f, rshift90(index, best[0]));
         }
-    }
+    });
+    pos_sing.compact();
 }
 
 void Parametrizer::AnalyzeValence() {
     auto& F = hierarchy.mF;
     std::map<int, int> sing;
-    for (auto& f : singularities) {
+    for (int f : singularities.faces()) {
         for (int i = 0; i < 3; ++i) {
-            sing[F(i, f.first)] = f.second;
+            sing[F(i, f)] = singularities[f];
         }
     }
     auto& F2E = face_edgeIds;
@@ -129,8 +154,8 @@ void Parametrizer::AnalyzeValence() {
         }
     }
     int count3 = 0, count4 = 0;
-    for (auto& s : singularities) {
-        if (s.second == 1)
+    for (int f : singularities.faces()) {
+        if (singularities[f] == 1)
             count3 += 1;
         else
             count4 += 1;
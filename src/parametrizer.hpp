@@ -2,9 +2,6 @@
 #define PARAMETRIZER_H_
 #include <atomic>
 #include <condition_variable>
-#ifdef WITH_TBB
-#include <tbb/tbb.h>
-#endif
 
 #include <Eigen/Core>
 #include <Eigen/Dense>
@@ -14,10 +11,14 @@
 #include <unordered_set>
 #include "adjacent-matrix.hpp"
 #include "disajoint-tree.hpp"
+#include "edge-hash.hpp"
+#include "edge-ranks.hpp"
 #include "field-math.hpp"
 #include "hierarchy.hpp"
+#include "packed-array.hpp"
 #include "post-solver.hpp"
 #include "serialize.hpp"
+#include "singularity.hpp"
 
 namespace qflow {
 
@@ -47,6 +48,9 @@ class Parametrizer {
     void ComputeSharpO();
     void ComputeVertexArea();
     void Initialize(int faces);
+    // Retargets an initialized mesh to another face count; the orientation field is kept and the
+    // slopes of -adaptive are estimated again
+    void SetTargetFaces(int faces);
 
     // Singularity and Mesh property
     void AnalyzeValence();
@@ -61,24 +65,34 @@ class Parametrizer {
     void BuildIntegerConstraints();
 
     // Fix Flip
+    void BuildEdgeHierarchy();
     void FixFlipHierarchy();
     void FixFlipSat();
     void FixHoles();
     void FixHoles(std::vector<int>& loop_vertices);
+    void FixHoles(std::vector<std::vector<int>>& loops);
     void FixValence();
+    // Quad tiling of a loop with the least corner angle energy, by dynamic programming over the
+    // sub-loops cut off by chords. |energy| and |split| are scratch tables reused across calls.
     double QuadEnergy(std::vector<int>& loop_vertices, std::vector<Vector4i>& res_quads,
-                      int level);
+                      std::vector<double>& energy, std::vector<int>& split);
 
     // Quadmesh and IO
     void AdvancedExtractQuad();
     void BuildTriangleManifold(DisajointTree& disajoint_tree, std::vector<int>& edge,
                                std::vector<int>& face, std::vector<DEdge>& edge_values,
                                std::vector<Vector3i>& F2E, std::vector<Vector2i>& E2F,
-                               std::vector<Vector2i>& EdgeDiff, std::vector<Vector3i>& FQ);
+                               DiffArray& EdgeDiff, OrientArray& FQ);
     void OutputMesh(const char* obj_name);
-
-    std::map<int, int> singularities;  // map faceid to valence (1 (valence=3) or 3(valence=5))
-    std::map<int, Vector2i> pos_sing;
+    // Splits the loaded mesh into its edge-connected components, ordered by their first face. Each
+    // component has the settings of this one and its own normalization, which maps to the
+    // coordinates of the input.
+    void SplitComponents(std::vector<Parametrizer>& components);
+    // Appends the quad mesh of |component| to this one
+    void MergeQuadMesh(const Parametrizer& component);
+
+    FaceSingularities<int> singularities;  // face valence index (1 (valence=3) or 3(valence=5))
+    FaceSingularities<Vector2i> pos_sing;
     MatrixXi pos_rank;   // pos_rank(i, j) i \in [0, 3) jth face ith vertex  rotate by its value so
                          // that all thress vertices are in the same orientation
     MatrixXi pos_index;  // pos_index(i x 2 + dim, j) i \in [0, 6) jth face ith vertex's
@@ -90,6 +104,9 @@ class Parametrizer {
     MatrixXd FS;
     MatrixXd FQ;
     MatrixXi F;
+    // the input before Initialize decimated it, empty otherwise
+    MatrixXd V_input;
+    MatrixXi F_input;
 
     double normalize_scale;
     Vector3d normalize_offset;
@@ -102,6 +119,9 @@ class Parametrizer {
     VectorXi nonManifold;  // nonManifold vertices, in boolean
     AdjacentMatrix adj;
     Hierarchy hierarchy;
+    // Coarsened edge graph of the integer stage, rebuilt by FixFlipHierarchy, FixFlipSat and
+    // AdvancedExtractQuad from the current offsets
+    Hierarchy edge_hierarchy;
 
     // Mesh Status;
     double surface_area;
@@ -119,7 +139,7 @@ class Parametrizer {
     std::vector<Vector3d> Q_compact;
     std::vector<Vector3d> N_compact;
     std::vector<Vector4i> F_compact;
-    std::set<std::pair<int, int>> Quad_edges;
+    EdgeHashMap Quad_edges;
     std::vector<int> V2E_compact;
     std::vector<int> E2E_compact;
     VectorXi boundary_compact;
@@ -127,20 +147,21 @@ class Parametrizer {
 
     std::vector<int> bad_vertices;
     std::vector<double> counter;
-    std::vector<int>
-        sharp_edges;  // sharp_edges[deid]: whether deid is a sharp edge that should be preserved
-    std::vector<int> allow_changes;   // allow_changes[variable_id]: whether var can be changed
-                                      // based on sharp edges
-    std::vector<Vector2i> edge_diff;  // edge_diff[edgeIds[i](j)]:  t_ij+t_ji under
-                                      // edge_values[edgeIds[i](j)].x's Q value
-    std::vector<DEdge> edge_values;   // see above
+    BitArray sharp_edges;            // sharp_edges[deid]: whether deid is a sharp edge that should
+                                     // be preserved
+    BitArray allow_changes;          // allow_changes[variable_id]: whether var can be changed
+                                     // based on sharp edges
+    DiffArray edge_diff;             // edge_diff[edgeIds[i](j)]:  t_ij+t_ji under
+                                     // edge_values[edgeIds[i](j)].x's Q value
+    std::vector<DEdge> edge_values;  // see above
+    EdgeRanks edge_ranks;            // edge_ranks[e]: Q rotation from edge_values[e].x to .y
     std::vector<Vector3i>
         face_edgeIds;  // face_edgeIds[i](j): ith face jth edge's "undirected edge ID"
 
     // face_edgeOrients[i](j): Rotate from edge_diff space
     //    (a) initially, to F(0, i)'s Q space
     //    (b) later on, to a global Q space where some edges are fixed
-    std::vector<Vector3i> face_edgeOrients;
+    OrientArray face_edgeOrients;
 
     // variable[i].first: indices of the two equations corresponding to variable i
     // variable[i].second: number of positive minus negative of variables' occurances
@@ -158,7 +179,7 @@ class Parametrizer {
     // scale
     void ComputeInverseAffine();
     void EstimateSlope();
-    std::vector<MatrixXd> triangle_space;
+    TriangleSpaces triangle_space;
 
     // flag
     int flag_preserve_sharp = 0;
@@ -166,6 +187,7 @@ class Parametrizer {
     int flag_adaptive_scale = 0;
     int flag_aggresive_sat = 0;
     int flag_minimum_cost_flow = 0;
+    int flag_decimate = 0;
 };
 
 extern void generate_adjacency_matrix_uniform(const MatrixXi& F, const VectorXi& V2E,
@@ -0,0 +1,47 @@
+#ifndef SINGULARITY_H_
+#define SINGULARITY_H_
+
+#include <vector>
+
+namespace qflow {
+
+// Values on the singular faces of a mesh. They are stored per face, so that faces can be set in
+// parallel, and compact() lists the singular faces in increasing order. Faces past the end are
+// regular.
+template <class T>
+class FaceSingularities {
+   public:
+    // Marks all |num_faces| faces regular
+    void resize(int num_faces) {
+        flags.assign(num_faces, 0);
+        values.resize(num_faces);
+        singular_faces.clear();
+    }
+    void clear() { resize(0); }
+
+    // Safe to call concurrently for different faces; compact() must follow
+    void set(int f, const T& value) {
+        flags[f] = 1;
+        values[f] = value;
+    }
+    void compact() {
+        singular_faces.clear();
+        for (int f = 0; f < flags.size(); ++f) {
+            if (flags[f]) singular_faces.push_back(f);
+        }
+    }
+
+    bool count(int f) const { return f < flags.size() && flags[f]; }
+    const T& operator[](int f) const { return values[f]; }
+    const std::vector<int>& faces() const { return singular_faces; }
+    int size() const { return singular_faces.size(); }
+
+   private:
+    std::vector<char> flags;
+    std::vector<T> values;
+    std::vector<int> singular_faces;
+};
+
+} // namespace qflow
+
+#endif
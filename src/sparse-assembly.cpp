@@ -0,0 +1,63 @@
+#include "sparse-assembly.hpp"
+
+#include "config.hpp"
+#include "parallel.hpp"
+
+namespace qflow {
+
+void SparseAssembly::analyze(int rows, int cols, const std::vector<int>& slot_rows,
+                             const std::vector<int>& slot_cols) {
+    this->rows = rows;
+    this->cols = cols;
+    int num = slot_rows.size();
+
+    // counting sort by row keeps the slots of a row in slot order, then each row is stably
+    // sorted by column
+    std::vector<int> row_slots(rows + 1, 0);
+    for (int i = 0; i < num; ++i) row_slots[slot_rows[i] + 1] += 1;
+    for (int r = 0; r < rows; ++r) row_slots[r + 1] += row_slots[r];
+    slots.resize(num);
+    std::vector<int> fill(row_slots.begin(), row_slots.end() - 1);
+    for (int i = 0; i < num; ++i) slots[fill[slot_rows[i]]++] = i;
+
+    outer.assign(rows + 1, 0);
+    parallel_for(0, rows, [&](int r) {
+        auto begin = slots.begin() + row_slots[r], end = slots.begin() + row_slots[r + 1];
+        std::stable_sort(begin, end, [&](int a, int b) { return slot_cols[a] < slot_cols[b]; });
+        for (auto it = begin; it != end; ++it) {
+            if (it == begin || slot_cols[*it] != slot_cols[*(it - 1)]) outer[r + 1] += 1;
+        }
+    });
+    for (int r = 0; r < rows; ++r) outer[r + 1] += outer[r];
+
+    inner.resize(outer[rows]);
+    entry_slots.resize(outer[rows] + 1);
+    parallel_for(0, rows, [&](int r) {
+        int k = outer[r];
+        for (int s = row_slots[r]; s < row_slots[r + 1]; ++s) {
+            if (s == row_slots[r] || slot_cols[slots[s]] != slot_cols[slots[s - 1]]) {
+                inner[k] = slot_cols[slots[s]];
+                entry_slots[k++] = s;
+            }
+        }
+    });
+    entry_slots[outer[rows]] = num;
+}
+
+void SparseAssembly::assemble(const std::vector<double>& slot_values, Matrix& A) const {
+    if (A.rows() != rows || A.cols() != cols || A.nonZeros() != inner.size() ||
+        !A.isCompressed() || !std::equal(outer.begin(), outer.end(), A.outerIndexPtr()) ||
+        !std::equal(inner.begin(), inner.end(), A.innerIndexPtr())) {
+        std::vector<double> zeros(inner.size(), 0.0);
+        A = Eigen::Map<const Matrix>(rows, cols, inner.size(), outer.data(), inner.data(),
+                                     zeros.data());
+    }
+    double* values = A.valuePtr();
+    parallel_for(0, inner.size(), [&](int k) {
+        double sum = 0;
+        for (int s = entry_slots[k]; s < entry_slots[k + 1]; ++s) sum += slot_values[slots[s]];
+        values[k] = sum;
+    });
+}
+
+} // namespace qflow
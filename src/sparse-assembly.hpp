@@ -0,0 +1,34 @@
+#ifndef SPARSE_ASSEMBLY_H_
+#define SPARSE_ASSEMBLY_H_
+
+#include <Eigen/Sparse>
+#include <vector>
+
+namespace qflow {
+
+// Assembles a sparse matrix from a fixed list of slots, each adding one value to entry
+// (row, col). analyze() sorts the slots into a CSR pattern once; assemble() then only sums the
+// slot values of each entry, in slot order, so refilling the same pattern is cheap and the result
+// does not depend on the thread count.
+class SparseAssembly {
+   public:
+    typedef Eigen::SparseMatrix<double, Eigen::RowMajor> Matrix;
+
+    void analyze(int rows, int cols, const std::vector<int>& slot_rows,
+                 const std::vector<int>& slot_cols);
+    // Writes the values into |A|, which receives the pattern if it does not have it yet
+    void assemble(const std::vector<double>& slot_values, Matrix& A) const;
+
+    int num_slots() const { return slots.size(); }
+    int num_entries() const { return inner.size(); }
+
+   private:
+    int rows = 0, cols = 0;
+    std::vector<int> outer, inner;  // CSR pattern
+    std::vector<int> slots;         // slot indices grouped by entry
+    std::vector<int> entry_slots;   // slots of entry k are slots[entry_slots[k], entry_slots[k+1])
+};
+
+} // namespace qflow
+
+#endif
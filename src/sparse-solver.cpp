@@ -0,0 +1,316 @@
+#include "sparse-solver.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+#include "config.hpp"
+#include "parallel.hpp"
+
+namespace qflow {
+
+using Eigen::VectorXd;
+
+// Vertices are strongly coupled if |A_ij| >= STRENGTH * sqrt(|A_ii| |A_jj|) for their 2x2 blocks
+static const double STRENGTH = 0.08;
+static const int MAX_COARSEST_SIZE = 256;
+static const int MAX_DENSE_SIZE = 1024;
+static const int SMOOTHING_SWEEPS = 2;
+
+static double dot(const VectorXd& a, const VectorXd& b) {
+    return parallel_reduce(
+        0, a.size(), GRAIN_SIZE * 4, 0.0,
+        [&](int begin, int end) {
+            return a.segment(begin, end - begin).dot(b.segment(begin, end - begin));
+        },
+        [](double x, double y) { return x + y; });
+}
+
+void sparse_multiply(const SparseAssembly::Matrix& A, const VectorXd& x, VectorXd& y) {
+    y.resize(A.rows());
+    const int* outer = A.outerIndexPtr();
+    const int* inner = A.innerIndexPtr();
+    const double* values = A.valuePtr();
+    parallel_for(0, A.rows(), [&](int i) {
+        double sum = 0;
+        for (int k = outer[i]; k < outer[i + 1]; ++k) sum += values[k] * x[inner[k]];
+        y[i] = sum;
+    });
+}
+
+// Closest rotation (or reflection) to |m|
+static Eigen::Matrix2d nearest_orthogonal(const Eigen::Matrix2d& m) {
+    Eigen::JacobiSVD<Eigen::Matrix2d> svd(m, Eigen::ComputeFullU | Eigen::ComputeFullV);
+    return svd.matrixU() * svd.matrixV().transpose();
+}
+
+struct Coupling {
+    int vertex;
+    Eigen::Matrix2d block;  // rows of this vertex, columns of |vertex|
+};
+
+// Groups the vertices into aggregates: first a vertex with no aggregated strong neighbor seeds
+// an aggregate with all of them, then the remaining vertices join a neighboring aggregate or
+// form their own. |parent| is the neighbor each vertex aligns its frame with (-1 for the roots).
+// Returns the number of aggregates.
+static int build_aggregates(const SparseAssembly::Matrix& A, std::vector<int>& aggregate,
+                            std::vector<int>& parent) {
+    int num_vertices = A.rows() / 2;
+    std::vector<std::vector<Coupling>> strong(num_vertices);
+    std::vector<double> diagonal(num_vertices);
+    parallel_for(0, num_vertices, [&](int a) {
+        auto& couplings = strong[a];
+        for (int k = 0; k < 2; ++k) {
+            for (SparseAssembly::Matrix::InnerIterator it(A, a * 2 + k); it; ++it) {
+                int b = it.col() / 2, c = 0;
+                while (c < couplings.size() && couplings[c].vertex != b) ++c;
+                if (c == couplings.size())
+                    couplings.push_back(Coupling{b, Eigen::Matrix2d::Zero()});
+                couplings[c].block(k, it.col() % 2) = it.value();
+            }
+        }
+        for (auto& c : couplings) {
+            if (c.vertex == a) diagonal[a] = c.block.norm();
+        }
+    });
+    parallel_for(0, num_vertices, [&](int a) {
+        auto& couplings = strong[a];
+        auto weak = [&](const Coupling& c) {
+            return c.vertex == a ||
+                   c.block.norm() < STRENGTH * std::sqrt(diagonal[a] * diagonal[c.vertex]);
+        };
+        couplings.erase(std::remove_if(couplings.begin(), couplings.end(), weak), couplings.end());
+    });
+
+    aggregate.assign(num_vertices, -1);
+    parent.assign(num_vertices, -1);
+    int num_aggregates = 0;
+    for (int a = 0; a < num_vertices; ++a) {
+        if (aggregate[a] != -1 || strong[a].empty()) continue;
+        bool free = true;
+        for (auto& c : strong[a]) free = free && aggregate[c.vertex] == -1;
+        if (!free) continue;
+        aggregate[a] = num_aggregates;
+        for (auto& c : strong[a]) {
+            aggregate[c.vertex] = num_aggregates;
+            parent[c.vertex] = a;
+        }
+        num_aggregates += 1;
+    }
+    std::vector<int> seeded = aggregate;
+    for (int a = 0; a < num_vertices; ++a) {
+        if (aggregate[a] != -1) continue;
+        for (auto& c : strong[a]) {
+            if (seeded[c.vertex] != -1) {
+                aggregate[a] = seeded[c.vertex];
+                parent[a] = c.vertex;
+                break;
+            }
+        }
+    }
+    for (int a = 0; a < num_vertices; ++a) {
+        if (aggregate[a] != -1) continue;
+        aggregate[a] = num_aggregates;
+        for (auto& c : strong[a]) {
+            if (aggregate[c.vertex] != -1) continue;
+            aggregate[c.vertex] = num_aggregates;
+            parent[c.vertex] = a;
+        }
+        num_aggregates += 1;
+    }
+    return num_aggregates;
+}
+
+// Block of |A| with the rows of vertex v and the columns of vertex u
+static Eigen::Matrix2d coupling_block(const SparseAssembly::Matrix& A, int v, int u) {
+    Eigen::Matrix2d block = Eigen::Matrix2d::Zero();
+    for (int k = 0; k < 2; ++k) {
+        for (SparseAssembly::Matrix::InnerIterator it(A, v * 2 + k); it; ++it) {
+            if (it.col() / 2 == u) block(k, it.col() % 2) = it.value();
+        }
+    }
+    return block;
+}
+
+// A coupling block of the position systems is close to -c R, where R maps the coordinates of one
+// frame into the other, so P_v = R(v, parent) P_parent. The frames move between the systems
+// sharing a hierarchy, so this is redone on every refresh.
+static void update_prolongation(const SparseAssembly::Matrix& A, const std::vector<int>& parent,
+                                std::vector<Eigen::Matrix2d>& prolongation) {
+    prolongation.resize(parent.size());
+    for (int depth = 0; depth < 3; ++depth) {
+        parallel_for(0, parent.size(), [&](int v) {
+            int p = parent[v];
+            if (depth != (p == -1 ? 0 : parent[p] == -1 ? 1 : 2)) return;
+            if (p == -1)
+                prolongation[v] = Eigen::Matrix2d::Identity();
+            else
+                prolongation[v] = nearest_orthogonal(-coupling_block(A, v, p)) * prolongation[p];
+        });
+    }
+}
+
+void AMGPreconditioner::assemble_coarse(int l) {
+    Level& level = *levels[l];
+    const Matrix& M = level.A;
+    std::vector<double> values(M.nonZeros() * 4);
+    update_prolongation(M, level.parent, level.prolongation);
+    const int* outer = M.outerIndexPtr();
+    const int* inner = M.innerIndexPtr();
+    const double* entries = M.valuePtr();
+    parallel_for(0, M.rows(), [&](int r) {
+        const Eigen::Matrix2d& P_r = level.prolongation[r / 2];
+        for (int k = outer[r]; k < outer[r + 1]; ++k) {
+            const Eigen::Matrix2d& P_c = level.prolongation[inner[k] / 2];
+            for (int i = 0; i < 2; ++i) {
+                for (int j = 0; j < 2; ++j)
+                    values[k * 4 + i * 2 + j] = P_r(r % 2, i) * entries[k] * P_c(inner[k] % 2, j);
+            }
+        }
+    });
+    level.galerkin.assemble(values, levels[l + 1]->A);
+}
+
+void AMGPreconditioner::setup(const Matrix& A) {
+    levels.clear();
+    levels.emplace_back(new Level());
+    levels[0]->A = A;
+    while (true) {
+        Level& level = *levels.back();
+        int n = level.A.rows();
+        if (n <= MAX_COARSEST_SIZE) break;
+        int num_coarse = build_aggregates(level.A, level.aggregate, level.parent) * 2;
+        // stop once the graph no longer coarsens
+        if (num_coarse * 10 > n * 9) {
+            level.aggregate.clear();
+            level.parent.clear();
+            break;
+        }
+        // each entry (r, c) adds P(r, i) A(r, c) P(c, j) to the coarse entry (i, j)
+        std::vector<int> slot_rows(level.A.nonZeros() * 4), slot_cols(level.A.nonZeros() * 4);
+        const int* outer = level.A.outerIndexPtr();
+        const int* inner = level.A.innerIndexPtr();
+        parallel_for(0, n, [&](int r) {
+            for (int k = outer[r]; k < outer[r + 1]; ++k) {
+                for (int i = 0; i < 2; ++i) {
+                    for (int j = 0; j < 2; ++j) {
+                        slot_rows[k * 4 + i * 2 + j] = level.aggregate[r / 2] * 2 + i;
+                        slot_cols[k * 4 + i * 2 + j] = level.aggregate[inner[k] / 2] * 2 + j;
+                    }
+                }
+            }
+        });
+        level.galerkin.analyze(num_coarse, num_coarse, slot_rows, slot_cols);
+        levels.emplace_back(new Level());
+        assemble_coarse(levels.size() - 2);
+    }
+    refresh(A);
+}
+
+void AMGPreconditioner::refresh(const Matrix& A) {
+    Matrix& fine = levels[0]->A;
+    std::copy(A.valuePtr(), A.valuePtr() + A.nonZeros(), fine.valuePtr());
+    for (int l = 0; l < levels.size(); ++l) {
+        Level& level = *levels[l];
+        const Matrix& M = level.A;
+        if (l + 1 < levels.size()) assemble_coarse(l);
+        // l1-Jacobi: converges for any SPD matrix, so the cycle stays a valid preconditioner
+        level.inv_diag.resize(M.rows());
+        parallel_for(0, M.rows(), [&](int i) {
+            double sum = 0;
+            for (Matrix::InnerIterator it(M, i); it; ++it) sum += std::abs(it.value());
+            level.inv_diag[i] = sum > 0 ? 1.0 / sum : 0.0;
+        });
+        level.x.resize(M.rows());
+        level.b.resize(M.rows());
+        level.r.resize(M.rows());
+    }
+    const Matrix& C = levels.back()->A;
+    if (C.rows() <= MAX_DENSE_SIZE) coarsest.compute(Eigen::MatrixXd(C));
+}
+
+bool AMGPreconditioner::ready(const Matrix& A) const {
+    if (levels.empty()) return false;
+    const Matrix& M = levels[0]->A;
+    return M.rows() == A.rows() && M.nonZeros() == A.nonZeros() &&
+           std::equal(A.outerIndexPtr(), A.outerIndexPtr() + A.rows() + 1, M.outerIndexPtr()) &&
+           std::equal(A.innerIndexPtr(), A.innerIndexPtr() + A.nonZeros(), M.innerIndexPtr());
+}
+
+void AMGPreconditioner::cycle(int l) const {
+    Level& level = *levels[l];
+    int n = level.A.rows();
+    if (l + 1 == levels.size() && n <= MAX_DENSE_SIZE) {
+        level.x = coarsest.solve(level.b);
+        return;
+    }
+    auto smooth = [&]() {
+        for (int sweep = 0; sweep < SMOOTHING_SWEEPS; ++sweep) {
+            sparse_multiply(level.A, level.x, level.r);
+            parallel_for(0, n, [&](int i) {
+                level.x[i] += level.inv_diag[i] * (level.b[i] - level.r[i]);
+            });
+        }
+    };
+    level.x.setZero();
+    smooth();
+    if (l + 1 == levels.size()) return;
+
+    Level& coarse = *levels[l + 1];
+    sparse_multiply(level.A, level.x, level.r);
+    coarse.b.setZero();
+    for (int a = 0; a < n / 2; ++a) {
+        Eigen::Vector2d residual = level.b.segment<2>(a * 2) - level.r.segment<2>(a * 2);
+        coarse.b.segment<2>(level.aggregate[a] * 2) +=
+            level.prolongation[a].transpose() * residual;
+    }
+    cycle(l + 1);
+    parallel_for(0, n / 2, [&](int a) {
+        level.x.segment<2>(a * 2) +=
+            level.prolongation[a] * coarse.x.segment<2>(level.aggregate[a] * 2);
+    });
+    smooth();
+}
+
+void AMGPreconditioner::apply(const VectorXd& r, VectorXd& z) const {
+    levels[0]->b = r;
+    cycle(0);
+    z = levels[0]->x;
+}
+
+int conjugate_gradient(const SparseAssembly::Matrix& A, const VectorXd& b, VectorXd& x,
+                       const AMGPreconditioner& preconditioner, double tolerance,
+                       int max_iterations, double& error) {
+    int n = b.size();
+    VectorXd r(n), z(n), p(n), Ap(n);
+    sparse_multiply(A, x, Ap);
+    parallel_for(0, n, [&](int i) { r[i] = b[i] - Ap[i]; });
+    double b_norm = std::sqrt(dot(b, b));
+    if (b_norm == 0) {
+        x.setZero();
+        error = 0;
+        return 0;
+    }
+    error = std::sqrt(dot(r, r)) / b_norm;
+    if (error < tolerance) return 0;
+    preconditioner.apply(r, z);
+    p = z;
+    double rz = dot(r, z);
+    for (int iter = 1; iter <= max_iterations; ++iter) {
+        sparse_multiply(A, p, Ap);
+        double alpha = rz / dot(p, Ap);
+        parallel_for(0, n, [&](int i) {
+            x[i] += alpha * p[i];
+            r[i] -= alpha * Ap[i];
+        });
+        error = std::sqrt(dot(r, r)) / b_norm;
+        if (error < tolerance) return iter;
+        preconditioner.apply(r, z);
+        double rz_next = dot(r, z);
+        double beta = rz_next / rz;
+        rz = rz_next;
+        parallel_for(0, n, [&](int i) { p[i] = z[i] + beta * p[i]; });
+    }
+    return max_iterations;
+}
+
+} // namespace qflow
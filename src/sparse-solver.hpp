@@ -0,0 +1,63 @@
+#ifndef SPARSE_SOLVER_H_
+#define SPARSE_SOLVER_H_
+
+#include <Eigen/Core>
+#include <Eigen/Dense>
+#include <memory>
+#include <vector>
+
+#include "sparse-assembly.hpp"
+
+namespace qflow {
+
+// Aggregation-based algebraic multigrid V-cycle, used as a preconditioner for conjugate
+// gradients on the position systems. Unknowns come in pairs (the two tangent coordinates of a
+// vertex) expressed in per-vertex frames, so each vertex joins its aggregate through the 2x2
+// rotation that aligns its frame with the aggregate root. setup() builds the aggregates and the
+// Galerkin patterns; refresh() only recomputes the rotations and the coarse operators, so a
+// sequence of systems with one sparsity pattern shares the hierarchy.
+class AMGPreconditioner {
+   public:
+    typedef SparseAssembly::Matrix Matrix;
+
+    void setup(const Matrix& A);
+    void refresh(const Matrix& A);
+    bool ready(const Matrix& A) const;
+
+    // Applies one V-cycle to |r|
+    void apply(const Eigen::VectorXd& r, Eigen::VectorXd& z) const;
+
+    int num_levels() const { return levels.size(); }
+
+   private:
+    struct Level {
+        Matrix A;
+        Eigen::VectorXd inv_diag;
+        std::vector<int> aggregate;                 // coarse vertex of each vertex
+        std::vector<int> parent;                    // neighbor whose frame a vertex follows
+        std::vector<Eigen::Matrix2d> prolongation;  // maps coarse into vertex coordinates
+        SparseAssembly galerkin;                    // coarse operator from the entries of A
+        mutable Eigen::VectorXd x, b, r;
+    };
+    // Galerkin product P^T A P of |level| into the next level
+    void assemble_coarse(int level);
+    void cycle(int level) const;
+
+    std::vector<std::unique_ptr<Level>> levels;
+    Eigen::LDLT<Eigen::MatrixXd> coarsest;
+};
+
+// Parallel y = A * x
+void sparse_multiply(const SparseAssembly::Matrix& A, const Eigen::VectorXd& x,
+                     Eigen::VectorXd& y);
+
+// Preconditioned conjugate gradients starting from |x|. Returns the number of iterations; the
+// relative residual is stored in |error|. Reductions use a fixed order, so the result does not
+// depend on the thread count.
+int conjugate_gradient(const SparseAssembly::Matrix& A, const Eigen::VectorXd& b,
+                       Eigen::VectorXd& x, const AMGPreconditioner& preconditioner,
+                       double tolerance, int max_iterations, double& error);
+
+} // namespace qflow
+
+#endif
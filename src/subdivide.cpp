@@ -147,9 +147,10 @@ void subdivide(MatrixXi &F, MatrixXd &V, VectorXd& rho, VectorXi &V2E, VectorXi
 
 void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, MatrixXd &O, MatrixXd* S,
                         VectorXi &V2E, VectorXi &E2E, VectorXi &boundary, VectorXi &nonmanifold,
-                        std::vector<Vector2i> &edge_diff, std::vector<DEdge> &edge_values,
-                        std::vector<Vector3i> &face_edgeOrients, std::vector<Vector3i> &face_edgeIds,
-                        std::vector<int>& sharp_edges, std::map<int, int> &singularities, int max_len) {
+                        DiffArray &edge_diff, std::vector<DEdge> &edge_values,
+                        EdgeRanks &edge_ranks, OrientArray &face_edgeOrients,
+                        std::vector<Vector3i> &face_edgeIds, BitArray& sharp_edges,
+                        FaceSingularities<int> &singularities, int max_len) {
     struct EdgeLink {
         int id;
         double length;
@@ -222,14 +223,14 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
             auto value = compat_orientation_extrinsic_index_4(
                 Q.col(v), N.col(v), face_spaces[f0].q, face_spaces[f0].n);
             if (F(j, f0) != v) orient += 2;
-            face_edgeOrients[f0][j] = (orient + value.second - value.first + 4) % 4;
+            face_edgeOrients.set(f0, j, (orient + value.second - value.first + 4) % 4);
         }
         face_spaces[f0].d = d;
         for (int j = 0; j < 3; ++j) {
             int eid = face_edgeIds[f0][j];
             int orient = face_edgeOrients[f0][j];
             auto diff = rshift90(diffs[f0 * 3 + j], (4 - orient) % 4);
-            edge_diff[eid] = diff;
+            edge_diff.set(eid, diff);
         }
     };
     auto FixOrient = [&](int f0) {
@@ -240,7 +241,7 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
                 while (orient < 4 && rshift90(diff, orient) != diffs[f0 * 3 + j]) orient += 1;
                 face_spaces[f0].d[j] =
                     (face_spaces[f0].d[j] + orient - face_edgeOrients[f0][j]) % 4;
-                face_edgeOrients[f0][j] = orient;
+                face_edgeOrients.set(f0, j, orient);
             }
         }
     };
@@ -289,7 +290,7 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
         }
         if (abs(diffs[e0][0]) < 2 && abs(diffs[e0][1]) < 2) continue;
         if (f1 != -1) {
-            face_edgeOrients.push_back(Vector3i());
+            face_edgeOrients.push_back(Vector3i::Zero());
             sharp_edges.push_back(0);
             sharp_edges.push_back(0);
             sharp_edges.push_back(0);
@@ -333,16 +334,19 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
         eid0 = eid;
         sharp_eid0 = sharp_eid;
         edge_values[eid0] = DEdge(v0, vn);
+        edge_ranks.update(Q, N, edge_values, eid0);
 
         eid1 = edge_values.size();
         sharp_eid1 = sharp_eid;
         edge_values.push_back(DEdge(vn, v1));
-        edge_diff.push_back(Vector2i());
+        edge_ranks.update(Q, N, edge_values, eid1);
+        edge_diff.push_back(Vector2i::Zero());
 
         eid0p = edge_values.size();
         sharp_eid0p = 0;
         edge_values.push_back(DEdge(vn, v0p));
-        edge_diff.push_back(Vector2i());
+        edge_ranks.update(Q, N, edge_values, eid0p);
+        edge_diff.push_back(Vector2i::Zero());
 
         int f2 = is_boundary ? -1 : (nF++);
         int f3 = nF++;
@@ -350,7 +354,7 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
         sharp_edges.push_back(0);
         sharp_edges.push_back(0);
         face_edgeIds.push_back(Vector3i());
-        face_edgeOrients.push_back(Vector3i());
+        face_edgeOrients.push_back(Vector3i::Zero());
 
         if (nF > F.cols()) {
             F.conservativeResize(F.rows(), std::max(nF, (int)F.cols() * 2));
@@ -368,9 +372,9 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
         auto orients1 = face_spaces[f0];
         F.col(f0) << vn, v0p, v0;
         face_edgeIds[f0] = Vector3i(eid0p, eid02, eid0);
-        sharp_edges[f0 * 3] = sharp_eid0p;
-        sharp_edges[f0 * 3 + 1] = sharp_eid02;
-        sharp_edges[f0 * 3 + 2] = sharp_eid0;
+        sharp_edges.set(f0 * 3, sharp_eid0p);
+        sharp_edges.set(f0 * 3 + 1, sharp_eid02);
+        sharp_edges.set(f0 * 3 + 2, sharp_eid0);
         
         diffs[f0 * 3] = D01 + D1p - D0n;
         diffs[f0 * 3 + 1] = Dp0;
@@ -396,11 +400,12 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
             eid1p = edge_values.size();
             sharp_eid1p = 0;
             edge_values.push_back(DEdge(vn, v1p));
-            edge_diff.push_back(Vector2i());
+            edge_ranks.update(Q, N, edge_values, eid1p);
+            edge_diff.push_back(Vector2i::Zero());
 
-            sharp_edges[f1 * 3] = sharp_eid0;
-            sharp_edges[f1 * 3 + 1] = sharp_eid11;
-            sharp_edges[f1 * 3 + 2] = sharp_eid1p;
+            sharp_edges.set(f1 * 3, sharp_eid0);
+            sharp_edges.set(f1 * 3 + 1, sharp_eid11);
+            sharp_edges.set(f1 * 3 + 2, sharp_eid1p);
             face_edgeIds[f1] = (Vector3i(eid0, eid11, eid1p));
             diffs[f1 * 3] = Dsn0;
             diffs[f1 * 3 + 1] = Ds0p;
@@ -409,9 +414,9 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
             AnalyzeOrient(f1, Vector3i(orients2.d[o2], orients2.d[(o2 + 1) % 3], 0));
 
             face_spaces[f2] = face_spaces[f1];
-            sharp_edges[f2 * 3] = sharp_eid1p;
-            sharp_edges[f2 * 3 + 1] = sharp_eid12;
-            sharp_edges[f2 * 3 + 2] = sharp_eid1;
+            sharp_edges.set(f2 * 3, sharp_eid1p);
+            sharp_edges.set(f2 * 3 + 1, sharp_eid12);
+            sharp_edges.set(f2 * 3 + 2, sharp_eid1);
             face_edgeIds[f2] = (Vector3i(eid1p, eid12, eid1));
             F.col(f2) << vn, v1p, v1;
             diffs[f2 * 3] = -Dsp1 - (Ds10 - Dsn0);
@@ -421,9 +426,9 @@ void subdivide_edgeDiff(MatrixXi &F, MatrixXd &V, MatrixXd &N, MatrixXd &Q, Matr
             AnalyzeOrient(f2, Vector3i(0, orients2.d[(o2 + 2) % 3], orients2.d[o2]));
         }
         face_spaces[f3] = face_spaces[f0];
-        sharp_edges[f3 * 3] = sharp_eid1;
-        sharp_edges[f3 * 3 + 1] = sharp_eid01;
-        sharp_edges[f3 * 3 + 2] = sharp_eid0p;
+        sharp_edges.set(f3 * 3, sharp_eid1);
+        sharp_edges.set(f3 * 3 + 1, sharp_eid01);
+        sharp_edges.set(f3 * 3 + 2, sharp_eid0p);
         face_edgeIds[f3] = (Vector3i(eid1, eid01, eid0p));
         F.col(f3) << vn, v1, v0p;
         diffs[f3 * 3] = D01 - D0n;